@@ -0,0 +1,674 @@
+//
+// Loopback benchmarks of the net layer, everything runs on 127.0.0.1.
+//
+//   opbench_net reuseport [max_threads] [seconds]
+//   opbench_net http-keepalive [requests]
+//   opbench_net http-pipeline [batch] [rounds]
+//   opbench_net http-server [loops] [clients] [seconds] [depth] [workers]
+//   opbench_net load [echo|http|large|all] [rate] [seconds] [connections] [body_kb]
+//   opbench_net static-file [size_kb] [clients] [seconds]
+//   opbench_net udp [batch] [size] [seconds]
+//   opbench_net uring-echo [clients] [seconds]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "net.hpp"
+#include "httpserver.hpp"
+#include "uring.hpp"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_t_;
+
+double seconds_since(clock_t_::time_point t) {
+    return std::chrono::duration<double>(clock_t_::now() - t).count();
+}
+
+// echoes everything back, one loop per thread
+class EchoServer : public op::TCPServer {
+public:
+    explicit EchoServer(bool reuseport = false) : op::TCPServer(0, reuseport) {}
+
+    void onReadable(SOCKET sd) override {
+        char buff[16 * 1024];
+        for (;;) {
+            int rc = ::recv(sd, buff, sizeof(buff), 0);
+            if (rc > 0) {
+                op::TCPSocket::write_all(sd, buff, rc);
+            } else {
+                if (rc == 0 || errno != EAGAIN) closeConnection(sd);
+                break;
+            }
+        }
+    }
+};
+
+// minimal HTTP/1.1 responder: "ok" for every request, honours Connection: close
+class HelloHTTPServer : public op::TCPServer {
+public:
+    HelloHTTPServer() : op::TCPServer(0) {}
+
+    void onAccept(SOCKET sd, sockaddr *, socklen_t) override {
+        op::TCPSocket::set_nodelay(sd, true);
+    }
+    void onClose(SOCKET sd) override { mIn.erase(sd); }
+    void onReadable(SOCKET sd) override {
+        char buff[16 * 1024];
+        int rc;
+        std::string & in = mIn[sd];
+        while ((rc = ::recv(sd, buff, sizeof(buff), 0)) > 0) {
+            in.append(buff, rc);
+        }
+        if (rc == 0 || errno != EAGAIN) {
+            closeConnection(sd);
+            return;
+        }
+        static const char resp[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+        for (size_t end; (end = in.find("\r\n\r\n")) != std::string::npos;) {
+            bool close = in.find("Connection: close") < end;
+            in.erase(0, end + 4);
+            op::TCPSocket::write_all(sd, resp, sizeof(resp) - 1);
+            if (close) {
+                closeConnection(sd);
+                return;
+            }
+        }
+    }
+
+private:
+    std::map<SOCKET, std::string> mIn;
+};
+
+// runs body(stop) on `clients` threads for `seconds`, returns sum of the results
+uint64_t run_clients(unsigned clients, double seconds,
+                     std::function<uint64_t(const std::atomic<bool> &)> body) {
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> total(0);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < clients; ++i) {
+        threads.emplace_back([&] { total += body(stop); });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    return total;
+}
+
+// connect, one 64 byte round trip, close
+uint64_t connect_once(unsigned port, const std::atomic<bool> & stop) {
+    char buff[64] = {0};
+    uint64_t n = 0;
+    while (!stop) {
+        op::TCPSocket client("127.0.0.1", port);
+        if (!client.isOk()
+                || client.write_all(buff, sizeof(buff)) != sizeof(buff)
+                || client.read_all(buff, sizeof(buff)) != sizeof(buff)) {
+            break;
+        }
+        ++n;
+    }
+    return n;
+}
+
+// 64 byte round trips over one connection
+uint64_t ping_pong(unsigned port, const std::atomic<bool> & stop) {
+    char buff[64] = {0};
+    uint64_t n = 0;
+    op::TCPSocket client("127.0.0.1", port);
+    while (!stop && client.isOk()) {
+        if (client.write_all(buff, sizeof(buff)) != sizeof(buff)
+                || client.read_all(buff, sizeof(buff)) != sizeof(buff)) {
+            break;
+        }
+        ++n;
+    }
+    return n;
+}
+
+int bench_reuseport(int argc, char ** argv) {
+    unsigned max_threads = argc > 2 ? atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+    unsigned clients = std::max(4u, 2 * max_threads);
+
+    std::cout << "SO_REUSEPORT reactors, " << clients << " client threads, "
+              << seconds << " s per run" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "conn/s"
+              << std::setw(14) << "req/s" << std::endl;
+    for (unsigned n = 1; n <= max_threads; n *= 2) {
+        EchoServer server(true);
+        if (!server.isOk()) {
+            std::cerr << "can't start server" << std::endl;
+            return 1;
+        }
+        unsigned port = server.port();
+        std::thread th([&server, n] { server.eventLoop(n); });
+
+        uint64_t conns = run_clients(clients, seconds, [port](const std::atomic<bool> & stop) {
+            return connect_once(port, stop);
+        });
+        uint64_t reqs = run_clients(clients, seconds, [port](const std::atomic<bool> & stop) {
+            return ping_pong(port, stop);
+        });
+        server.stop();
+        th.join();
+
+        std::cout << std::setw(8) << n
+                  << std::setw(14) << (uint64_t) (conns / seconds)
+                  << std::setw(14) << (uint64_t) (reqs / seconds) << std::endl;
+        if (n < max_threads && n * 2 > max_threads) n = max_threads / 2;
+    }
+    return 0;
+}
+
+int bench_http_keepalive(int argc, char ** argv) {
+    unsigned requests = argc > 2 ? atoi(argv[2]) : 20000;
+
+    HelloHTTPServer server;
+    if (!server.isOk()) {
+        std::cerr << "can't start server" << std::endl;
+        return 1;
+    }
+    std::thread th([&server] { server.eventLoop(); });
+
+    std::cout << "HTTP GET on loopback, " << requests << " sequential requests" << std::endl;
+    std::cout << std::setw(12) << "mode" << std::setw(14) << "req/s"
+              << std::setw(14) << "avg us" << std::endl;
+    for (int keepalive = 0; keepalive < 2; ++keepalive) {
+        op::HTTPConnectionPool pool;
+        op::HTTP http("127.0.0.1", server.port());
+        http.setPool(&pool);
+        http.setKeepAlive(keepalive != 0);
+        clock_t_::time_point start = clock_t_::now();
+        for (unsigned i = 0; i < requests; ++i) {
+            if (http.GET("/") != 200) {
+                std::cerr << "request failed" << std::endl;
+                break;
+            }
+        }
+        double elapsed = seconds_since(start);
+        std::cout << std::setw(12) << (keepalive ? "keep-alive" : "close")
+                  << std::setw(14) << (uint64_t) (requests / elapsed)
+                  << std::setw(14) << std::fixed << std::setprecision(1)
+                  << elapsed * 1e6 / requests << std::endl;
+    }
+    server.stop();
+    th.join();
+    return 0;
+}
+
+int bench_http_pipeline(int argc, char ** argv) {
+    unsigned batch  = argc > 2 ? atoi(argv[2]) : 500;
+    unsigned rounds = argc > 3 ? atoi(argv[3]) : 20;
+
+    HelloHTTPServer server;
+    if (!server.isOk()) {
+        std::cerr << "can't start server" << std::endl;
+        return 1;
+    }
+    std::thread th([&server] { server.eventLoop(); });
+
+    op::HTTPConnectionPool pool;
+    op::HTTP http("127.0.0.1", server.port());
+    http.setPool(&pool);
+    http.setKeepAlive(true);
+
+    std::vector<op::HTTP::Request> requests(batch);
+    for (size_t i = 0; i < requests.size(); ++i) {
+        requests[i].Method = "GET";
+        requests[i].Uri = "/item/" + std::to_string(i);
+    }
+
+    double sequential = 0, pipelined = 0, latency = 0;
+    for (unsigned r = 0; r < rounds; ++r) {
+        clock_t_::time_point start = clock_t_::now();
+        for (size_t i = 0; i < requests.size(); ++i) {
+            http.GET(requests[i].Uri);
+        }
+        sequential += seconds_since(start) * 1e3;
+
+        std::vector<op::HTTP::Response> responses;
+        double total = 0;
+        if (http.pipeline(requests, &responses, &total) != requests.size()) {
+            std::cerr << "pipeline failed" << std::endl;
+            break;
+        }
+        pipelined += total;
+        for (size_t i = 0; i < responses.size(); ++i) latency += responses[i].LatencyMs;
+    }
+    server.stop();
+    th.join();
+
+    std::cout << "HTTP batch of " << batch << " GETs, " << rounds << " rounds" << std::endl;
+    std::cout << std::fixed << std::setprecision(3)
+              << "sequential keep-alive: " << sequential / rounds << " ms per batch" << std::endl
+              << "pipelined:             " << pipelined / rounds << " ms per batch, "
+              << latency / rounds / batch << " ms mean request latency" << std::endl;
+    return 0;
+}
+
+// keeps `depth` raw GETs in flight on one connection, answers are of known size
+uint64_t http_load(unsigned port, unsigned depth, size_t answer, const std::atomic<bool> & stop) {
+    static const char req[] = "GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    std::string batch;
+    for (unsigned i = 0; i < depth; ++i) batch.append(req, sizeof(req) - 1);
+    std::vector<char> buff(answer * depth);
+    op::TCPSocket client("127.0.0.1", port);
+    op::TCPSocket::set_nodelay(client.sd(), true);
+    uint64_t n = 0;
+    while (!stop && client.isOk()) {
+        if (client.write_all(batch.data(), (int) batch.size()) != (int) batch.size()
+                || client.read_all(&buff[0], (int) buff.size()) != (int) buff.size()) {
+            break;
+        }
+        n += depth;
+    }
+    return n;
+}
+
+int bench_http_server(int argc, char ** argv) {
+    unsigned loops   = argc > 2 ? atoi(argv[2]) : 1;
+    unsigned clients = argc > 3 ? atoi(argv[3]) : 4;
+    double seconds   = argc > 4 ? atof(argv[4]) : 2.0;
+    unsigned depth   = argc > 5 ? atoi(argv[5]) : 16;
+    unsigned workers = argc > 6 ? atoi(argv[6]) : 0;
+
+    op::HTTPServer server(0, true);
+    if (!server.isOk()) {
+        std::cerr << "can't start server" << std::endl;
+        return 1;
+    }
+    server.setWorkers(workers);
+    server.route("GET", "/hello", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        resp.set(200, "hello world");
+    });
+    std::thread th([&server, loops] { server.run(loops); });
+
+    // size of one answer
+    op::HTTPConnectionPool pool;
+    op::HTTP probe("127.0.0.1", server.port());
+    probe.setPool(&pool);
+    probe.setKeepAlive(true);
+    probe.GET("/hello");
+    size_t answer = strlen(probe.headers()) + probe.bodySize();
+
+    unsigned port = server.port();
+    uint64_t total = run_clients(clients, seconds, [=](const std::atomic<bool> & stop) {
+        return http_load(port, depth, answer, stop);
+    });
+    server.stop();
+    th.join();
+
+    std::cout << "HTTPServer loops=" << loops << " workers=" << workers
+              << " clients=" << clients << " pipeline depth=" << depth << std::endl
+              << (uint64_t) (total / seconds) << " req/s" << std::endl;
+    return 0;
+}
+
+// GETs the uri over keep-alive, returns received body bytes
+uint64_t http_download(unsigned port, const std::string & uri, const std::atomic<bool> & stop) {
+    op::HTTPConnectionPool pool;
+    op::HTTP http("127.0.0.1", port);
+    http.setPool(&pool);
+    http.setKeepAlive(true);
+    uint64_t bytes = 0;
+    while (!stop) {
+        int status = http.GET(uri, std::string(), [&bytes](const char *, size_t size) {
+            bytes += size;
+            return true;
+        });
+        if (status != 200) break;
+    }
+    return bytes;
+}
+
+// file body by sendfile()/mmap against reading the file into the body
+int bench_static_file(int argc, char ** argv) {
+    size_t size      = (argc > 2 ? atoi(argv[2]) : 1024) * 1024;
+    unsigned clients = argc > 3 ? atoi(argv[3]) : 2;
+    double seconds   = argc > 4 ? atof(argv[4]) : 2.0;
+
+    char dir[] = "/tmp/opbenchXXXXXX";
+    if (!::mkdtemp(dir)) {
+        std::cerr << "can't create temp dir" << std::endl;
+        return 1;
+    }
+    const std::string path = std::string(dir) + "/blob.bin";
+    std::ofstream(path, std::ios::binary) << std::string(size, 'x');
+
+    op::HTTPServer server(0);
+    if (!server.isOk()) {
+        std::cerr << "can't start server" << std::endl;
+        return 1;
+    }
+    server.serveFiles("/files/", dir);
+    server.route("GET", "/buffer", [path](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream body;
+        body << in.rdbuf();
+        resp.set(200, body.str(), "application/octet-stream");
+    });
+    std::thread th([&server] { server.run(); });
+
+    std::cout << "file " << size / 1024 << " KB, clients=" << clients
+              << (size <= op::HTTPFileBody::MMAP_LIMIT ? " (mmap)" : " (sendfile)") << std::endl;
+    unsigned port = server.port();
+    const char * uris[] = { "/files/blob.bin", "/buffer" };
+    const char * names[] = { "zero-copy", "read+copy" };
+    for (int i = 0; i < 2; ++i) {
+        std::string uri = uris[i];
+        uint64_t bytes = run_clients(clients, seconds, [port, uri](const std::atomic<bool> & stop) {
+            return http_download(port, uri, stop);
+        });
+        std::cout << std::setw(10) << names[i] << std::setw(10)
+                  << (uint64_t) (bytes / seconds / (1024 * 1024)) << " MB/s"
+                  << std::setw(10) << (uint64_t) (bytes / size / seconds) << " req/s" << std::endl;
+    }
+    server.stop();
+    th.join();
+    ::unlink(path.c_str());
+    ::rmdir(dir);
+    return 0;
+}
+
+// datagrams per second sent and received on loopback, one sender
+// and one receiver thread, per-datagram syscalls against batches
+int bench_udp(int argc, char ** argv) {
+    unsigned batchSize = argc > 2 ? atoi(argv[2]) : 64;
+    size_t size        = argc > 3 ? atoi(argv[3]) : 64;
+    double seconds     = argc > 4 ? atof(argv[4]) : 2.0;
+
+    std::cout << "datagram " << size << " bytes, batch " << batchSize << std::endl
+              << std::setw(10) << "mode" << std::setw(14) << "sent/s" << std::setw(14) << "received/s"
+              << std::endl;
+    const std::string payload(size, 'm');
+    for (int batched = 0; batched < 2; ++batched) {
+        op::UDPSocket rx;
+        if (!rx.isOk() || !rx.bind("127.0.0.1", 0)) {
+            std::cerr << "can't bind" << std::endl;
+            return 1;
+        }
+        op::UDPSocket::set_rcvbuf(rx.sd(), 4 << 20);
+        op::UDPSocket tx("127.0.0.1", rx.port());
+
+        std::atomic<bool> stop(false);
+        uint64_t received = 0;
+        std::thread reader([&] {
+            if (batched) {
+                op::UDPBatch batch(batchSize, size);
+                received = rx.receive(batch, [](const op::UDPBatch &) { return true; }, stop);
+                return;
+            }
+            std::vector<char> buff(size);
+            while (!stop) {
+                int rc = ::recv(rx.sd(), &buff[0], (int) buff.size(), MSG_DONTWAIT);
+                if (rc >= 0) {
+                    ++received;
+                    continue;
+                }
+                pollfd pfd = { rx.sd(), POLLIN, 0 };
+                ::poll(&pfd, 1, 100);
+            }
+        });
+
+        uint64_t sent = 0;
+        op::UDPBatch batch(batchSize);
+        for (unsigned i = 0; i < batchSize; ++i) {
+            batch.add(payload.data(), payload.size());
+        }
+        const clock_t_::time_point start = clock_t_::now();
+        while (seconds_since(start) < seconds) {
+            for (int i = 0; i < 64; ++i) {
+                if (batched) {
+                    int rc = tx.write_batch(batch);
+                    if (rc > 0) sent += rc;
+                } else {
+                    for (unsigned j = 0; j < batchSize; ++j) {
+                        if (tx.write_all(payload.data(), (int) payload.size()) > 0) ++sent;
+                    }
+                }
+            }
+        }
+        // let the reader drain the socket buffer
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        stop = true;
+        reader.join();
+
+        std::cout << std::setw(10) << (batched ? "batched" : "single")
+                  << std::setw(14) << (uint64_t) (sent / seconds)
+                  << std::setw(14) << (uint64_t) (received / seconds) << std::endl;
+    }
+    return 0;
+}
+
+// requests of one connection of the open-loop client
+struct LoadStats {
+    std::vector<double> LatencyUs;
+    uint64_t Errors = 0;
+};
+
+// open loop: request i is sent at first + i * interval whether or not the
+// earlier ones were answered, and its latency counts from that moment, so
+// a server that falls behind shows in the tail instead of slowing the client
+void load_connection(unsigned port, const std::string & request, size_t answer, uint64_t count,
+                     clock_t_::duration interval, clock_t_::time_point first, LoadStats * stats) {
+    op::TCPSocket client("127.0.0.1", port);
+    if (!client.isOk()) {
+        stats->Errors = count;
+        return;
+    }
+    op::TCPSocket::set_nodelay(client.sd(), true);
+    op::TCPSocket::set_rcvtimeo(client.sd(), 5);
+    stats->LatencyUs.reserve(count);
+
+    std::atomic<bool> failed(false);
+    std::thread writer([&] {
+        for (uint64_t i = 0; i < count && !failed; ++i) {
+            std::this_thread::sleep_until(first + interval * i);
+            if (client.write_all(request.data(), (int) request.size()) != (int) request.size()) {
+                failed = true;
+            }
+        }
+    });
+    std::vector<char> buff(answer);
+    for (uint64_t i = 0; i < count && !failed; ++i) {
+        if (client.read_all(&buff[0], (int) answer) != (int) answer) {
+            failed = true;
+            ::shutdown(client.sd(), SHUT_RDWR);   // wakes the writer
+            break;
+        }
+        stats->LatencyUs.push_back(std::chrono::duration<double, std::micro>(
+            clock_t_::now() - (first + interval * i)).count());
+    }
+    writer.join();
+    stats->Errors = count - stats->LatencyUs.size();
+}
+
+// one workload at the rate over the connections, prints a row of the table
+bool load_run(const char * name, unsigned port, const std::string & request, size_t answer,
+              double rate, double seconds, unsigned connections) {
+    const uint64_t perConnection = std::max<uint64_t>(1, (uint64_t) (rate * seconds / connections));
+    const auto interval = std::chrono::duration_cast<clock_t_::duration>(
+        std::chrono::duration<double>(connections / rate));
+    const auto stagger = std::chrono::duration_cast<clock_t_::duration>(
+        std::chrono::duration<double>(1 / rate));
+
+    std::vector<LoadStats> stats(connections);
+    std::vector<std::thread> threads;
+    const clock_t_::time_point start = clock_t_::now() + std::chrono::milliseconds(50);
+    for (unsigned c = 0; c < connections; ++c) {
+        threads.emplace_back(load_connection, port, std::cref(request), answer, perConnection,
+                             interval, start + stagger * c, &stats[c]);
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    const double elapsed = std::chrono::duration<double>(clock_t_::now() - start).count();
+
+    std::vector<double> all;
+    uint64_t errors = 0;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        all.insert(all.end(), stats[i].LatencyUs.begin(), stats[i].LatencyUs.end());
+        errors += stats[i].Errors;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double q) {
+        return all.empty() ? 0.0 : all[std::min(all.size() - 1, (size_t) (q * all.size()))];
+    };
+    std::cout << std::setw(8) << name << std::setw(10) << (uint64_t) rate
+              << std::setw(12) << (uint64_t) (all.size() / elapsed)
+              << std::setw(12) << (uint64_t) (all.size() * answer / elapsed / (1024 * 1024))
+              << std::fixed << std::setprecision(0)
+              << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99)
+              << std::setw(10) << percentile(0.999) << std::setw(10) << (all.empty() ? 0.0 : all.back())
+              << std::setw(8) << errors << std::endl;
+    return errors == 0;
+}
+
+// size of the answer to GET uri, head included
+size_t http_answer_size(unsigned port, const std::string & uri) {
+    op::HTTPConnectionPool pool;
+    op::HTTP probe("127.0.0.1", port);
+    probe.setPool(&pool);
+    probe.setKeepAlive(true);
+    if (probe.GET(uri) != 200) return 0;
+    return strlen(probe.headers()) + probe.bodySize();
+}
+
+// open-loop load at a fixed rate: 64 byte echo, small HTTP answers and
+// large HTTP bodies; the rate is the total of all connections, by default
+// it depends on the workload
+int bench_load(int argc, char ** argv) {
+    std::string workload = argc > 2 ? argv[2] : "all";
+    double rate          = argc > 3 ? atof(argv[3]) : 0;
+    double seconds       = argc > 4 ? atof(argv[4]) : 2.0;
+    unsigned connections = argc > 5 ? std::max(1, atoi(argv[5])) : 4;
+    size_t bodySize      = (argc > 6 ? atoi(argv[6]) : 256) * 1024;
+    if (workload != "all" && workload != "echo" && workload != "http" && workload != "large") {
+        std::cerr << "unknown workload '" << workload << "'" << std::endl;
+        return 1;
+    }
+
+    std::cout << "open-loop load, " << connections << " connections, " << seconds << " s, "
+              << "latency in us" << std::endl
+              << std::setw(8) << "load" << std::setw(10) << "rate" << std::setw(12) << "req/s"
+              << std::setw(12) << "MB/s" << std::setw(10) << "p50" << std::setw(10) << "p99"
+              << std::setw(10) << "p999" << std::setw(10) << "max" << std::setw(8) << "errors"
+              << std::endl;
+    bool ok = true;
+    if (workload == "all" || workload == "echo") {
+        EchoServer server;
+        if (!server.isOk()) {
+            std::cerr << "can't start server" << std::endl;
+            return 1;
+        }
+        std::thread th([&server] { server.eventLoop(); });
+        ok &= load_run("echo", server.port(), std::string(64, 'e'), 64,
+                       rate > 0 ? rate : 20000, seconds, connections);
+        server.stop();
+        th.join();
+    }
+    if (workload == "all" || workload == "http" || workload == "large") {
+        op::HTTPServer server(0);
+        if (!server.isOk()) {
+            std::cerr << "can't start server" << std::endl;
+            return 1;
+        }
+        const std::string large(bodySize, 'b');
+        server.route("GET", "/hello", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+            resp.set(200, "hello world");
+        });
+        server.route("GET", "/large", [&large](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+            resp.set(200, large, "application/octet-stream");
+        });
+        std::thread th([&server] { server.run(); });
+        const unsigned port = server.port();
+        if (workload != "large") {
+            ok &= load_run("http", port, "GET /hello HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n",
+                           http_answer_size(port, "/hello"), rate > 0 ? rate : 20000, seconds, connections);
+        }
+        if (workload != "http") {
+            ok &= load_run("large", port, "GET /large HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n",
+                           http_answer_size(port, "/large"), rate > 0 ? rate : 500, seconds, connections);
+        }
+        server.stop();
+        th.join();
+    }
+    return ok ? 0 : 1;
+}
+
+class URingEchoServer : public op::URingServer {
+public:
+    URingEchoServer() : op::URingServer(0) {}
+    void onData(SOCKET sd, const char * data, size_t size) override { send(sd, data, size); }
+};
+
+// 64 byte ping-pong echo on the epoll and the io_uring backends
+int bench_uring_echo(int argc, char ** argv) {
+    unsigned clients = argc > 2 ? atoi(argv[2]) : 16;
+    double seconds   = argc > 3 ? atof(argv[3]) : 2.0;
+
+    std::cout << "echo, " << clients << " clients, io_uring "
+              << (op::IOURing::supported() ? "supported" : "not supported") << std::endl
+              << std::setw(10) << "backend" << std::setw(14) << "req/s" << std::setw(16)
+              << "syscalls/req" << std::endl;
+    const op::URingServer::Backend backends[] = { op::URingServer::EPOLL, op::URingServer::URING };
+    for (op::URingServer::Backend backend : backends) {
+        URingEchoServer server;
+        if (!server.isOk()) {
+            std::cerr << "can't start server" << std::endl;
+            return 1;
+        }
+        std::thread th([&server, backend] { server.run(backend); });
+        unsigned port = server.port();
+        uint64_t reqs = run_clients(clients, seconds, [port](const std::atomic<bool> & stop) {
+            return ping_pong(port, stop);
+        });
+        server.stop();
+        th.join();
+        std::cout << std::setw(10) << (server.backend() == op::URingServer::URING ? "io_uring" : "epoll")
+                  << std::setw(14) << (uint64_t) (reqs / seconds)
+                  << std::setw(16) << std::fixed << std::setprecision(2)
+                  << (reqs ? (double) server.syscalls() / reqs : 0.0) << std::endl;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    std::map<std::string, std::function<int(int, char**)> > benches;
+    benches["reuseport"] = bench_reuseport;
+    benches["http-keepalive"] = bench_http_keepalive;
+    benches["http-pipeline"] = bench_http_pipeline;
+    benches["http-server"] = bench_http_server;
+    benches["load"] = bench_load;
+    benches["static-file"] = bench_static_file;
+    benches["udp"] = bench_udp;
+    benches["uring-echo"] = bench_uring_echo;
+
+    std::string name = argc > 1 ? argv[1] : "";
+    auto it = benches.find(name);
+    if (it == benches.end()) {
+        std::cerr << "usage: " << argv[0] << " <bench> [args...]" << std::endl << "benches:";
+        for (auto & b : benches) std::cerr << " " << b.first;
+        std::cerr << std::endl;
+        return 1;
+    }
+    return it->second(argc, argv);
+}
@@ -0,0 +1,261 @@
+//
+// WorkerPool benchmarks: the shared queue against work stealing.
+//
+//   opbench_pool scaling [max_threads] [jobs] [work]
+//   opbench_pool submit [producers] [workers] [jobs] [capacity] [batch]
+//   opbench_pool algorithms [size] [threads]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <cstdlib>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cmath>
+
+#include "pool.hpp"
+#include "parallel.hpp"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_t_;
+
+double seconds_since(clock_t_::time_point t) {
+    return std::chrono::duration<double>(clock_t_::now() - t).count();
+}
+
+// `work` rounds of arithmetic the optimizer can't drop
+uint64_t spin(unsigned work, uint64_t seed) {
+    for (unsigned i = 0; i < work; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    return seed;
+}
+
+// depth > 0 splits in two jobs queued from the worker itself,
+// depth == 0 is a leaf doing the actual work
+struct Job {
+    unsigned Depth;
+    uint64_t Seed;
+};
+
+class BenchPool : public op::WorkerPool<Job> {
+public:
+    explicit BenchPool(unsigned work) : mWork(work), mLeaves(0), mSink(0) {}
+
+    void run(unsigned threads, Scheduling scheduling, const std::vector<Job> & jobs, uint64_t leaves) {
+        mLeaves = 0;
+        Start(threads, scheduling);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            QueueJob(jobs[i]);
+        }
+        while (mLeaves.load(std::memory_order_acquire) < leaves) {
+            std::this_thread::yield();
+        }
+        Stop();
+    }
+
+    // `producers` threads queue `jobs` leaves between them, QueueJobs() by `batch`
+    void produce(unsigned workers, unsigned producers, uint64_t jobs, unsigned batch) {
+        mLeaves = 0;
+        Start(workers);
+        std::vector<std::thread> threads;
+        for (unsigned p = 0; p < producers; ++p) {
+            threads.emplace_back([this, p, producers, jobs, batch] {
+                std::vector<Job> pack;
+                for (uint64_t i = p; i < jobs; i += producers) {
+                    if (batch < 2) {
+                        QueueJob(Job{0, i});
+                        continue;
+                    }
+                    pack.push_back(Job{0, i});
+                    if (pack.size() == batch) {
+                        QueueJobs(pack);
+                        pack.clear();
+                    }
+                }
+                QueueJobs(pack);
+            });
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+        while (mLeaves.load(std::memory_order_acquire) < jobs) {
+            std::this_thread::yield();
+        }
+        Stop();
+    }
+
+protected:
+    void ServeJob(Job job) override {
+        if (job.Depth > 0) {
+            QueueJob(Job{job.Depth - 1, job.Seed * 2});
+            QueueJob(Job{job.Depth - 1, job.Seed * 2 + 1});
+            return;
+        }
+        mSink += spin(mWork, job.Seed);
+        mLeaves.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    unsigned mWork;
+    std::atomic<uint64_t> mLeaves;
+    std::atomic<uint64_t> mSink;
+};
+
+// `jobs` fine grained jobs queued from outside (flat) and the same number of
+// leaves spawned by a binary tree of jobs (recursive), threads 1..max_threads
+int bench_scaling(int argc, char ** argv) {
+    unsigned max_threads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+    unsigned jobs = argc > 3 ? atoi(argv[3]) : 200000;
+    unsigned work = argc > 4 ? atoi(argv[4]) : 200;
+    if (max_threads == 0) max_threads = 1;
+
+    unsigned depth = 0;
+    while ((2u << depth) <= jobs) ++depth;
+    std::vector<Job> flat(jobs, Job{0, 1});
+    for (unsigned i = 0; i < jobs; ++i) flat[i].Seed = i;
+    std::vector<Job> tree(1, Job{depth, 1});
+
+    std::cout << "jobs " << jobs << ", work " << work << ", tree depth " << depth << std::endl;
+    std::cout << std::setw(10) << "workload" << std::setw(9) << "threads"
+              << std::setw(14) << "queue jobs/s" << std::setw(16) << "stealing jobs/s"
+              << std::setw(9) << "speedup" << std::endl;
+
+    const char * names[] = { "flat", "recursive" };
+    for (int w = 0; w < 2; ++w) {
+        const std::vector<Job> & input = w == 0 ? flat : tree;
+        const uint64_t leaves = w == 0 ? jobs : (1ULL << depth);
+        for (unsigned threads = 1; threads <= max_threads; ++threads) {
+            double rate[2];
+            for (int mode = 0; mode < 2; ++mode) {
+                BenchPool pool(work);
+                auto start = clock_t_::now();
+                pool.run(threads, mode == 0 ? BenchPool::SHARED_QUEUE : BenchPool::WORK_STEALING, input, leaves);
+                rate[mode] = leaves / seconds_since(start);
+            }
+            std::cout << std::setw(10) << names[w] << std::setw(9) << threads
+                      << std::setw(14) << (uint64_t) rate[0] << std::setw(16) << (uint64_t) rate[1]
+                      << std::setw(9) << std::fixed << std::setprecision(2) << rate[1] / rate[0]
+                      << std::endl;
+        }
+    }
+    return 0;
+}
+
+// many producers submitting tiny jobs: the locked queue against BoundedQueue
+int bench_submit(int argc, char ** argv) {
+    unsigned producers = argc > 2 ? atoi(argv[2]) : 4;
+    unsigned workers = argc > 3 ? atoi(argv[3]) : 2;
+    unsigned jobs = argc > 4 ? atoi(argv[4]) : 1000000;
+    unsigned capacity = argc > 5 ? atoi(argv[5]) : 65536;
+    unsigned batch = argc > 6 ? atoi(argv[6]) : 256;
+
+    std::cout << std::setw(10) << "queue" << std::setw(11) << "producers"
+              << std::setw(9) << "workers" << std::setw(7) << "batch"
+              << std::setw(14) << "jobs/s" << std::endl;
+    for (int bounded = 0; bounded < 2; ++bounded) {
+        for (unsigned b = 1; ; b = batch) {
+            BenchPool pool(10);
+            if (bounded) pool.SetBoundedQueue(capacity, BenchPool::BLOCK);
+            auto start = clock_t_::now();
+            pool.produce(workers, producers, jobs, b);
+            std::cout << std::setw(10) << (bounded ? "bounded" : "mutex") << std::setw(11) << producers
+                      << std::setw(9) << workers << std::setw(7) << b
+                      << std::setw(14) << (uint64_t) (jobs / seconds_since(start)) << std::endl;
+            if (b == batch) break;
+        }
+    }
+    return 0;
+}
+
+// best of `rounds` runs of body(), seconds
+double best_of(int rounds, const std::function<void()> & prepare, const std::function<void()> & body) {
+    double best = 1e9;
+    for (int i = 0; i < rounds; ++i) {
+        prepare();
+        auto start = clock_t_::now();
+        body();
+        best = std::min(best, seconds_since(start));
+    }
+    return best;
+}
+
+// op::parallel_* against the serial STL on `size` elements
+int bench_algorithms(int argc, char ** argv) {
+    size_t size = argc > 2 ? atol(argv[2]) : 10000000;
+    unsigned threads = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    op::TaskPool pool(threads);
+    std::vector<double> input(size), output(size);
+    std::mt19937_64 rng(42);
+    for (size_t i = 0; i < size; ++i) input[i] = (double) (rng() % 1000000);
+    std::vector<double> data;
+    volatile double sink = 0;
+    auto nothing = [] {};
+    auto reset = [&] { data = input; };
+    auto heavy = [](double x) { return std::sqrt(x) * std::log1p(x); };
+
+    std::cout << "size " << size << ", threads " << pool.threads() << std::endl;
+    std::cout << std::setw(12) << "algorithm" << std::setw(12) << "serial ms"
+              << std::setw(14) << "parallel ms" << std::setw(9) << "speedup" << std::endl;
+    auto row = [](const char * name, double serial, double parallel) {
+        std::cout << std::setw(12) << name << std::setw(12) << std::fixed << std::setprecision(2)
+                  << serial * 1000 << std::setw(14) << parallel * 1000
+                  << std::setw(9) << serial / parallel << std::endl;
+    };
+
+    row("for",
+        best_of(3, nothing, [&] { for (size_t i = 0; i < size; ++i) output[i] = heavy(input[i]); }),
+        best_of(3, nothing, [&] {
+            op::parallel_for(pool, (size_t) 0, size, [&](size_t i) { output[i] = heavy(input[i]); });
+        }));
+    row("transform",
+        best_of(3, nothing, [&] { std::transform(input.begin(), input.end(), output.begin(), heavy); }),
+        best_of(3, nothing, [&] {
+            op::parallel_transform(pool, input.begin(), input.end(), output.begin(), heavy);
+        }));
+    row("reduce",
+        best_of(3, nothing, [&] { sink = std::accumulate(input.begin(), input.end(), 0.0); }),
+        best_of(3, nothing, [&] {
+            sink = op::parallel_reduce(pool, input.begin(), input.end(), 0.0, std::plus<double>());
+        }));
+    row("sort",
+        best_of(3, reset, [&] { std::sort(data.begin(), data.end()); }),
+        best_of(3, reset, [&] { op::parallel_sort(pool, data.begin(), data.end()); }));
+    row("stable_sort",
+        best_of(3, reset, [&] { std::stable_sort(data.begin(), data.end()); }),
+        best_of(3, reset, [&] { op::parallel_sort(pool, data.begin(), data.end()); }));
+    if (!std::is_sorted(data.begin(), data.end())) {
+        std::cerr << "parallel_sort: not sorted" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    std::map<std::string, std::function<int(int, char**)> > benches;
+    benches["scaling"] = bench_scaling;
+    benches["submit"] = bench_submit;
+    benches["algorithms"] = bench_algorithms;
+
+    std::string name = argc > 1 ? argv[1] : "";
+    auto it = benches.find(name);
+    if (it == benches.end()) {
+        std::cerr << "usage: " << argv[0] << " <bench> [args...]" << std::endl << "benches:";
+        for (auto & b : benches) std::cerr << " " << b.first;
+        std::cerr << std::endl;
+        return 1;
+    }
+    return it->second(argc, argv);
+}
@@ -0,0 +1,810 @@
+//
+// Copyright (C) 2026 Oleg Polivets. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 
+// 1. Redistributions of source code must retain the above copyright 
+//    notice, this list of conditions and the following disclaimer.  
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.  
+// 3. Neither the name of the project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission. 
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+// SUCH DAMAGE.
+// 
+
+#pragma once
+
+#if defined(__linux__) && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <set>
+#include <utility>
+#include "net.hpp"
+
+namespace op {
+
+/*
+ * C++20 coroutines over EventLoop. The header is empty for older
+ * standards. Operations of AsyncSocket and AsyncHTTP are awaited from
+ * tasks started with AsyncLoop::spawn(); a waiting task costs its frame
+ * only, so one thread keeps thousands of connections busy and a few
+ * threads with an AsyncLoop each scale that further.
+ */
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> Continuation;
+    std::exception_ptr Error;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> next = h.promise().Continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { Error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> Value;
+
+    Task<T> get_return_object();
+    template <typename U>
+    void return_value(U && value) { Value.emplace(std::forward<U>(value)); }
+    T result() {
+        if (Error) std::rethrow_exception(Error);
+        return std::move(*Value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (Error) std::rethrow_exception(Error);
+    }
+};
+
+}  // namespace detail
+
+/*
+ * Lazily started coroutine. It runs when awaited and resumes the
+ * awaiting one when done, exceptions are rethrown to it.
+ */
+
+template <typename T>
+class Task {
+public:
+    typedef detail::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_t;
+
+    Task() {}
+    explicit Task(handle_t h) : mHandle(h) {}
+    Task(Task && other) noexcept : mHandle(std::exchange(other.mHandle, handle_t())) {}
+    Task & operator= (Task && other) noexcept {
+        if (this != &other) {
+            destroy();
+            mHandle = std::exchange(other.mHandle, handle_t());
+        }
+        return *this;
+    }
+    ~Task() { destroy(); }
+
+    bool valid() const { return (bool) mHandle; }
+    bool done() const  { return !mHandle || mHandle.done(); }
+
+    bool await_ready() const noexcept { return mHandle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        mHandle.promise().Continuation = awaiting;
+        return mHandle;
+    }
+    T await_resume() { return mHandle.promise().result(); }
+
+private:
+    handle_t mHandle;
+
+    void destroy() {
+        if (mHandle) mHandle.destroy();
+        mHandle = handle_t();
+    }
+
+    Task(const Task &);
+    Task & operator= (const Task &);
+};
+
+namespace detail {
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+}  // namespace detail
+
+class AsyncLoop;
+
+// suspended operation, linked into the loop while it waits
+struct AsyncWaiter {
+    typedef std::multimap<Deadline::clock::time_point, AsyncWaiter *> Timers;
+
+    AsyncLoop * Loop = 0;
+    std::coroutine_handle<> Handle;
+    SOCKET Sd = INVALID_SOCKET;
+    unsigned Events = 0;
+    int Result = 0;
+    int OnTimer = ETIMEDOUT;    // result when the deadline comes
+    bool Parked = false;
+    bool HasTimer = false;
+    Timers::iterator Timer;
+    class CancelToken * Cancel = 0;
+    AsyncWaiter * CancelPrev = 0;
+    AsyncWaiter * CancelNext = 0;
+};
+
+/*
+ * Cancels a group of operations: the waiting ones are woken with
+ * ECANCELED and the later ones fail at once until reset(). Belongs to
+ * the loop thread, other threads post() the cancel().
+ */
+
+class CancelToken {
+public:
+    CancelToken() : mCancelled(false), mWaiters(0) {}
+    ~CancelToken() { cancel(); }
+
+    void cancel();
+    void reset() { mCancelled = false; }
+    bool cancelled() const { return mCancelled; }
+
+private:
+    friend class AsyncLoop;
+
+    bool mCancelled;
+    AsyncWaiter * mWaiters;
+
+    CancelToken(const CancelToken &);
+    CancelToken & operator= (const CancelToken &);
+};
+
+/*
+ * Event loop for the tasks: sockets are watched edge-triggered for both
+ * directions, a task waits for one of them with a deadline and a cancel
+ * token. Woken tasks are resumed after the events are dispatched, never
+ * from inside another task.
+ */
+
+class AsyncLoop {
+public:
+    typedef Deadline::clock clock;
+
+    AsyncLoop() : mActive(0), mStop(false) {}
+
+    ~AsyncLoop() {
+        // frames of the unfinished tasks, their promises unregister them
+        while (!mTasks.empty()) {
+            std::coroutine_handle<>::from_address(*mTasks.begin()).destroy();
+        }
+    }
+
+    bool isOk() const { return mEvents.isOk(); }
+
+    EventLoop & events() { return mEvents; }
+
+    // loop that runs on the calling thread or NULL
+    static AsyncLoop *& current() {
+        static thread_local AsyncLoop * loop = 0;
+        return loop;
+    }
+
+    // starts the task on the calling thread, it runs till its first wait;
+    // call it on the loop thread or before run()
+    void spawn(Task<void> task) {
+        detach(this, std::move(task));
+    }
+
+    // spawned tasks that are not done yet
+    size_t active() const { return mActive; }
+
+    // runs the function on the loop thread, may be called from any thread
+    void post(std::function<void()> task) { mEvents.post(std::move(task)); }
+
+    // dispatches events till every spawned task is done or stop()
+    void run() {
+        AsyncLoop * prev = current();
+        current() = this;
+        while (!mStop.load(std::memory_order_acquire)) {
+            resumeReady();
+            if (mActive == 0 && mReady.empty()) break;
+            if (mEvents.runOnce(mReady.empty() ? nextTimeout() : 0) < 0) break;
+            expireTimers();
+        }
+        current() = prev;
+    }
+
+    // may be called from any thread
+    void stop() {
+        mStop.store(true, std::memory_order_release);
+        mEvents.post([] {});
+    }
+
+    // starts watching the non-blocking socket
+    bool attach(SOCKET sd) {
+        if (!mEvents.add(sd, EventLoop::READ | EventLoop::WRITE,
+                [this](SOCKET sd, unsigned events) { ready(sd, events); })) {
+            return false;
+        }
+        if ((size_t) sd >= mWatches.size()) {
+            mWatches.resize(std::max<size_t>(sd + 1, mWatches.size() * 2));
+        }
+        return true;
+    }
+
+    // stops watching, the waiting operations get ECANCELED
+    void detach(SOCKET sd) {
+        if (!mEvents.has(sd)) return;
+        Watch & watch = mWatches[sd];
+        if (watch.Read)  wake(watch.Read, ECANCELED);
+        if (watch.Write) wake(watch.Write, ECANCELED);
+        mEvents.remove(sd);
+    }
+
+    /*
+     * co_await wait(sd, READ or WRITE, ...) gives 0 once the socket is
+     * ready, ETIMEDOUT, ECANCELED, EBADF for sockets not attached and
+     * EBUSY when another task waits for the same direction.
+     */
+
+    class Wait {
+    public:
+        Wait(AsyncLoop & loop, SOCKET sd, unsigned events, const Deadline & deadline,
+             CancelToken * cancel, int onTimer)
+            : mDeadline(deadline)
+        {
+            mWaiter.Loop    = &loop;
+            mWaiter.Sd      = sd;
+            mWaiter.Events  = events;
+            mWaiter.Cancel  = cancel;
+            mWaiter.OnTimer = onTimer;
+        }
+        ~Wait() { mWaiter.Loop->unpark(&mWaiter); }
+
+        bool await_ready() const { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            mWaiter.Handle = h;
+            return mWaiter.Loop->park(&mWaiter, mDeadline);
+        }
+        int await_resume() const { return mWaiter.Result; }
+
+    private:
+        AsyncWaiter mWaiter;
+        Deadline mDeadline;
+
+        Wait(const Wait &);
+        Wait & operator= (const Wait &);
+    };
+
+    Wait wait(SOCKET sd, unsigned events, const Deadline & deadline = Deadline(),
+              CancelToken * cancel = 0) {
+        return Wait(*this, sd, events, deadline, cancel, ETIMEDOUT);
+    }
+
+    // 0 after ms, ECANCELED when cancelled earlier
+    Wait sleep(unsigned ms, CancelToken * cancel = 0) {
+        return Wait(*this, INVALID_SOCKET, 0, Deadline(ms), cancel, 0);
+    }
+
+private:
+    friend class CancelToken;
+
+    struct Watch {
+        AsyncWaiter * Read = 0;
+        AsyncWaiter * Write = 0;
+    };
+
+    // runs a spawned task, the frame frees itself when it is done
+    struct Detached {
+        struct promise_type {
+            AsyncLoop * Loop;
+
+            promise_type(AsyncLoop * loop, Task<void> &) : Loop(loop) {
+                ++Loop->mActive;
+                Loop->mTasks.insert(std::coroutine_handle<promise_type>::from_promise(*this).address());
+            }
+            ~promise_type() {
+                --Loop->mActive;
+                Loop->mTasks.erase(std::coroutine_handle<promise_type>::from_promise(*this).address());
+            }
+            Detached get_return_object() { return Detached(); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() {}
+        };
+    };
+
+    EventLoop mEvents;
+    std::vector<Watch> mWatches;
+    AsyncWaiter::Timers mTimers;
+    std::vector<std::coroutine_handle<> > mReady;
+    std::vector<std::coroutine_handle<> > mResuming;
+    std::set<void *> mTasks;
+    size_t mActive;
+    std::atomic<bool> mStop;
+
+    static Detached detach(AsyncLoop *, Task<void> task) {
+        try {
+            co_await task;
+        } catch (const std::exception & e) {
+            WARN("task failed err='%s'", e.what());
+        } catch (...) {
+            WARN("task failed");
+        }
+    }
+
+    // false when the result is known without waiting
+    bool park(AsyncWaiter * w, const Deadline & deadline) {
+        if (w->Cancel && w->Cancel->cancelled()) {
+            w->Result = ECANCELED;
+            return false;
+        }
+        if (deadline.expired()) {
+            w->Result = w->OnTimer;
+            return false;
+        }
+        if (w->Sd != INVALID_SOCKET) {
+            if (!mEvents.has(w->Sd)) {
+                w->Result = EBADF;
+                return false;
+            }
+            AsyncWaiter *& slot = (w->Events & EventLoop::READ) ? mWatches[w->Sd].Read
+                                                                : mWatches[w->Sd].Write;
+            if (slot) {
+                w->Result = EBUSY;
+                return false;
+            }
+            slot = w;
+        }
+        if (!deadline.infinite()) {
+            w->Timer = mTimers.insert(std::make_pair(deadline.at(), w));
+            w->HasTimer = true;
+        }
+        if (w->Cancel) {
+            w->CancelNext = w->Cancel->mWaiters;
+            if (w->CancelNext) w->CancelNext->CancelPrev = w;
+            w->Cancel->mWaiters = w;
+        }
+        w->Parked = true;
+        return true;
+    }
+
+    void unpark(AsyncWaiter * w) {
+        if (!w->Parked) return;
+        w->Parked = false;
+        if (w->Sd != INVALID_SOCKET && (size_t) w->Sd < mWatches.size()) {
+            Watch & watch = mWatches[w->Sd];
+            if (watch.Read == w)  watch.Read = 0;
+            if (watch.Write == w) watch.Write = 0;
+        }
+        if (w->HasTimer) {
+            mTimers.erase(w->Timer);
+            w->HasTimer = false;
+        }
+        if (w->Cancel) {
+            if (w->CancelPrev) w->CancelPrev->CancelNext = w->CancelNext;
+            else               w->Cancel->mWaiters = w->CancelNext;
+            if (w->CancelNext) w->CancelNext->CancelPrev = w->CancelPrev;
+            w->CancelPrev = w->CancelNext = 0;
+        }
+    }
+
+    void wake(AsyncWaiter * w, int result) {
+        unpark(w);
+        w->Result = result;
+        mReady.push_back(w->Handle);
+    }
+
+    void ready(SOCKET sd, unsigned events) {
+        Watch & watch = mWatches[sd];
+        if ((events & (EventLoop::READ | EventLoop::CLOSED)) && watch.Read) {
+            wake(watch.Read, 0);
+        }
+        if ((events & (EventLoop::WRITE | EventLoop::CLOSED)) && watch.Write) {
+            wake(watch.Write, 0);
+        }
+    }
+
+    void resumeReady() {
+        while (!mReady.empty()) {
+            mResuming.swap(mReady);
+            for (size_t i = 0; i < mResuming.size(); ++i) {
+                mResuming[i].resume();
+            }
+            mResuming.clear();
+        }
+    }
+
+    void expireTimers() {
+        const clock::time_point now = clock::now();
+        while (!mTimers.empty() && mTimers.begin()->first <= now) {
+            AsyncWaiter * w = mTimers.begin()->second;
+            wake(w, w->OnTimer);
+        }
+    }
+
+    // ms till the nearest deadline rounded up, -1 when there is none
+    int nextTimeout() const {
+        if (mTimers.empty()) return -1;
+        auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+            mTimers.begin()->first - clock::now()).count();
+        return left <= 0 ? 0 : (int) std::min<long long>((left + 999) / 1000, 0x7fffffff);
+    }
+
+    AsyncLoop(const AsyncLoop &);
+    AsyncLoop & operator= (const AsyncLoop &);
+};  // AsyncLoop
+
+inline void CancelToken::cancel() {
+    mCancelled = true;
+    while (mWaiters) {
+        mWaiters->Loop->wake(mWaiters, ECANCELED);
+    }
+}
+
+/*
+ * Non-blocking TCP socket of one loop. A failed operation returns false
+ * or -1 and keeps the reason in error(): ETIMEDOUT when the deadline
+ * expired, ECANCELED after the cancel token fired, errno otherwise. One
+ * task may read while another one writes.
+ */
+
+class AsyncSocket {
+public:
+    explicit AsyncSocket(AsyncLoop & loop)
+        : mLoop(loop)
+        , mSocket(INVALID_SOCKET)
+        , mCancel(0)
+        , mError(0)
+    {}
+
+    // takes over the connected socket
+    AsyncSocket(AsyncLoop & loop, SOCKET sd)
+        : AsyncSocket(loop)
+    {
+        TCPSocket::set_nonblocking(sd, true);
+        if (mLoop.attach(sd)) {
+            mSocket = sd;
+        } else {
+            CLOSE_SOCKET(sd);
+        }
+    }
+
+    ~AsyncSocket() { close(); }
+
+    SOCKET sd() const   { return mSocket; }
+    bool isOk() const   { return mSocket != INVALID_SOCKET; }
+    int error() const   { return mError; }
+
+    void setCancel(CancelToken * token) { mCancel = token; }
+
+    void close() {
+        if (mSocket == INVALID_SOCKET) return;
+        mLoop.detach(mSocket);
+        CLOSE_SOCKET(mSocket);
+        mSocket = INVALID_SOCKET;
+    }
+
+    // the host is resolved through DNSCache before the connect, a lookup
+    // that misses the cache blocks the loop thread
+    Task<bool> async_connect(std::string host, unsigned port, Deadline deadline = Deadline()) {
+        close();
+        sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        if (!NetUtils::lookupIPv4(host.c_str(), &addr, SOCK_STREAM)) {
+            WARN("lookup() of '%s' failed", host.c_str());
+            co_return fail(EHOSTUNREACH);
+        }
+        addr.sin_family = AF_INET;
+        addr.sin_port   = htons(port);
+
+        SOCKET sd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sd == INVALID_SOCKET) {
+            co_return fail(errno);
+        }
+        if (!mLoop.attach(sd)) {
+            CLOSE_SOCKET(sd);
+            co_return fail(EBADF);
+        }
+        mSocket = sd;
+        const NetMetrics::clock::time_point start = NetMetrics::clock::now();
+        NetMetrics::add(NetMetrics::CONNECTS);
+        int err = 0;
+        if (::connect(sd, (const sockaddr *) &addr, sizeof(addr)) != 0) {
+            err = TCPSocket::is_inprogress() ? 0 : errno;
+            if (err == 0) {
+                err = co_await mLoop.wait(sd, EventLoop::WRITE, deadline, mCancel);
+            }
+            if (err == 0) {
+                socklen_t len = sizeof(err);
+                ::getsockopt(sd, SOL_SOCKET, SO_ERROR, (char *) &err, &len);
+            }
+        }
+        errno = err;
+        if (!TCPSocket::connected(err == 0, start)) {
+            co_return fail(err);
+        }
+        mError = 0;
+        co_return true;
+    }
+
+    // bytes received, up to count; 0 when the peer closed, -1 on errors
+    Task<long> async_read(char * buff, size_t count, Deadline deadline = Deadline()) {
+        for (;;) {
+            long n = (long) ::recv(mSocket, buff, count, 0);
+            NetMetrics::io(NetMetrics::BYTES_IN, n);
+            if (n >= 0) {
+                co_return n;
+            }
+            if (errno == EINTR) continue;
+            if (!IS_EAGAIN) {
+                co_return error(errno);
+            }
+            int rc = co_await mLoop.wait(mSocket, EventLoop::READ, deadline, mCancel);
+            if (rc != 0) {
+                co_return error(rc);
+            }
+        }
+    }
+
+    // writes everything, returns count or -1
+    Task<long> async_write(const char * data, size_t count, Deadline deadline = Deadline()) {
+        TCPSocket::iovec_t iov;
+        TCPSocket::set_iov(iov, data, count);
+        co_return co_await async_writev(&iov, 1, deadline);
+    }
+
+    // gather write of everything, the vector is advanced while sending
+    Task<long> async_writev(TCPSocket::iovec_t * iov, int count, Deadline deadline = Deadline()) {
+        long total = 0;
+        while (count > 0) {
+            msghdr msg;
+            ::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov    = iov;
+            msg.msg_iovlen = (size_t) std::min(count, 1024);
+            long n = (long) ::sendmsg(mSocket, &msg, MSG_NOSIGNAL);
+            NetMetrics::io(NetMetrics::BYTES_OUT, n);
+            if (n >= 0) {
+                total += n;
+                TCPSocket::iov_advance(iov, count, (size_t) n);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            if (!IS_EAGAIN) {
+                co_return error(errno);
+            }
+            int rc = co_await mLoop.wait(mSocket, EventLoop::WRITE, deadline, mCancel);
+            if (rc != 0) {
+                co_return error(rc);
+            }
+        }
+        co_return total;
+    }
+
+private:
+    AsyncLoop & mLoop;
+    SOCKET mSocket;
+    CancelToken * mCancel;
+    int mError;
+
+    bool fail(int err) {
+        close();
+        mError = err;
+        errno = err;
+        return false;
+    }
+
+    long error(int err) {
+        mError = err;
+        errno = err;
+        return -1;
+    }
+
+    AsyncSocket(const AsyncSocket &);
+    AsyncSocket & operator= (const AsyncSocket &);
+};  // AsyncSocket
+
+/*
+ * HTTP/1.1 client of one loop: one request at a time on its own
+ * connection, kept open between requests with setKeepAlive(). Deadlines
+ * and statuses follow HTTP, cancelled requests return 500 and
+ * cancelled() is true.
+ */
+
+class AsyncHTTP {
+public:
+    typedef HTTPResponseParser::BodySink BodySink;
+
+    static constexpr int TIMED_OUT = HTTP::TIMED_OUT;
+
+    AsyncHTTP(AsyncLoop & loop, const std::string & host, unsigned port = 80)
+        : mSocket(loop)
+        , mRecvBuffer(16 * 1024)
+        , mHost(host)
+        , mPort(port)
+        , mKeepAlive(false)
+        , mTimeout((unsigned) -1)
+        , mConnectTimeout((unsigned) -1)
+        , mIOTimeout((unsigned) -1)
+        , mError(0)
+    {}
+
+    void setKeepAlive(bool value) { mKeepAlive = value; }
+    bool isKeepAlive() const      { return mKeepAlive; }
+
+    // see HTTP::setTimeout()
+    void setTimeout(unsigned ms)        { mTimeout = ms; }
+    void setConnectTimeout(unsigned ms) { mConnectTimeout = ms; }
+    void setIOTimeout(unsigned ms)      { mIOTimeout = ms; }
+
+    void setCancel(CancelToken * token) { mSocket.setCancel(token); }
+
+    bool timedOut() const  { return mError == ETIMEDOUT; }
+    bool cancelled() const { return mError == ECANCELED; }
+
+    // parsed status line and headers of the last response
+    const HTTPResponseParser & response() const { return mResponse; }
+    // body when no sink was given
+    const std::string & body() const { return mBody; }
+
+    // data is the query of GET and the form body of POST, as in HTTP
+    Task<int> async_request(std::string method, std::string uri,
+                            std::string data = std::string(), BodySink sink = BodySink()) {
+        mBody.clear();
+        mError = 0;
+        const Deadline deadline(mTimeout);
+        const bool post = (method == "POST");
+        const NetMetrics::clock::time_point started = NetMetrics::clock::now();
+        NetMetrics::add(NetMetrics::HTTP_REQUESTS);
+
+        mHead.clear();
+        mHead.requestLine(method, uri, post ? std::string_view() : std::string_view(data));
+        mHead.header("Host", mHost);
+        mHead.header("User-Agent", "opHttp/1.1");
+        if (post) {
+            mHead.header("Content-Type", "application/x-www-form-urlencoded");
+            mHead.header("Content-Length", (uint64_t) data.size());
+        }
+        if (!mKeepAlive) {
+            mHead.header("Connection", "close");
+        }
+        mHead.end();
+        TCPSocket::iovec_t iov[2];
+        TCPSocket::set_iov(iov[0], mHead.data(), mHead.size());
+        TCPSocket::set_iov(iov[1], data.data(), data.size());
+        const int iovCount = (post && !data.empty()) ? 2 : 1;
+        const long total = (long) (mHead.size() + (iovCount == 2 ? data.size() : 0));
+
+        mResponse.reset(method == "HEAD");
+        if (!sink) {
+            sink = [this](const char * bytes, size_t size) {
+                mBody.append(bytes, size);
+                return true;
+            };
+        }
+        mResponse.setSink(std::move(sink));
+
+        // kept connection may be closed by the server in the meantime,
+        // then the request is repeated once on a new one
+        int status = -1;
+        for (int attempt = 0; attempt < 2 && status < 0; ++attempt) {
+            const bool reused = mSocket.isOk();
+            if (!reused && !co_await mSocket.async_connect(mHost, mPort,
+                    Deadline::earliest(deadline, Deadline(mConnectTimeout)))) {
+                mError = mSocket.error();
+                break;
+            }
+            bool reusable = false;
+            size_t received = 0;
+            TCPSocket::iovec_t v[2] = { iov[0], iov[1] };
+            if (co_await mSocket.async_writev(v, iovCount,
+                    Deadline::earliest(deadline, Deadline(mIOTimeout))) == total) {
+                status = co_await readResponse(deadline, &reusable, &received);
+            }
+            mError = (status < 0) ? mSocket.error() : 0;
+            if (status < 0 || !reusable || !mKeepAlive) {
+                mSocket.close();
+            }
+            if (status < 0 && (mError == ETIMEDOUT || mError == ECANCELED || !reused || received > 0)) {
+                break;
+            }
+        }
+        mResponse.setSink(BodySink());
+        if (status < 0) {
+            mBody.clear();
+            status = timedOut() ? TIMED_OUT : 500;
+        }
+        NetMetrics::time(NetMetrics::HTTP_TIME, started);
+        if (status >= 500) NetMetrics::add(NetMetrics::HTTP_ERRORS);
+        if (timedOut()) NetMetrics::add(NetMetrics::HTTP_TIMEOUTS);
+        co_return status;
+    }
+
+private:
+    AsyncSocket mSocket;
+    HTTPResponseParser mResponse;
+    HTTPHeaderBuilder mHead;
+    std::vector<char> mRecvBuffer;
+    std::string mBody;
+    std::string mHost;
+    unsigned mPort;
+    bool mKeepAlive;
+    unsigned mTimeout;
+    unsigned mConnectTimeout;
+    unsigned mIOTimeout;
+    int mError;
+
+    // feeds the parser until the response is complete, -1 on errors
+    Task<int> readResponse(Deadline deadline, bool * reusable, size_t * received) {
+        for (;;) {
+            long rc = co_await mSocket.async_read(&mRecvBuffer[0], mRecvBuffer.size(),
+                Deadline::earliest(deadline, Deadline(mIOTimeout)));
+            if (rc < 0) {
+                co_return -1;
+            }
+            if (rc == 0) {
+                if (!mResponse.finish()) co_return -1;
+                break;
+            }
+            *received += (size_t) rc;
+            size_t used = mResponse.feed(&mRecvBuffer[0], (size_t) rc);
+            if (mResponse.isFailed()) {
+                co_return -1;
+            }
+            if (mResponse.isDone()) {
+                // bytes past the response mean the stream is out of sync
+                *reusable = mResponse.keepAlive() && used == (size_t) rc;
+                break;
+            }
+        }
+        co_return mResponse.status();
+    }
+
+    AsyncHTTP(const AsyncHTTP &);
+    AsyncHTTP & operator= (const AsyncHTTP &);
+};  // AsyncHTTP
+
+} // namespace op
+
+#endif // __linux__ && __cpp_impl_coroutine
@@ -0,0 +1,812 @@
+//
+// Copyright (C) 2026 Oleg Polivets. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 
+// 1. Redistributions of source code must retain the above copyright 
+//    notice, this list of conditions and the following disclaimer.  
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.  
+// 3. Neither the name of the project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission. 
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+// SUCH DAMAGE.
+// 
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "net.hpp"
+#include "url.hpp"
+#include "pool.hpp"
+#include "mmap.hpp"
+
+namespace op {
+
+/*
+ * Request parsed in place: all fields are views into the connection
+ * buffer and stay valid only while the handler runs.
+ */
+
+struct HTTPRequest {
+    typedef std::string_view view_t;
+
+    view_t Method;
+    view_t Target;      // /path?query
+    view_t Path;
+    view_t Query;
+    view_t Version;
+    std::vector<std::pair<view_t, view_t> > Headers;
+    view_t Body;
+    bool KeepAlive = true;
+
+    view_t header(view_t name) const {
+        for (size_t i = 0; i < Headers.size(); ++i) {
+            if (HTTPResponseParser::equalsNoCase(Headers[i].first, name)) return Headers[i].second;
+        }
+        return view_t();
+    }
+
+    QueryParams params() const { return QueryParams(Query); }
+
+    // parses one request from the data, returns its size with the body,
+    // 0 when more data is needed, -1 on malformed or too large head and
+    // -2 when Content-Length is over maxBody
+    static long parse(const char * data, size_t size, HTTPRequest * req,
+                      size_t maxHead = 64 * 1024, size_t maxBody = (size_t) -1) {
+        view_t in(data, size);
+        size_t end = in.find("\r\n\r\n");
+        if (end == view_t::npos) {
+            return size > maxHead ? -1 : 0;
+        }
+        req->Headers.clear();
+        req->Body = view_t();
+        view_t head = in.substr(0, end + 2);
+
+        // METHOD /target HTTP/1.1
+        size_t eol = head.find("\r\n");
+        view_t line = head.substr(0, eol);
+        size_t sp1 = line.find(' ');
+        size_t sp2 = line.rfind(' ');
+        if (sp1 == view_t::npos || sp2 == sp1) {
+            return -1;
+        }
+        req->Method  = line.substr(0, sp1);
+        req->Target  = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        req->Version = line.substr(sp2 + 1);
+        size_t q = req->Target.find('?');
+        req->Path  = req->Target.substr(0, q);
+        req->Query = (q != view_t::npos) ? req->Target.substr(q + 1) : view_t();
+        req->KeepAlive = (req->Version == "HTTP/1.1");
+
+        size_t length = 0;
+        bool hasLength = false;
+        for (size_t pos = eol + 2; pos < head.size();) {
+            size_t e = head.find("\r\n", pos);
+            view_t h = head.substr(pos, e - pos);
+            pos = e + 2;
+            size_t colon = h.find(':');
+            if (colon == view_t::npos) continue;
+            view_t name = h.substr(0, colon), value = h.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back()  == ' ' || value.back()  == '\t')) value.remove_suffix(1);
+            req->Headers.push_back(std::make_pair(name, value));
+            if (HTTPResponseParser::equalsNoCase(name, "Content-Length")) {
+                // digits only and no more than 19 of them, so it can't wrap
+                if (value.empty() || value.size() > 19) {
+                    return -1;
+                }
+                uint64_t v = 0;
+                for (size_t i = 0; i < value.size(); ++i) {
+                    if (value[i] < '0' || value[i] > '9') return -1;
+                    v = v * 10 + (uint64_t) (value[i] - '0');
+                }
+                if (hasLength && v != length) {
+                    return -1;  // conflicting lengths would desync the stream
+                }
+                if (v > maxBody) {
+                    return -2;
+                }
+                length = (size_t) v;
+                hasLength = true;
+            } else if (HTTPResponseParser::equalsNoCase(name, "Connection")) {
+                if (HTTPResponseParser::containsNoCase(value, "close")) req->KeepAlive = false;
+                if (HTTPResponseParser::containsNoCase(value, "keep-alive")) req->KeepAlive = true;
+            } else if (HTTPResponseParser::equalsNoCase(name, "Transfer-Encoding")) {
+                return -1;  // chunked request bodies are not supported
+            }
+        }
+        size_t total = end + 4 + length;
+        if (size < total) {
+            return 0;
+        }
+        req->Body = in.substr(end + 4, length);
+        return (long) total;
+    }
+};  // HTTPRequest
+
+/*
+ * File body of a response. Files up to the mmap limit are mapped and
+ * go out together with the headers in one gather write, larger ones
+ * are sent by sendfile() straight from the page cache.
+ */
+
+class HTTPFileBody {
+public:
+    static const size_t MMAP_LIMIT = 64 * 1024;
+
+    HTTPFileBody() : mFd(-1), mSize(0), mIno(0), mMTime(0), mMTimeNs(0) {}
+    ~HTTPFileBody() { if (mFd >= 0) ::close(mFd); }
+
+    HTTPFileBody(const HTTPFileBody &) = delete;
+    HTTPFileBody & operator=(const HTTPFileBody &) = delete;
+
+    bool open(const std::string & path, size_t mmapLimit = MMAP_LIMIT) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat s;
+        if (::fstat(fd, &s) != 0 || !S_ISREG(s.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+        mSize = (uint64_t) s.st_size;
+        mIno = s.st_ino;
+        mMTime = s.st_mtim.tv_sec;
+        mMTimeNs = s.st_mtim.tv_nsec;
+        if (mSize > 0 && mSize <= mmapLimit && mMap.open(path.c_str()) && mMap.size() == mSize) {
+            ::close(fd);
+            return true;
+        }
+        mMap.closeIt();
+        mFd = fd;
+        return true;
+    }
+
+    // the file on disk is still the one opened
+    bool same(const struct stat & s) const {
+        return s.st_ino == mIno && (uint64_t) s.st_size == mSize
+            && s.st_mtim.tv_sec == mMTime && s.st_mtim.tv_nsec == mMTimeNs;
+    }
+
+    uint64_t size() const { return mSize; }
+    int fd() const { return mFd; }
+    // contents of a mapped file, 0 when it goes by sendfile()
+    const char * data() const { return mMap.begin(); }
+
+    // "bytes=first-last", "bytes=first-" or "bytes=-suffix" against the size;
+    // returns 1 for a satisfiable range, -1 for an unsatisfiable one and 0
+    // when the header is ignored (other units, several ranges, garbage)
+    static int parseRange(std::string_view value, uint64_t size, uint64_t * first, uint64_t * last) {
+        static const std::string_view prefix("bytes=");
+        if (value.compare(0, prefix.size(), prefix) != 0) {
+            return 0;
+        }
+        std::string_view spec = value.substr(prefix.size());
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos || spec.find(',') != std::string_view::npos) {
+            return 0;
+        }
+        uint64_t a = 0, b = 0;
+        bool hasA = number(spec.substr(0, dash), &a);
+        bool hasB = number(spec.substr(dash + 1), &b);
+        if ((!hasA && dash > 0) || (!hasB && dash + 1 < spec.size())) {
+            return 0;
+        }
+        if (!hasA) {
+            if (!hasB) return 0;
+            if (b == 0 || size == 0) return -1;
+            *first = size > b ? size - b : 0;
+            *last = size - 1;
+            return 1;
+        }
+        if (a >= size) {
+            return -1;
+        }
+        *first = a;
+        *last = (hasB && b < size) ? b : size - 1;
+        return (*last < *first) ? 0 : 1;
+    }
+
+private:
+    int mFd;
+    uint64_t mSize;
+    ino_t mIno;
+    time_t mMTime;
+    long mMTimeNs;
+    MMap mMap;
+
+    static bool number(std::string_view v, uint64_t * out) {
+        while (!v.empty() && v.front() == ' ') v.remove_prefix(1);
+        while (!v.empty() && v.back()  == ' ') v.remove_suffix(1);
+        if (v.empty() || v.size() > 19) return false;
+        uint64_t n = 0;
+        for (size_t i = 0; i < v.size(); ++i) {
+            if (v[i] < '0' || v[i] > '9') return false;
+            n = n * 10 + (v[i] - '0');
+        }
+        *out = n;
+        return true;
+    }
+};  // HTTPFileBody
+
+/*
+ * Opened files shared by the requests: sendfile() takes the offset
+ * explicitly, so one descriptor or mapping serves any number of them.
+ * Entries are checked with stat() on every lookup.
+ */
+
+class HTTPFileCache {
+public:
+    explicit HTTPFileCache(size_t maxEntries = 1024) : mMaxEntries(maxEntries) {}
+
+    std::shared_ptr<HTTPFileBody> get(const std::string & path) {
+        struct stat s;
+        if (::stat(path.c_str(), &s) != 0) {
+            return std::shared_ptr<HTTPFileBody>();
+        }
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            auto it = mFiles.find(path);
+            if (it != mFiles.end() && it->second->same(s)) {
+                return it->second;
+            }
+        }
+        std::shared_ptr<HTTPFileBody> body = std::make_shared<HTTPFileBody>();
+        if (!body->open(path)) {
+            return std::shared_ptr<HTTPFileBody>();
+        }
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mFiles.size() >= mMaxEntries) {
+            mFiles.clear();
+        }
+        mFiles[path] = body;
+        return body;
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mFiles.clear();
+    }
+
+private:
+    std::mutex mMutex;
+    std::map<std::string, std::shared_ptr<HTTPFileBody> > mFiles;
+    size_t mMaxEntries;
+};  // HTTPFileCache
+
+struct HTTPServerResponse {
+    int Status = 200;
+    std::string ContentType = "text/plain";
+    std::vector<std::pair<std::string, std::string> > Headers;
+    std::string Body;
+    std::shared_ptr<HTTPFileBody> File;     // sent after the headers instead of Body
+    uint64_t FileOffset = 0;
+    uint64_t FileLength = 0;
+    bool HeadOnly = false;                  // answer to HEAD: Content-Length without the body
+
+    void set(int status, std::string body, std::string contentType = "text/plain") {
+        Status = status;
+        Body = std::move(body);
+        ContentType = std::move(contentType);
+    }
+
+    // answers with the file or the part of it asked by the Range header
+    bool file(const HTTPRequest & req, const std::string & path,
+              std::string contentType = "application/octet-stream") {
+        std::shared_ptr<HTTPFileBody> body = std::make_shared<HTTPFileBody>();
+        if (!body->open(path)) {
+            body.reset();
+        }
+        return file(req, body, std::move(contentType));
+    }
+
+    bool file(const HTTPRequest & req, std::shared_ptr<HTTPFileBody> body,
+              std::string contentType = "application/octet-stream") {
+        if (!body) {
+            set(404, "Not Found");
+            return false;
+        }
+        const uint64_t size = body->size();
+        uint64_t first = 0, last = 0;
+        std::string_view range = req.header("Range");
+        int rc = range.empty() ? 0 : HTTPFileBody::parseRange(range, size, &first, &last);
+        if (rc < 0) {
+            set(416, std::string());
+            Headers.push_back(std::make_pair("Content-Range", "bytes */" + std::to_string(size)));
+            return false;
+        }
+        Status = 200;
+        Body.clear();
+        ContentType = std::move(contentType);
+        Headers.push_back(std::make_pair("Accept-Ranges", "bytes"));
+        if (rc > 0) {
+            Status = 206;
+            Headers.push_back(std::make_pair("Content-Range", "bytes " + std::to_string(first)
+                + "-" + std::to_string(last) + "/" + std::to_string(size)));
+        } else {
+            first = 0;
+            last = size - 1;
+        }
+        File = body;
+        FileOffset = first;
+        FileLength = size ? last - first + 1 : 0;
+        return true;
+    }
+
+    static std::string_view reason(int status) {
+        switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 416: return "Range Not Satisfiable";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default:  return "Unknown";
+        }
+    }
+
+    void serialize(HTTPHeaderBuilder & head, bool keepAlive) const {
+        head.statusLine(Status, reason(Status));
+        if (!ContentType.empty()) head.header("Content-Type", ContentType);
+        head.header("Content-Length", File ? FileLength : (uint64_t) Body.size());
+        for (size_t i = 0; i < Headers.size(); ++i) {
+            head.header(Headers[i].first, Headers[i].second);
+        }
+        if (!keepAlive) head.header("Connection", "close");
+        head.end();
+    }
+};  // HTTPServerResponse
+
+/*
+ * Embedded HTTP/1.1 server on top of TCPServer::eventLoop(): requests
+ * are parsed in place from the connection buffer, keep-alive and
+ * pipelined requests are served with answers kept in request order.
+ * Handlers run on the WorkerPool threads (setWorkers()) or, with no
+ * workers, right on the loop thread which suits cheap handlers best.
+ *
+ * Routes match the exact path, or the prefix when the pattern ends
+ * with '*'; the longest prefix wins.
+ */
+
+class HTTPServer : public TCPServer {
+public:
+    typedef std::function<void(const HTTPRequest &, HTTPServerResponse &)> Handler;
+
+    explicit HTTPServer(unsigned port, bool reuseport = false)
+        : TCPServer(port, reuseport)
+        , mWorkersCount(0)
+        , mMaxRequestSize(16 * 1024 * 1024)
+    {}
+
+    ~HTTPServer() {
+        mWorkers.Stop();
+    }
+
+    void route(const std::string & method, const std::string & pattern, Handler handler) {
+        std::string path = pattern;
+        bool prefix = !path.empty() && path.back() == '*';
+        if (prefix) path.pop_back();
+        Route & r = prefix ? mPrefixRoutes[path] : mRoutes[path];
+        r.Methods.push_back(std::make_pair(method, std::move(handler)));
+    }
+
+    // handlers run on n pool threads, 0 - on the loop thread
+    void setWorkers(unsigned n) { mWorkersCount = n; }
+
+    void setMaxRequestSize(size_t v) { mMaxRequestSize = v; }
+
+    // GET prefix* is answered with the files under the root directory
+    void serveFiles(const std::string & prefix, const std::string & root) {
+        HTTPFileCache * cache = &mFileCache;
+        route("GET", prefix + "*", [prefix, root, cache](const HTTPRequest & req, HTTPServerResponse & resp) {
+            std::string name = URL::Decode(req.Path.substr(prefix.size()));
+            if (name.find("..") != std::string::npos || name.find('\0') != std::string::npos) {
+                resp.set(403, "Forbidden");
+                return;
+            }
+            resp.file(req, cache->get(root + "/" + name), std::string(mimeType(name)));
+        });
+    }
+
+    static std::string_view mimeType(std::string_view name) {
+        static const char * const types[][2] = {
+            { ".html", "text/html" },       { ".htm", "text/html" },
+            { ".css",  "text/css" },        { ".js",  "application/javascript" },
+            { ".json", "application/json" },{ ".txt", "text/plain" },
+            { ".xml",  "application/xml" }, { ".svg", "image/svg+xml" },
+            { ".png",  "image/png" },       { ".jpg", "image/jpeg" },
+            { ".jpeg", "image/jpeg" },      { ".gif", "image/gif" },
+        };
+        size_t dot = name.rfind('.');
+        if (dot != std::string_view::npos) {
+            std::string_view ext = name.substr(dot);
+            for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+                if (HTTPResponseParser::equalsNoCase(ext, types[i][0])) return types[i][1];
+            }
+        }
+        return "application/octet-stream";
+    }
+
+    // serves until stop(), loops > 1 needs reuseport to spread accepts
+    void run(unsigned loops = 1) {
+        if (mWorkersCount > 0) {
+            mWorkers.Start(mWorkersCount);
+        }
+        eventLoop(loops);
+    }
+
+    void stop() {
+        // no handler posts results after the pool is joined
+        mWorkers.Stop();
+        TCPServer::stop();
+    }
+
+    void onAccept(SOCKET sd, sockaddr *, socklen_t) override {
+        TCPSocket::set_nodelay(sd, true);
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        ::setsockopt(sd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        Connection * c = new Connection();
+        c->Id = ++mConnectionIds;
+        EventLoop::current()->setData(sd, c);
+    }
+
+    void onClose(SOCKET sd) override {
+        delete connection(sd);
+        EventLoop::current()->setData(sd, 0);
+    }
+
+    void onReadable(SOCKET sd) override {
+        Connection * c = connection(sd);
+        if (!c) return;
+        char buff[16 * 1024];
+        for (;;) {
+            int rc = ::recv(sd, buff, sizeof(buff), 0);
+            NetMetrics::io(NetMetrics::BYTES_IN, rc);
+            if (rc > 0) {
+                c->In.append(buff, rc);
+                continue;
+            }
+            if (rc == 0) {
+                c->Eof = true;
+                break;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                closeConnection(sd);
+                return;
+            }
+            break;
+        }
+        process(sd, c);
+    }
+
+    void onWritable(SOCKET sd) override {
+        Connection * c = connection(sd);
+        if (c) flush(sd, c);
+    }
+
+protected:
+    // bytes in memory (heads and bodies of one or more answers)
+    // followed by an optional file range
+    struct Chunk {
+        std::string Data;
+        std::shared_ptr<HTTPFileBody> File;
+        uint64_t Offset = 0;
+        uint64_t Left = 0;
+    };
+
+    struct Connection {
+        uint64_t Id = 0;
+        std::string In;
+        std::deque<Chunk> Out;
+        size_t OutPos = 0;          // of the front chunk data
+        uint64_t NextSeq = 0;       // sequence number of the next request
+        uint64_t FlushSeq = 0;      // next answer to be written
+        uint64_t CloseSeq = (uint64_t) -1;  // close after this answer
+        bool Eof = false;           // the peer has shut down its side
+        std::map<uint64_t, Chunk> Ready;    // answers out of order
+        HTTPRequest Request;
+        HTTPHeaderBuilder Head;
+    };
+
+    struct Route {
+        std::vector<std::pair<std::string, Handler> > Methods;
+    };
+
+    class Workers : public WorkerPool<std::function<void()> > {
+    protected:
+        void ServeJob(std::function<void()> job) override { job(); }
+    };
+
+    std::map<std::string, Route, std::less<> > mRoutes;
+    std::map<std::string, Route, std::less<> > mPrefixRoutes;
+    Workers mWorkers;
+    HTTPFileCache mFileCache;
+    unsigned mWorkersCount;
+    size_t mMaxRequestSize;
+    std::atomic<uint64_t> mConnectionIds{0};
+
+    static Connection * connection(SOCKET sd) {
+        EventLoop * loop = EventLoop::current();
+        return loop ? (Connection *) loop->data(sd) : 0;
+    }
+
+    const Handler * find(std::string_view method, std::string_view path, int * status) const {
+        const Route * route = 0;
+        auto it = mRoutes.find(path);
+        if (it != mRoutes.end()) {
+            route = &it->second;
+        } else {
+            // longest prefix is the last one not greater than the path
+            for (auto p = mPrefixRoutes.upper_bound(path); p != mPrefixRoutes.begin();) {
+                --p;
+                if (path.compare(0, p->first.size(), p->first) == 0) {
+                    route = &p->second;
+                    break;
+                }
+            }
+        }
+        if (!route) {
+            *status = 404;
+            return 0;
+        }
+        for (size_t i = 0; i < route->Methods.size(); ++i) {
+            if (route->Methods[i].first == method) return &route->Methods[i].second;
+        }
+        if (method == "HEAD") {
+            // served by the GET handler, the body is dropped by append()
+            return find("GET", path, status);
+        }
+        *status = 405;
+        return 0;
+    }
+
+    void handle(const HTTPRequest & req, HTTPServerResponse & resp) const {
+        int status = 200;
+        const Handler * handler = find(req.Method, req.Path, &status);
+        if (!handler) {
+            resp.set(status, std::string(HTTPServerResponse::reason(status)));
+        } else {
+            (*handler)(req, resp);
+        }
+        resp.HeadOnly = req.Method == "HEAD";
+    }
+
+    // parses and dispatches every complete request in the input buffer
+    void process(SOCKET sd, Connection * c) {
+        size_t pos = 0;
+        while (c->CloseSeq == (uint64_t) -1 && pos < c->In.size()) {
+            long n = HTTPRequest::parse(c->In.data() + pos, c->In.size() - pos, &c->Request,
+                                        64 * 1024, mMaxRequestSize);
+            if (n == 0 && c->In.size() - pos > mMaxRequestSize) n = -1;
+            if (n == 0) break;
+            const uint64_t seq = c->NextSeq++;
+            if (n < 0) {
+                HTTPServerResponse resp;
+                const int status = n == -2 ? 413 : 400;
+                resp.set(status, std::string(HTTPServerResponse::reason(status)));
+                c->CloseSeq = seq;
+                complete(sd, c, seq, resp, false);
+                pos = c->In.size();
+                break;
+            }
+            const bool keepAlive = c->Request.KeepAlive;
+            if (!keepAlive) c->CloseSeq = seq;
+            if (mWorkersCount == 0) {
+                HTTPServerResponse resp;
+                handle(c->Request, resp);
+                complete(sd, c, seq, resp, keepAlive);
+            } else {
+                dispatch(sd, c, seq, std::string(c->In.data() + pos, (size_t) n), keepAlive);
+            }
+            pos += (size_t) n;
+        }
+        c->In.erase(0, pos);
+        if (c->Eof && c->CloseSeq == (uint64_t) -1) {
+            // nothing more will come: answer what was asked, then close
+            if (c->NextSeq == 0) {
+                closeConnection(sd);
+                return;
+            }
+            c->CloseSeq = c->NextSeq - 1;
+        }
+        flush(sd, c);
+    }
+
+    void dispatch(SOCKET sd, Connection * c, uint64_t seq, std::string raw, bool keepAlive) {
+        EventLoop * loop = EventLoop::current();
+        const uint64_t id = c->Id;
+        mWorkers.QueueJob([this, loop, sd, id, seq, keepAlive, raw]() {
+            HTTPRequest req;
+            HTTPRequest::parse(raw.data(), raw.size(), &req);
+            HTTPServerResponse resp;
+            handle(req, resp);
+            std::shared_ptr<HTTPServerResponse> result =
+                std::make_shared<HTTPServerResponse>(std::move(resp));
+            loop->post([this, sd, id, seq, keepAlive, result]() {
+                EventLoop * l = EventLoop::current();
+                Connection * c = l->has(sd) ? (Connection *) l->data(sd) : 0;
+                if (!c || c->Id != id) {
+                    return;     // connection is gone
+                }
+                complete(sd, c, seq, *result, keepAlive);
+                flush(sd, c);
+            });
+        });
+    }
+
+    // chunk to append to, answers without files share one
+    static Chunk & tail(Connection * c) {
+        if (c->Out.empty() || c->Out.back().File) {
+            c->Out.emplace_back();
+        }
+        return c->Out.back();
+    }
+
+    static void append(Chunk & ch, const HTTPHeaderBuilder & head, const HTTPServerResponse & resp) {
+        ch.Data.append(head.data(), head.size());
+        if (resp.HeadOnly) {
+            return;
+        }
+        if (resp.File) {
+            ch.File = resp.File;
+            ch.Offset = resp.FileOffset;
+            ch.Left = resp.FileLength;
+        } else {
+            ch.Data.append(resp.Body);
+        }
+    }
+
+    // serializes the answer, in order of the requests
+    void complete(SOCKET, Connection * c, uint64_t seq, const HTTPServerResponse & resp,
+                  bool keepAlive) {
+        c->Head.clear();
+        resp.serialize(c->Head, keepAlive);
+        if (seq != c->FlushSeq) {
+            append(c->Ready[seq], c->Head, resp);
+            return;
+        }
+        append(tail(c), c->Head, resp);
+        ++c->FlushSeq;
+        for (auto it = c->Ready.begin(); it != c->Ready.end() && it->first == c->FlushSeq;) {
+            Chunk & ch = tail(c);
+            ch.Data.append(it->second.Data);
+            ch.File = std::move(it->second.File);
+            ch.Offset = it->second.Offset;
+            ch.Left = it->second.Left;
+            ++c->FlushSeq;
+            it = c->Ready.erase(it);
+        }
+    }
+
+    // sendfile() has no MSG_NOSIGNAL: SIGPIPE is blocked in this thread for
+    // the call and the one it raised is taken back, the process-wide
+    // disposition is left alone
+    static long sendfile_nosignal(SOCKET sd, int fd, off_t * offset, size_t count) {
+        sigset_t pipe, old, pending;
+        sigemptyset(&pipe);
+        sigaddset(&pipe, SIGPIPE);
+        sigemptyset(&pending);
+        ::sigpending(&pending);
+        const bool wasPending = sigismember(&pending, SIGPIPE) == 1;
+        ::pthread_sigmask(SIG_BLOCK, &pipe, &old);
+        long rc = ::sendfile(sd, fd, offset, count);
+        const int err = errno;
+        // not only with EPIPE: a reset during the call raises it as well
+        sigemptyset(&pending);
+        ::sigpending(&pending);
+        if (!wasPending && sigismember(&pending, SIGPIPE) == 1) {
+            struct timespec zero = { 0, 0 };
+            while (::sigtimedwait(&pipe, 0, &zero) < 0 && errno == EINTR) {}
+        }
+        ::pthread_sigmask(SIG_SETMASK, &old, 0);
+        errno = err;
+        return rc;
+    }
+
+    // writes what the socket takes: memory with a mapped file body by one
+    // sendmsg(), the rest of a file by sendfile()
+    void flush(SOCKET sd, Connection * c) {
+        while (!c->Out.empty()) {
+            Chunk & ch = c->Out.front();
+            const char * mapped = ch.File ? ch.File->data() : 0;
+            long rc = 0;
+            if (c->OutPos < ch.Data.size()) {
+                struct iovec iov[2];
+                iov[0].iov_base = &ch.Data[c->OutPos];
+                iov[0].iov_len = ch.Data.size() - c->OutPos;
+                iov[1].iov_base = mapped ? (void *) (mapped + ch.Offset) : 0;
+                iov[1].iov_len = mapped ? (size_t) ch.Left : 0;
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = (mapped && ch.Left > 0) ? 2 : 1;
+                rc = ::sendmsg(sd, &msg, MSG_NOSIGNAL);
+                NetMetrics::io(NetMetrics::BYTES_OUT, rc);
+                if (rc > 0) {
+                    size_t head = std::min((size_t) rc, iov[0].iov_len);
+                    c->OutPos += head;
+                    ch.Offset += (size_t) rc - head;
+                    ch.Left -= (size_t) rc - head;
+                }
+            } else if (ch.Left > 0) {
+                if (mapped) {
+                    rc = ::send(sd, mapped + ch.Offset, (size_t) ch.Left, MSG_NOSIGNAL);
+                } else {
+                    off_t offset = (off_t) ch.Offset;
+                    rc = sendfile_nosignal(sd, ch.File->fd(), &offset,
+                                           (size_t) std::min<uint64_t>(ch.Left, 1 << 30));
+                    if (rc == 0) {
+                        rc = -1;    // file was truncated under us
+                        errno = EIO;
+                    }
+                }
+                NetMetrics::io(NetMetrics::BYTES_OUT, rc);
+                if (rc > 0) {
+                    ch.Offset += (uint64_t) rc;
+                    ch.Left -= (uint64_t) rc;
+                }
+            } else {
+                c->OutPos = 0;
+                if (c->Out.size() > 1) {
+                    c->Out.pop_front();
+                    continue;
+                }
+                // the last chunk is kept with its buffer for the next answers
+                ch.Data.clear();
+                ch.File.reset();
+                break;
+            }
+            if (rc < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;   // wait for onWritable()
+                closeConnection(sd);
+                return;
+            }
+        }
+        if (c->CloseSeq != (uint64_t) -1 && c->FlushSeq > c->CloseSeq) {
+            closeConnection(sd);
+        }
+    }
+};  // HTTPServer
+
+} // namespace op
@@ -0,0 +1,235 @@
+//
+// Copyright (C) 2026 Oleg Polivets. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 
+// 1. Redistributions of source code must retain the above copyright 
+//    notice, this list of conditions and the following disclaimer.  
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.  
+// 3. Neither the name of the project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission. 
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+// SUCH DAMAGE.
+// 
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "url.hpp"
+#include "mmap.hpp"
+#include "pool.hpp"
+
+namespace op {
+
+/*
+ * Aggregated URL components of the access log: number of hits
+ * per host, per path and per query parameter name.
+ */
+
+struct URLStats {
+    typedef std::unordered_map<std::string, uint64_t> counters_t;
+
+    uint64_t Lines = 0;
+    uint64_t Urls  = 0;
+    counters_t Hosts;
+    counters_t Paths;
+    counters_t QueryKeys;
+
+    // n most frequent entries of the counters, the most frequent first
+    static std::vector<std::pair<std::string, uint64_t> > top(const counters_t & c, size_t n) {
+        std::vector<std::pair<std::string, uint64_t> > result(c.begin(), c.end());
+        n = std::min(n, result.size());
+        std::partial_sort(result.begin(), result.begin() + n, result.end(),
+            [](const std::pair<std::string, uint64_t> & a,
+               const std::pair<std::string, uint64_t> & b) {
+                return a.second > b.second || (a.second == b.second && a.first < b.first);
+            });
+        result.resize(n);
+        return result;
+    }
+};  // URLStats
+
+/*
+ * Parallel scanner of the memory mapped access log. The file is split
+ * into chunks on line boundaries, every chunk is parsed on the pool
+ * thread into its own counters keyed by views into the mapping, and
+ * the counters are merged into URLStats when all chunks are done.
+ *
+ * Line is either a bare URL or a log record with a quoted request line
+ * ("GET /path?query HTTP/1.1"), then request target is used.
+ */
+
+class URLScanner : protected WorkerPool<size_t> {
+public:
+    URLScanner() : mPending(0) {}
+
+    bool scanFile(const char * path, URLStats * out, unsigned num_threads = 0) {
+        op::MMap file;
+        if (!file.open(path)) {
+            return false;
+        }
+        scan(file.begin(), file.end(), out, num_threads);
+        return true;
+    }
+
+    void scan(const char * begin, const char * end, URLStats * out, unsigned num_threads = 0) {
+        if (num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        split(begin, end, num_threads * 4);
+        if (mChunks.empty()) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mDoneMutex);
+            mPending = mChunks.size();
+        }
+        Start(std::min<size_t>(num_threads, mChunks.size()));
+        for (size_t i = 0; i < mChunks.size(); ++i) {
+            QueueJob(i);
+        }
+        {
+            std::unique_lock<std::mutex> lock(mDoneMutex);
+            mDoneCV.wait(lock, [this] { return mPending == 0; });
+        }
+        Stop();
+        for (size_t i = 0; i < mChunks.size(); ++i) {
+            merge(mChunks[i], out);
+        }
+        mChunks.clear();
+    }
+
+    // request target of the log line or the first token of it
+    static std::string_view extractURL(std::string_view line) {
+        typedef std::string_view view_t;
+        size_t q = line.find('"');
+        if (q != view_t::npos) {
+            view_t req = line.substr(q + 1);
+            req = req.substr(0, req.find('"'));
+            size_t sp = req.find(' ');
+            if (sp == view_t::npos) {
+                return view_t();
+            }
+            req = req.substr(sp + 1);
+            return req.substr(0, req.find(' '));
+        }
+        size_t b = line.find_first_not_of(" \t");
+        if (b == view_t::npos) {
+            return view_t();
+        }
+        line = line.substr(b);
+        return line.substr(0, line.find_first_of(" \t\r"));
+    }
+
+protected:
+    void ServeJob(size_t idx) override {
+        Chunk & chunk = mChunks[idx];
+        std::string_view data(chunk.Begin, chunk.End - chunk.Begin);
+        for (size_t pos = 0; pos < data.size();) {
+            size_t eol = data.find('\n', pos);
+            if (eol == std::string_view::npos) eol = data.size();
+            std::string_view line = data.substr(pos, eol - pos);
+            pos = eol + 1;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (line.empty()) continue;
+            ++chunk.Lines;
+            std::string_view target = extractURL(line);
+            if (target.empty()) continue;
+            ++chunk.Urls;
+            URLView url = URLView::Parse(target);
+            ++chunk.Hosts[url.Host];
+            ++chunk.Paths[url.Path];
+            std::string_view query = url.QueryString.substr(0, url.QueryString.find('#'));
+            for (size_t qp = 0; qp < query.size();) {
+                size_t amp = query.find('&', qp);
+                if (amp == std::string_view::npos) amp = query.size();
+                std::string_view key = query.substr(qp, amp - qp);
+                qp = amp + 1;
+                key = key.substr(0, key.find('='));
+                if (!key.empty()) ++chunk.QueryKeys[key];
+            }
+        }
+        std::unique_lock<std::mutex> lock(mDoneMutex);
+        if (--mPending == 0) {
+            mDoneCV.notify_one();
+        }
+    }
+
+private:
+    typedef std::unordered_map<std::string_view, uint64_t> counters_t;
+
+    struct Chunk {
+        const char * Begin;
+        const char * End;
+        uint64_t Lines = 0;
+        uint64_t Urls  = 0;
+        counters_t Hosts;
+        counters_t Paths;
+        counters_t QueryKeys;
+    };
+
+    std::vector<Chunk> mChunks;
+    size_t mPending;
+    std::mutex mDoneMutex;
+    std::condition_variable mDoneCV;
+
+    void split(const char * begin, const char * end, size_t count) {
+        static const size_t MIN_CHUNK = 64 * 1024;
+        const size_t total = end - begin;
+        count = std::max<size_t>(1, std::min(count, total / MIN_CHUNK));
+        mChunks.clear();
+        mChunks.reserve(count);
+        for (const char * p = begin; p < end;) {
+            const char * e = p + std::max<size_t>(total / count, 1);
+            if (e >= end || mChunks.size() + 1 == count) {
+                e = end;
+            } else {
+                e = std::find(e, end, '\n');
+                if (e != end) ++e;
+            }
+            Chunk chunk;
+            chunk.Begin = p;
+            chunk.End = e;
+            mChunks.push_back(std::move(chunk));
+            p = e;
+        }
+    }
+
+    static void merge(const counters_t & from, URLStats::counters_t & to) {
+        for (const auto & kv : from) {
+            to[std::string(kv.first)] += kv.second;
+        }
+    }
+
+    static void merge(const Chunk & chunk, URLStats * out) {
+        out->Lines += chunk.Lines;
+        out->Urls  += chunk.Urls;
+        merge(chunk.Hosts, out->Hosts);
+        merge(chunk.Paths, out->Paths);
+        merge(chunk.QueryKeys, out->QueryKeys);
+    }
+};  // URLScanner
+
+} // namespace op
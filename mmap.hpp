@@ -58,11 +58,13 @@ public:
 
     const char* begin() const { return mBegin; }
     const char*   end() const { return mEnd;   }
+    size_t size() const { return mEnd - mBegin; }
 
     void closeIt() {
 #ifdef WIN32
         if (mBegin) UnmapViewOfFile(mBegin);
 #else
+        if (mBegin) ::munmap((void*) mBegin, mEnd - mBegin);
         if (mFD != INVALID_HANDLE_VALUE) ::close(mFD);
 #endif
         mBegin = 0;
@@ -104,14 +106,24 @@ public:
 #else
         struct stat s;
         fd = ::open(path, O_RDONLY);
-        ::fstat (fd, & s);
+        if (fd == INVALID_HANDLE_VALUE || ::fstat(fd, &s) != 0) {
+            if (fd != INVALID_HANDLE_VALUE) ::close(fd);
+            return false;
+        }
         size = s.st_size;
-        void *ret = ::mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
-        if (ret != MAP_FAILED) {
-            ok = true;
-            mBegin = (char*) ret;
-            mEnd   = mBegin + size;
+        if (size == 0) {
+            ok = true;  // nothing to map
+        } else {
+            void *ret = ::mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ret != MAP_FAILED) {
+                ok = true;
+                mBegin = (char*) ret;
+                mEnd   = mBegin + size;
+                ::madvise(ret, size, MADV_SEQUENTIAL);
+            }
         }
+        // mapping holds its own reference to the file
+        ::close(fd);
 #endif
         return ok;
     }
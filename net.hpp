@@ -37,13 +37,22 @@
   #define socklen_t        int  
   #define NETINIT          { WSADATA wd; if (WSAStartup(0x202, &wd)) { WARN("WSAStartup error %d", WSAGetLastError()); } }
   #define IS_EAGAIN        (WSAGetLastError() == WSAETIMEDOUT)
+  #define poll             WSAPoll
+  #define MSG_DONTWAIT     0
+  #define MSG_TRUNC        0
+  #define strtok_r         strtok_s
 #else
   #include <sys/types.h>
   #include <sys/socket.h>
   #include <arpa/inet.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
   #include <netdb.h>
   #include <errno.h>
   #include <unistd.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <sys/uio.h>
   #define INVALID_SOCKET   (-1)
   #define SOCKET_ERROR     (-1)
   #define CLOSE_SOCKET(sd) ::shutdown(sd, 2), ::close(sd)
@@ -52,9 +61,23 @@
   #define IS_EAGAIN        (errno == EAGAIN)
 #endif // !WIN32
 
+#ifdef __linux__
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+#endif
+
+#if (OPNET_HTTP_ZLIB == 1)
+  #include <zlib.h>
+#endif
+
+// NetMetrics counters are on unless built with OPNET_METRICS=0
+#ifndef OPNET_METRICS
+  #define OPNET_METRICS 1
+#endif
+
 #if (DEBUG_ENABLED == 1)
   #include "op/debug.hpp"
-#else
+#elif !defined(LOG)
   #define LOG(m, ...)   ((void)0)
   #define LOGINIT(n, l) ((void)0)
   #define LOGUNINIT()   ((void)0)
@@ -66,33 +89,569 @@
 
 #include <sstream>
 #include <vector>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <map>
+#include <algorithm>
+#include <cstdint>
 #include <cstring> // memset
+#include <cstdio>
 
 namespace op {
 
-class NetUtils {
+/*
+ * Counters and latency histograms of the net layer. Each thread updates
+ * its own shard with relaxed stores, no locks and no shared cache lines;
+ * snapshot() sums the shards, shards of finished threads are folded into
+ * one. Histograms have log2 buckets of microseconds.
+ */
+
+class NetMetrics {
 public:
-    static bool lookupIPv4(const char * host, struct sockaddr_in * addr, int socktype) {
-        unsigned long ret = inet_addr(host);
-        if (ret != INADDR_NONE && ret != INADDR_ANY) {
-            memcpy(&addr->sin_addr.s_addr, &ret, sizeof(ret));
-            return true;
+    typedef std::chrono::steady_clock clock;
+
+    enum Counter {
+        ACCEPTS,            // connections accepted by TCPServer
+        ACTIVE,             // accepted and not closed yet
+        CONNECTS,           // outgoing connects
+        CONNECT_ERRORS,
+        BYTES_IN,
+        BYTES_OUT,
+        SYSCALLS,           // send and receive calls
+        IO_ERRORS,
+        DNS_LOOKUPS,
+        DNS_MISSES,         // lookups that went to the resolver
+        UDP_IN,             // datagrams
+        UDP_OUT,
+        HTTP_REQUESTS,
+        HTTP_ERRORS,        // failed or answered with 5xx
+        HTTP_TIMEOUTS,
+        COUNTERS
+    };
+
+    enum Timer {
+        DNS_TIME,
+        CONNECT_TIME,
+        FIRST_BYTE_TIME,    // HTTP request sent till the first byte of the answer
+        HTTP_TIME,          // whole HTTP request
+        TIMERS
+    };
+
+    // bucket i counts the values below 2^i us, the last one the rest
+    static const unsigned BUCKETS = 32;
+    // errno values counted apart, larger ones go to the last slot
+    static const unsigned MAX_ERRNO = 160;
+
+    struct Histogram {
+        uint64_t Count = 0;
+        uint64_t SumUs = 0;
+        uint64_t Buckets[BUCKETS] = {};
+
+        double mean() const { return Count ? (double) SumUs / Count : 0.0; }
+
+        // upper bound in us of the bucket holding the q quantile
+        uint64_t percentile(double q) const {
+            if (Count == 0) return 0;
+            const uint64_t rank = std::max<uint64_t>(1, (uint64_t) (q * Count + 0.5));
+            uint64_t seen = 0;
+            for (unsigned i = 0; i < BUCKETS; ++i) {
+                seen += Buckets[i];
+                if (seen >= rank) return (uint64_t) 1 << i;
+            }
+            return (uint64_t) 1 << (BUCKETS - 1);
+        }
+    };
+
+    struct Snapshot {
+        uint64_t Counters[COUNTERS] = {};
+        Histogram Timers[TIMERS];
+        std::map<int, uint64_t> Errors;     // errno -> count
+
+        uint64_t operator[](Counter c) const        { return Counters[c]; }
+        const Histogram & operator[](Timer t) const { return Timers[t]; }
+
+        // what happened after the earlier snapshot
+        Snapshot since(const Snapshot & earlier) const {
+            Snapshot d = *this;
+            for (unsigned c = 0; c < COUNTERS; ++c) d.Counters[c] -= earlier.Counters[c];
+            for (unsigned t = 0; t < TIMERS; ++t) {
+                d.Timers[t].Count -= earlier.Timers[t].Count;
+                d.Timers[t].SumUs -= earlier.Timers[t].SumUs;
+                for (unsigned b = 0; b < BUCKETS; ++b) {
+                    d.Timers[t].Buckets[b] -= earlier.Timers[t].Buckets[b];
+                }
+            }
+            for (auto it = earlier.Errors.begin(); it != earlier.Errors.end(); ++it) {
+                auto e = d.Errors.find(it->first);
+                if (e == d.Errors.end()) continue;
+                if ((e->second -= it->second) == 0) d.Errors.erase(e);
+            }
+            return d;
+        }
+
+        // Prometheus text format
+        std::string text() const {
+            std::ostringstream out;
+            for (unsigned c = 0; c < COUNTERS; ++c) {
+                out << "opnet_" << counterName((Counter) c) << " "
+                    << (c == ACTIVE ? (int64_t) Counters[c] : Counters[c]) << "\n";
+            }
+            for (unsigned t = 0; t < TIMERS; ++t) {
+                const Histogram & h = Timers[t];
+                const char * name = timerName((Timer) t);
+                uint64_t total = 0;
+                for (unsigned b = 0; b + 1 < BUCKETS; ++b) {
+                    total += h.Buckets[b];
+                    if (h.Buckets[b] == 0) continue;
+                    out << "opnet_" << name << "_us_bucket{le=\"" << ((uint64_t) 1 << b)
+                        << "\"} " << total << "\n";
+                }
+                out << "opnet_" << name << "_us_bucket{le=\"+Inf\"} " << h.Count << "\n";
+                out << "opnet_" << name << "_us_sum " << h.SumUs << "\n"
+                    << "opnet_" << name << "_us_count " << h.Count << "\n";
+            }
+            for (auto it = Errors.begin(); it != Errors.end(); ++it) {
+                out << "opnet_errors_total{errno=\"" << it->first << "\"} " << it->second << "\n";
+            }
+            return out.str();
+        }
+    };
+
+    static void add(Counter c, int64_t n = 1) {
+#if (OPNET_METRICS == 1)
+        bump(local().Counters[c], (uint64_t) n);
+#else
+        (void) c; (void) n;
+#endif
+    }
+
+    static void time(Timer t, uint64_t us) {
+#if (OPNET_METRICS == 1)
+        Shard & s = local();
+        bump(s.Count[t], 1);
+        bump(s.Sum[t], us);
+        bump(s.Buckets[t][bucket(us)], 1);
+#else
+        (void) t; (void) us;
+#endif
+    }
+
+    static void time(Timer t, clock::time_point start) {
+#if (OPNET_METRICS == 1)
+        time(t, (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            clock::now() - start).count());
+#else
+        (void) t; (void) start;
+#endif
+    }
+
+    static void error(int code) {
+#if (OPNET_METRICS == 1)
+        bump(local().Errors[code < 0 || code >= (int) MAX_ERRNO ? MAX_ERRNO : code], 1);
+#else
+        (void) code;
+#endif
+    }
+
+    // one send/recv that returned rc, dir is BYTES_IN or BYTES_OUT
+    static void io(Counter dir, long rc) {
+#if (OPNET_METRICS == 1)
+        Shard & s = local();
+        bump(s.Counters[SYSCALLS], 1);
+        if (rc > 0) {
+            bump(s.Counters[dir], (uint64_t) rc);
+        } else if (rc < 0) {
+            const int err = errno;
+            if (err != EINTR && !IS_EAGAIN) {
+                bump(s.Counters[IO_ERRORS], 1);
+                error(err);
+            }
+        }
+#else
+        (void) dir; (void) rc;
+#endif
+    }
+
+    static Snapshot snapshot() {
+        Snapshot snap;
+        Registry & r = registry();
+        std::unique_lock<std::mutex> lock(r.Mutex);
+        collect(r.Retired, &snap);
+        for (size_t i = 0; i < r.Shards.size(); ++i) {
+            collect(*r.Shards[i], &snap);
+        }
+        return snap;
+    }
+
+    static const char * counterName(Counter c) {
+        static const char * const names[COUNTERS] = {
+            "accepts_total", "active_connections", "connects_total", "connect_errors_total",
+            "bytes_in_total", "bytes_out_total", "syscalls_total", "io_errors_total",
+            "dns_lookups_total", "dns_misses_total", "udp_datagrams_in_total",
+            "udp_datagrams_out_total", "http_requests_total", "http_errors_total",
+            "http_timeouts_total"
+        };
+        return names[c];
+    }
+
+    static const char * timerName(Timer t) {
+        static const char * const names[TIMERS] = {
+            "dns_time", "connect_time", "first_byte_time", "http_time"
+        };
+        return names[t];
+    }
+
+    static unsigned bucket(uint64_t us) {
+        unsigned b = 0;
+        while (us && b + 1 < BUCKETS) {
+            us >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+private:
+    typedef std::atomic<uint64_t> value_t;
+
+    // written by its thread only, read by snapshot()
+    struct Shard {
+        value_t Counters[COUNTERS];
+        value_t Count[TIMERS];
+        value_t Sum[TIMERS];
+        value_t Buckets[TIMERS][BUCKETS];
+        value_t Errors[MAX_ERRNO + 1];
+    };
+
+    struct Registry {
+        std::mutex Mutex;
+        std::vector<Shard *> Shards;
+        Shard Retired;      // what the finished threads counted
+    };
+
+    static Registry & registry() {
+        static Registry r;
+        return r;
+    }
+
+    static Shard & local() {
+        struct Holder {
+            Shard * S;
+            Holder() : S(new Shard()) {
+                Registry & r = registry();
+                std::unique_lock<std::mutex> lock(r.Mutex);
+                r.Shards.push_back(S);
+            }
+            ~Holder() {
+                Registry & r = registry();
+                std::unique_lock<std::mutex> lock(r.Mutex);
+                merge(*S, &r.Retired);
+                r.Shards.erase(std::find(r.Shards.begin(), r.Shards.end(), S));
+                delete S;
+            }
+        };
+        static thread_local Holder holder;
+        return *holder.S;
+    }
+
+    static void bump(value_t & v, uint64_t n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static uint64_t get(const value_t & v) { return v.load(std::memory_order_relaxed); }
+
+    static void merge(const Shard & from, Shard * to) {
+        for (unsigned c = 0; c < COUNTERS; ++c) bump(to->Counters[c], get(from.Counters[c]));
+        for (unsigned t = 0; t < TIMERS; ++t) {
+            bump(to->Count[t], get(from.Count[t]));
+            bump(to->Sum[t], get(from.Sum[t]));
+            for (unsigned b = 0; b < BUCKETS; ++b) bump(to->Buckets[t][b], get(from.Buckets[t][b]));
+        }
+        for (unsigned e = 0; e <= MAX_ERRNO; ++e) bump(to->Errors[e], get(from.Errors[e]));
+    }
+
+    static void collect(const Shard & s, Snapshot * snap) {
+        for (unsigned c = 0; c < COUNTERS; ++c) snap->Counters[c] += get(s.Counters[c]);
+        for (unsigned t = 0; t < TIMERS; ++t) {
+            snap->Timers[t].Count += get(s.Count[t]);
+            snap->Timers[t].SumUs += get(s.Sum[t]);
+            for (unsigned b = 0; b < BUCKETS; ++b) snap->Timers[t].Buckets[b] += get(s.Buckets[t][b]);
+        }
+        for (unsigned e = 0; e <= MAX_ERRNO; ++e) {
+            if (uint64_t n = get(s.Errors[e])) snap->Errors[(int) e] += n;
+        }
+    }
+};  // NetMetrics
+
+/*
+ * Thread-safe cache of resolved IPv4 addresses. getaddrinfo() does not
+ * tell the record TTL, so answers live for a fixed time, failures for a
+ * shorter one. Concurrent lookups of the same host wait for the one
+ * in flight instead of resolving it again.
+ */
+
+class DNSCache {
+public:
+    typedef std::function<bool(const std::string & host, in_addr * addr)> Resolver;
+    typedef std::chrono::steady_clock clock;
+
+    explicit DNSCache(unsigned ttlMs = 60000, unsigned negativeTtlMs = 5000,
+                      size_t maxEntries = 4096)
+        : mResolver(&DNSCache::resolve)
+        , mTtl(ttlMs)
+        , mNegativeTtl(negativeTtlMs)
+        , mMaxEntries(maxEntries)
+    {}
+
+    static DNSCache & instance() {
+        static DNSCache cache;
+        return cache;
+    }
+
+    bool lookup(const std::string & host, in_addr * addr) {
+        NetMetrics::add(NetMetrics::DNS_LOOKUPS);
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;) {
+            auto it = mEntries.find(host);
+            if (it == mEntries.end()) {
+                break;
+            }
+            if (it->second.Pending) {
+                mResolved.wait(lock);
+                continue;
+            }
+            if (clock::now() >= it->second.Expires) {
+                break;
+            }
+            *addr = it->second.Addr;
+            return it->second.Ok;
+        }
+        if (mEntries.size() >= mMaxEntries) {
+            evict();
+        }
+        mEntries[host].Pending = true;
+        Resolver resolver = mResolver;
+        lock.unlock();
+
+        in_addr resolved;
+        memset(&resolved, 0, sizeof(resolved));
+        const NetMetrics::clock::time_point start = NetMetrics::clock::now();
+        bool ok = false;
+        try {
+            ok = resolver(host, &resolved);
+        } catch (...) {
+            // nothing to cache: waiters retry the lookup themselves
+            lock.lock();
+            mEntries.erase(host);
+            mResolved.notify_all();
+            throw;
+        }
+        NetMetrics::add(NetMetrics::DNS_MISSES);
+        NetMetrics::time(NetMetrics::DNS_TIME, start);
+
+        lock.lock();
+        Entry & e = mEntries[host];
+        e.Addr = resolved;
+        e.Ok = ok;
+        e.Pending = false;
+        e.Expires = clock::now() + std::chrono::milliseconds(ok ? mTtl : mNegativeTtl);
+        mResolved.notify_all();
+        *addr = resolved;
+        return ok;
+    }
+
+    void setResolver(Resolver resolver) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mResolver = std::move(resolver);
+    }
+
+    void setTTL(unsigned ttlMs, unsigned negativeTtlMs) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mTtl = ttlMs;
+        mNegativeTtl = negativeTtlMs;
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (auto it = mEntries.begin(); it != mEntries.end();) {
+            it = it->second.Pending ? std::next(it) : mEntries.erase(it);
         }
+    }
+
+    size_t size() const {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mEntries.size();
+    }
+
+    // system resolver, the default one
+    static bool resolve(const std::string & host, in_addr * addr) {
         struct addrinfo hints, *p = NULL;
         memset(&hints, 0, sizeof(hints));
         hints.ai_family = AF_INET; // use AF_INET6 to force IPv6
-        hints.ai_socktype = socktype;
-        int rv = getaddrinfo(host, NULL, &hints, &p);
+        int rv = getaddrinfo(host.c_str(), NULL, &hints, &p);
         if (rv != 0) {
             WARN("getaddrinfo: %s", gai_strerror(rv));
             return false;
-        } 
-        memcpy(addr, p->ai_addr, sizeof(struct sockaddr_in));
+        }
+        *addr = ((sockaddr_in *) p->ai_addr)->sin_addr;
         freeaddrinfo(p);
         return true;
     }
+
+    // resolver reading "address name [aliases...]" lines of a hosts file
+    // on every call, stands in for DNS in tests and sandboxes
+    static Resolver hostsFile(const std::string & path) {
+        return [path](const std::string & host, in_addr * addr) {
+            FILE * f = fopen(path.c_str(), "r");
+            if (!f) {
+                return false;
+            }
+            bool found = false;
+            char line[1024];
+            while (!found && fgets(line, sizeof(line), f)) {
+                char * hash = strchr(line, '#');
+                if (hash) *hash = 0;
+                const char * seps = " \t\r\n";
+                char * save = 0;
+                char * ip = strtok_r(line, seps, &save);
+                if (!ip) continue;
+                for (char * name = strtok_r(0, seps, &save); name; name = strtok_r(0, seps, &save)) {
+                    if (host == name) {
+                        found = inet_pton(AF_INET, ip, addr) == 1;
+                        break;
+                    }
+                }
+            }
+            fclose(f);
+            return found;
+        };
+    }
+
+private:
+    struct Entry {
+        in_addr Addr;
+        bool Ok = false;
+        bool Pending = false;
+        clock::time_point Expires;
+    };
+
+    mutable std::mutex mMutex;
+    std::condition_variable mResolved;
+    std::map<std::string, Entry> mEntries;
+    Resolver mResolver;
+    unsigned mTtl;
+    unsigned mNegativeTtl;
+    size_t mMaxEntries;
+
+    // drops expired entries, everything settled when none are
+    void evict() {
+        const clock::time_point now = clock::now();
+        size_t before = mEntries.size();
+        for (auto it = mEntries.begin(); it != mEntries.end();) {
+            it = (!it->second.Pending && it->second.Expires <= now) ? mEntries.erase(it) : std::next(it);
+        }
+        if (mEntries.size() == before) {
+            for (auto it = mEntries.begin(); it != mEntries.end();) {
+                it = it->second.Pending ? std::next(it) : mEntries.erase(it);
+            }
+        }
+    }
+};  // DNSCache
+
+class NetUtils {
+public:
+    // numeric addresses are parsed, names go through DNSCache::instance()
+    static bool lookupIPv4(const char * host, struct sockaddr_in * addr, int /*socktype*/) {
+        unsigned long ret = inet_addr(host);
+        if (ret != INADDR_NONE && ret != INADDR_ANY) {
+            memcpy(&addr->sin_addr.s_addr, &ret, sizeof(ret));
+            return true;
+        }
+        return DNSCache::instance().lookup(host, &addr->sin_addr);
+    }
 };
 
+/*
+ * Preallocated datagrams for UDPSocket::write_batch() and read_batch():
+ * up to capacity() messages go by one sendmmsg()/recvmmsg() call.
+ * Sent datagrams point to the caller's memory, received ones are
+ * stored in the batch buffer, maxDatagram bytes for each.
+ */
+
+class UDPBatch {
+public:
+    explicit UDPBatch(unsigned capacity = 64, size_t maxDatagram = 2048)
+        : mCapacity(capacity)
+        , mMaxDatagram(maxDatagram)
+        , mSize(0)
+        , mBuffer(capacity * maxDatagram)
+        , mData(capacity)
+        , mLength(capacity)
+        , mAddr(capacity)
+        , mFlags(capacity)
+    {
+    #ifdef __linux__
+        mMsgs.resize(capacity);
+        mIov.resize(capacity);
+        memset(&mMsgs[0], 0, capacity * sizeof(mmsghdr));
+        for (unsigned i = 0; i < capacity; ++i) {
+            mMsgs[i].msg_hdr.msg_iov = &mIov[i];
+            mMsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    #endif
+    }
+
+    unsigned capacity() const { return mCapacity; }
+    unsigned size() const     { return mSize; }
+    bool full() const         { return mSize == mCapacity; }
+    void clear()              { mSize = 0; }
+
+    // queues a datagram to send, the data is not copied;
+    // with no address it goes to the peer of the socket
+    bool add(const void * data, size_t size, const sockaddr_in * to = 0) {
+        if (full()) {
+            return false;
+        }
+        mData[mSize] = (const char *) data;
+        mLength[mSize] = size;
+        mFlags[mSize] = to ? 1 : 0;
+        if (to) mAddr[mSize] = *to;
+        ++mSize;
+        return true;
+    }
+
+    // received datagrams
+    const char * data(unsigned i) const        { return mData[i]; }
+    size_t length(unsigned i) const            { return mLength[i]; }
+    const sockaddr_in & from(unsigned i) const { return mAddr[i]; }
+    // datagram was longer than maxDatagram
+    bool truncated(unsigned i) const           { return (mFlags[i] & MSG_TRUNC) != 0; }
+
+private:
+    friend class UDPSocket;
+
+    unsigned mCapacity;
+    size_t mMaxDatagram;
+    unsigned mSize;
+    std::vector<char> mBuffer;
+    std::vector<const char *> mData;
+    std::vector<size_t> mLength;
+    std::vector<sockaddr_in> mAddr;
+    std::vector<int> mFlags;    // has address when sending, msg_flags when received
+#ifdef __linux__
+    std::vector<mmsghdr> mMsgs;
+    std::vector<iovec> mIov;
+#endif
+
+    char * slot(unsigned i) { return &mBuffer[i * mMaxDatagram]; }
+};  // UDPBatch
+
 class UDPSocket {
     SOCKET mSocket;
     sockaddr_in mAddr;
@@ -103,7 +662,19 @@ class UDPSocket {
 public:
     explicit UDPSocket(SOCKET sd)
         : mSocket(sd)
-    {}
+    {
+        ::memset(&mAddr, 0, sizeof(mAddr));
+    }
+
+    // socket with no peer, to bind() and receive or to send with addresses
+    UDPSocket()
+        : mSocket(::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))
+    {
+        ::memset(&mAddr, 0, sizeof(mAddr));
+        if (mSocket == INVALID_SOCKET) {
+            WARN("socket() err='%d'", get_lasterror());
+        }
+    }
 
     explicit UDPSocket(const char * host, unsigned port)
         : mSocket(INVALID_SOCKET)
@@ -123,7 +694,9 @@ public:
     }
 
     ~UDPSocket() {
-        CLOSE_SOCKET(mSocket);
+        if (mSocket != INVALID_SOCKET) {
+            CLOSE_SOCKET(mSocket);
+        }
     }
 
     void release() { mSocket = INVALID_SOCKET; }
@@ -136,13 +709,167 @@ public:
 
     static int write_all(SOCKET sd, const char * buff, int count,
                          sockaddr_in * addr, int addr_len) {
-        return sendto(sd, buff, count, 0, (sockaddr*) addr, addr_len);
+        int rc = sendto(sd, buff, count, 0, (sockaddr*) addr, addr_len);
+        NetMetrics::io(NetMetrics::BYTES_OUT, rc);
+        if (rc >= 0) NetMetrics::add(NetMetrics::UDP_OUT);
+        return rc;
     }
 
     int write_all(const char * buff, int count) {
         return write_all(mSocket, buff, count, &mAddr, sizeof(mAddr));
     }
 
+    // binds for receiving, port 0 picks a free one (see port())
+    bool bind(const char * host, unsigned port) {
+        sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        if (!op::NetUtils::lookupIPv4(host, &addr, SOCK_DGRAM)) {
+            return false;
+        }
+        addr.sin_family = AF_INET;
+        addr.sin_port   = htons(port);
+        if (::bind(mSocket, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR) {
+            WARN("bind() err='%d'", get_lasterror());
+            return false;
+        }
+        return true;
+    }
+
+    unsigned port() const {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (::getsockname(mSocket, (sockaddr *) &addr, &len) != 0) {
+            return 0;
+        }
+        return ntohs(addr.sin_port);
+    }
+
+    const sockaddr_in & peer() const { return mAddr; }
+
+    // sends the queued datagrams, as many per syscall as the kernel takes;
+    // returns the number sent, less than size() when a non-blocking socket
+    // is full, or -1 when nothing could be sent
+    int write_batch(UDPBatch & batch) {
+        unsigned sent = 0;
+    #ifdef __linux__
+        for (unsigned i = 0; i < batch.mSize; ++i) {
+            msghdr & h = batch.mMsgs[i].msg_hdr;
+            batch.mIov[i].iov_base = (void *) batch.mData[i];
+            batch.mIov[i].iov_len = batch.mLength[i];
+            h.msg_name = batch.mFlags[i] ? (void *) &batch.mAddr[i] : (void *) &mAddr;
+            h.msg_namelen = sizeof(sockaddr_in);
+        }
+        while (sent < batch.mSize) {
+            int rc = ::sendmmsg(mSocket, &batch.mMsgs[sent], batch.mSize - sent, 0);
+            if (rc < 0) {
+                NetMetrics::io(NetMetrics::BYTES_OUT, rc);
+                if (errno == EINTR) continue;
+                break;
+            }
+            long bytes = 0;
+            for (int i = 0; i < rc; ++i) bytes += (long) batch.mMsgs[sent + i].msg_len;
+            NetMetrics::io(NetMetrics::BYTES_OUT, bytes);
+            NetMetrics::add(NetMetrics::UDP_OUT, rc);
+            sent += (unsigned) rc;
+        }
+    #else
+        for (; sent < batch.mSize; ++sent) {
+            sockaddr_in * to = batch.mFlags[sent] ? &batch.mAddr[sent] : &mAddr;
+            if (write_all(mSocket, batch.mData[sent], (int) batch.mLength[sent],
+                          to, sizeof(sockaddr_in)) < 0) break;
+        }
+    #endif
+        return (sent == 0 && batch.mSize > 0) ? -1 : (int) sent;
+    }
+
+    // receives up to capacity() datagrams into the batch; waits for the
+    // first one unless the socket is non-blocking or flags has MSG_DONTWAIT.
+    // Returns the number received, 0 when none are ready, -1 on error
+    int read_batch(UDPBatch & batch, int flags = 0) {
+        batch.mSize = 0;
+    #ifdef __linux__
+        for (unsigned i = 0; i < batch.mCapacity; ++i) {
+            msghdr & h = batch.mMsgs[i].msg_hdr;
+            batch.mIov[i].iov_base = batch.slot(i);
+            batch.mIov[i].iov_len = batch.mMaxDatagram;
+            h.msg_name = &batch.mAddr[i];
+            h.msg_namelen = sizeof(sockaddr_in);
+            h.msg_flags = 0;
+        }
+        int rc;
+        do {
+            rc = ::recvmmsg(mSocket, &batch.mMsgs[0], batch.mCapacity, flags | MSG_WAITFORONE, 0);
+            if (rc < 0) NetMetrics::io(NetMetrics::BYTES_IN, rc);
+        } while (rc < 0 && errno == EINTR);
+        if (rc < 0) {
+            return IS_EAGAIN ? 0 : -1;
+        }
+        long bytes = 0;
+        for (int i = 0; i < rc; ++i) {
+            batch.mData[i] = batch.slot(i);
+            batch.mLength[i] = std::min((size_t) batch.mMsgs[i].msg_len, batch.mMaxDatagram);
+            batch.mFlags[i] = batch.mMsgs[i].msg_hdr.msg_flags;
+            bytes += (long) batch.mLength[i];
+        }
+        NetMetrics::io(NetMetrics::BYTES_IN, bytes);
+        NetMetrics::add(NetMetrics::UDP_IN, rc);
+        batch.mSize = (unsigned) rc;
+    #else
+        for (; batch.mSize < batch.mCapacity; ++batch.mSize) {
+            const unsigned i = batch.mSize;
+            socklen_t len = sizeof(sockaddr_in);
+            int rc = ::recvfrom(mSocket, batch.slot(i), (int) batch.mMaxDatagram,
+                                i > 0 ? flags | MSG_DONTWAIT : flags,
+                                (sockaddr *) &batch.mAddr[i], &len);
+            NetMetrics::io(NetMetrics::BYTES_IN, rc);
+            if (rc >= 0) NetMetrics::add(NetMetrics::UDP_IN);
+            if (rc < 0) {
+                if (i > 0 || IS_EAGAIN) break;
+                return -1;
+            }
+            batch.mData[i] = batch.slot(i);
+            batch.mLength[i] = (size_t) rc;
+            batch.mFlags[i] = 0;
+        }
+    #endif
+        return (int) batch.mSize;
+    }
+
+    // receive loop of a bound socket: hands every batch to handler(batch)
+    // until it returns false or stop is set, which is checked at least
+    // every pollMs. Returns the number of datagrams received
+    template <class Handler>
+    uint64_t receive(UDPBatch & batch, Handler handler, const std::atomic<bool> & stop,
+                     int pollMs = 100) {
+        uint64_t total = 0;
+        while (!stop) {
+            int rc = read_batch(batch, MSG_DONTWAIT);
+            if (rc < 0) {
+                WARN("recvmmsg() err='%d'", get_lasterror());
+                break;
+            }
+            if (rc == 0) {
+                pollfd pfd;
+                pfd.fd = mSocket;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                ::poll(&pfd, 1, pollMs);
+                continue;
+            }
+            total += (uint64_t) rc;
+            if (!handler(batch)) break;
+        }
+        return total;
+    }
+
+    static void set_rcvbuf(SOCKET sd, int size) {
+        ::setsockopt(sd, SOL_SOCKET, SO_RCVBUF, (char*)&size, sizeof(size));
+    }
+
+    static void set_sndbuf(SOCKET sd, int size) {
+        ::setsockopt(sd, SOL_SOCKET, SO_SNDBUF, (char*)&size, sizeof(size));
+    }
+
     static void gracefulclose(SOCKET sd) {
         CLOSE_SOCKET(sd);
     }
@@ -161,13 +888,54 @@ public:
     }
 };
 
+/*
+ * Point in time an operation has to be done by, unlimited by default.
+ * remaining() is the timeout to give to poll().
+ */
+
+class Deadline {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    Deadline() : mInfinite(true) {}
+
+    // (unsigned) -1 means no deadline
+    explicit Deadline(unsigned ms)
+        : mInfinite(ms == (unsigned) -1)
+        , mAt(clock::now() + std::chrono::milliseconds(mInfinite ? 0 : ms))
+    {}
+
+    bool infinite() const { return mInfinite; }
+    bool expired() const  { return !mInfinite && clock::now() >= mAt; }
+    clock::time_point at() const { return mAt; }
+
+    // milliseconds left, rounded up; -1 when unlimited
+    int remaining() const {
+        if (mInfinite) return -1;
+        auto left = std::chrono::duration_cast<std::chrono::microseconds>(mAt - clock::now()).count();
+        return left <= 0 ? 0 : (int) std::min<long long>((left + 999) / 1000, 0x7fffffff);
+    }
+
+    static Deadline earliest(const Deadline & a, const Deadline & b) {
+        if (a.mInfinite) return b;
+        if (b.mInfinite) return a;
+        return a.mAt <= b.mAt ? a : b;
+    }
+
+private:
+    bool mInfinite;
+    clock::time_point mAt;
+};  // Deadline
+
 class TCPSocket {
 public:
     explicit TCPSocket(SOCKET sd)
         : mSocket(sd)
     {}
 
-    explicit TCPSocket(const char * host, unsigned port)
+    // connects within timeoutMs, (unsigned) -1 waits as long as the system
+    // does; on failure isOk() is false and errno is ETIMEDOUT on expiry
+    explicit TCPSocket(const char * host, unsigned port, unsigned timeoutMs = (unsigned) -1)
         : mSocket(INVALID_SOCKET)
     {
         mSocket = ::socket(AF_INET, SOCK_STREAM, 0);
@@ -179,21 +947,81 @@ public:
         ::memset(&addr, 0, sizeof(addr));
         if (!op::NetUtils::lookupIPv4(host, &addr, SOCK_STREAM)) {
             WARN("lookup() failed err=%d", get_lasterror());
+            CLOSE_SOCKET(mSocket);
+            mSocket = INVALID_SOCKET;
             return;
         }
         addr.sin_family = AF_INET;
         addr.sin_port   = htons(port);
 
-        if (::connect(mSocket, (sockaddr*) &addr, sizeof(addr)) < 0) {
-            WARN("connect() err='%d'", get_lasterror());
+        if (!connect(mSocket, addr, Deadline(timeoutMs))) {
+            const int err = get_lasterror();
+            WARN("connect() err='%d'", err);
             CLOSE_SOCKET(mSocket);
             mSocket = INVALID_SOCKET;
+            errno = err;
             return;
         }
     }
 
+    // non-blocking connect waited for with poll(), the socket stays blocking
+    static bool connect(SOCKET sd, const sockaddr_in & addr, const Deadline & deadline) {
+        const NetMetrics::clock::time_point start = NetMetrics::clock::now();
+        NetMetrics::add(NetMetrics::CONNECTS);
+        if (deadline.infinite()) {
+            return connected(::connect(sd, (const sockaddr*) &addr, sizeof(addr)) == 0, start);
+        }
+        set_nonblocking(sd, true);
+        int rc = ::connect(sd, (const sockaddr*) &addr, sizeof(addr));
+        if (rc < 0 && is_inprogress()) {
+            rc = wait_io(sd, POLLOUT, deadline);
+            if (rc > 0) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                ::getsockopt(sd, SOL_SOCKET, SO_ERROR, (char*)&err, &len);
+                rc = err ? -1 : 0;
+                if (err) errno = err;
+            } else if (rc == 0) {
+                errno = ETIMEDOUT;
+                rc = -1;
+            }
+        }
+        const int err = errno;
+        set_nonblocking(sd, false);
+        errno = err;
+        return connected(rc == 0, start);
+    }
+
+    // records the outcome of the connect started at start
+    static bool connected(bool ok, NetMetrics::clock::time_point start) {
+        if (ok) {
+            NetMetrics::time(NetMetrics::CONNECT_TIME, start);
+        } else {
+            const int err = get_lasterror();
+            NetMetrics::add(NetMetrics::CONNECT_ERRORS);
+            NetMetrics::error(err);
+            errno = err;
+        }
+        return ok;
+    }
+
+    // poll() for the events until the deadline: >0 ready, 0 expired, -1 error
+    static int wait_io(SOCKET sd, short events, const Deadline & deadline) {
+        for (;;) {
+            pollfd pfd;
+            pfd.fd      = sd;
+            pfd.events  = events;
+            pfd.revents = 0;
+            int rc = ::poll(&pfd, 1, deadline.remaining());
+            if (rc < 0 && errno == EINTR) continue;
+            return rc;
+        }
+    }
+
     ~TCPSocket() {
-        CLOSE_SOCKET(mSocket);
+        if (mSocket != INVALID_SOCKET) {
+            CLOSE_SOCKET(mSocket);
+        }
     }
 
     void release() { mSocket = INVALID_SOCKET; }
@@ -208,6 +1036,7 @@ public:
         int total = 0;
         for (int iret = 0; total < count;) {
             iret = send(sd, buff + total, count - total, 0);
+            NetMetrics::io(NetMetrics::BYTES_OUT, iret);
             if (iret <= 0) {
                 WARN("send() err='%d'", get_lasterror());
                 total = iret;
@@ -218,8 +1047,112 @@ public:
         return total;
     }
 
+#ifdef WIN32
+    typedef WSABUF iovec_t;
+    static void set_iov(iovec_t & v, const void * data, size_t size) {
+        v.buf = (char*) data;
+        v.len = (ULONG) size;
+    }
+    static size_t iov_size(const iovec_t & v) { return v.len; }
+#else
+    typedef struct iovec iovec_t;
+    static void set_iov(iovec_t & v, const void * data, size_t size) {
+        v.iov_base = (void*) data;
+        v.iov_len  = size;
+    }
+    static size_t iov_size(const iovec_t & v) { return v.iov_len; }
+#endif
+
+    // one gather write, returns bytes sent or -1
+    static long writev_some(SOCKET sd, iovec_t * iov, int count) {
+    #ifdef WIN32
+        DWORD sent = 0;
+        long rc = ::WSASend(sd, iov, count, &sent, 0, 0, 0) != 0 ? -1 : (long) sent;
+    #else
+        static const int max_iov = 1024;    // IOV_MAX on Linux
+        // sendmsg() instead of writev() for MSG_NOSIGNAL: a closed peer is
+        // an error here, not a SIGPIPE for the whole process
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = std::min(count, max_iov);
+    #ifdef MSG_NOSIGNAL
+        long rc = (long) ::sendmsg(sd, &msg, MSG_NOSIGNAL);
+    #else
+        long rc = (long) ::sendmsg(sd, &msg, 0);
+    #endif
+    #endif
+        NetMetrics::io(NetMetrics::BYTES_OUT, rc);
+        return rc;
+    }
+
+    // scatter read into the buffers, returns bytes received, 0 on close or -1
+    static long readv_some(SOCKET sd, iovec_t * iov, int count) {
+    #ifdef WIN32
+        DWORD got = 0, flags = 0;
+        long rc = ::WSARecv(sd, iov, count, &got, &flags, 0, 0) != 0 ? -1 : (long) got;
+    #else
+        long rc = (long) ::readv(sd, iov, count);
+    #endif
+        NetMetrics::io(NetMetrics::BYTES_IN, rc);
+        return rc;
+    }
+
+    // gather write of everything, returns total bytes or -1;
+    // with a deadline errno is ETIMEDOUT when it expires
+    static long writev_all(SOCKET sd, iovec_t * iov, int count,
+                           const Deadline & deadline = Deadline()) {
+        long total = 0;
+        if (!deadline.infinite()) {
+            set_nonblocking(sd, true);
+        }
+        while (count > 0) {
+            if (!deadline.infinite()) {
+                int rc = wait_io(sd, POLLOUT, deadline);
+                if (rc <= 0) {
+                    if (rc == 0) errno = ETIMEDOUT;
+                    total = -1;
+                    break;
+                }
+            }
+            long n = writev_some(sd, iov, count);
+            if (n < 0) {
+                if (errno == EINTR || (!deadline.infinite() && IS_EAGAIN)) continue;
+                WARN("writev() err='%d'", get_lasterror());
+                total = -1;
+                break;
+            }
+            total += n;
+            iov_advance(iov, count, (size_t) n);
+        }
+        if (!deadline.infinite()) {
+            const int err = errno;
+            set_nonblocking(sd, false);
+            errno = err;
+        }
+        return total;
+    }
+
+    // skips n written bytes of the iovec array
+    static void iov_advance(iovec_t *& iov, int & count, size_t n) {
+        while (count > 0 && n >= iov_size(*iov)) {
+            n -= iov_size(*iov);
+            ++iov;
+            --count;
+        }
+        if (count > 0 && n > 0) {
+        #ifdef WIN32
+            set_iov(*iov, iov->buf + n, iov->len - n);
+        #else
+            set_iov(*iov, (char*) iov->iov_base + n, iov->iov_len - n);
+        #endif
+        }
+    }
+
     int recvthis(char * buff, int count) {
-        return recv(mSocket, buff, count, 0);
+        int rc = recv(mSocket, buff, count, 0);
+        NetMetrics::io(NetMetrics::BYTES_IN, rc);
+        return rc;
     }
 
     int write_all(const char * buff, int count) {
@@ -230,6 +1163,7 @@ public:
         int total = 0;
         for (int iret = 0; total < count;) {
             iret = recv(sd, buff + total, count - total, 0);
+            NetMetrics::io(NetMetrics::BYTES_IN, iret);
             if (iret == 0) break;
             if (iret < 0) {
                 WARN("recv() sd=%d err='%d'", sd, get_lasterror());
@@ -270,23 +1204,577 @@ public:
         optval.tv_usec = msec;
         ::setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, (char*)&optval, sizeof(optval));
     }
-
-private:
-    SOCKET mSocket;
-
-    TCPSocket(const TCPSocket &);
-    TCPSocket operator= (const TCPSocket &);
-};
-
-class TCPServer {
+    static void set_nodelay(SOCKET sd, bool value) {
+        const int optval = value ? 1 : 0;
+        ::setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, (char*)&optval, sizeof(optval));
+    }
+    static bool set_reuseport(SOCKET sd, bool value) {
+        #ifdef SO_REUSEPORT
+            const int optval = value ? 1 : 0;
+            return ::setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, (char*)&optval, sizeof(optval)) == 0;
+        #else
+            (void) sd;
+            return !value;
+        #endif
+    }
+    static bool is_inprogress() {
+        #if WIN32
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        #else
+            return errno == EINPROGRESS;
+        #endif
+    }
+    static bool set_nonblocking(SOCKET sd, bool value) {
+        #if WIN32
+            u_long optval = value ? 1 : 0;
+            return ::ioctlsocket(sd, FIONBIO, &optval) == 0;
+        #else
+            int flags = ::fcntl(sd, F_GETFL, 0);
+            if (flags < 0) return false;
+            flags = value ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+            return ::fcntl(sd, F_SETFL, flags) == 0;
+        #endif
+    }
+
+private:
+    SOCKET mSocket;
+
+    TCPSocket(const TCPSocket &);
+    TCPSocket operator= (const TCPSocket &);
+};
+
+/*
+ * Byte ring of power of two capacity. Data and free space are at most
+ * two segments each, so the socket fills or drains the whole ring with
+ * one readv()/writev() without moving bytes around; linearize() makes
+ * the data contiguous when a caller needs one view of it.
+ */
+
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity) {
+        size_t c = 64;
+        while (c < capacity) c <<= 1;
+        mBuff.resize(c);
+        mMask = c - 1;
+    }
+
+    size_t capacity() const { return mBuff.size(); }
+    size_t size() const     { return mTail - mHead; }
+    size_t free() const     { return capacity() - size(); }
+    bool empty() const      { return mTail == mHead; }
+    void clear()            { mHead = mTail = 0; }
+
+    // data segments, returns their number (0..2)
+    int readable(TCPSocket::iovec_t * iov) const {
+        return segments(iov, mHead, size());
+    }
+
+    // free space segments after the data
+    int writable(TCPSocket::iovec_t * iov) {
+        return segments(iov, mTail, free());
+    }
+
+    void commit(size_t n)  { mTail += n; }
+    void consume(size_t n) {
+        mHead += n;
+        if (mHead == mTail) mHead = mTail = 0;  // next fill is one segment
+    }
+
+    size_t write(const void * data, size_t size) {
+        size = std::min(size, free());
+        const size_t pos = mTail & mMask;
+        const size_t first = std::min(size, capacity() - pos);
+        memcpy(&mBuff[pos], data, first);
+        memcpy(&mBuff[0], (const char *) data + first, size - first);
+        mTail += size;
+        return size;
+    }
+
+    size_t read(void * data, size_t size) {
+        size = std::min(size, this->size());
+        const size_t pos = mHead & mMask;
+        const size_t first = std::min(size, capacity() - pos);
+        memcpy(data, &mBuff[pos], first);
+        memcpy((char *) data + first, &mBuff[0], size - first);
+        consume(size);
+        return size;
+    }
+
+    // all data as one view, moves it to the start when it wraps
+    std::string_view linearize() {
+        const size_t pos = mHead & mMask;
+        if (pos + size() > capacity()) {
+            std::rotate(mBuff.begin(), mBuff.begin() + pos, mBuff.end());
+            const size_t n = size();
+            mHead = 0;
+            mTail = n;
+        }
+        return std::string_view(&mBuff[mHead & mMask], size());
+    }
+
+private:
+    std::vector<char> mBuff;
+    size_t mMask;
+    size_t mHead = 0;   // positions grow, index is pos & mMask
+    size_t mTail = 0;
+
+    int segments(TCPSocket::iovec_t * iov, size_t from, size_t n) const {
+        if (n == 0) return 0;
+        const size_t pos = from & mMask;
+        const size_t first = std::min(n, capacity() - pos);
+        TCPSocket::set_iov(iov[0], &mBuff[pos], first);
+        if (first == n) return 1;
+        TCPSocket::set_iov(iov[1], &mBuff[0], n - first);
+        return 2;
+    }
+};  // RingBuffer
+
+/*
+ * Buffered stream over a connected blocking socket. Reads fill the
+ * input ring with as much as the socket has, lines and delimited
+ * records are returned as views into the ring which stay valid until
+ * the next read. Small writes are collected in the output ring and go
+ * out together on flush(), or when the ring fills up.
+ */
+
+class SocketStream {
+public:
+    explicit SocketStream(SOCKET sd, size_t readBuffer = 64 * 1024, size_t writeBuffer = 64 * 1024)
+        : mSocket(sd)
+        , mIn(readBuffer)
+        , mOut(writeBuffer)
+        , mToConsume(0)
+        , mScanned(0)
+        , mEof(false)
+        , mFailed(false)
+        , mSyscalls(0)
+    {}
+
+    SOCKET sd() const { return mSocket; }
+
+    // peer closed the connection and everything was read
+    bool eof() const    { return mEof && mIn.empty(); }
+    bool failed() const { return mFailed; }
+
+    // bytes received and not read yet
+    size_t buffered() const { return mIn.size() - mToConsume; }
+
+    // recv()/send() calls made so far
+    uint64_t syscalls() const { return mSyscalls; }
+
+    // next line without "\n" and "\r\n"; false at the end of the stream,
+    // on errors and on lines longer than the read buffer
+    bool readLine(std::string_view * line) {
+        if (!readUntil("\n", line)) {
+            return false;
+        }
+        if (!line->empty() && line->back() == '\r') line->remove_suffix(1);
+        return true;
+    }
+
+    // next record ending with the delimiter, returned without it
+    bool readUntil(std::string_view delim, std::string_view * out) {
+        release();
+        for (;;) {
+            std::string_view data = mIn.linearize();
+            const size_t from = mScanned >= delim.size() ? mScanned - delim.size() + 1 : 0;
+            const size_t pos = data.find(delim, from);
+            if (pos != std::string_view::npos) {
+                *out = data.substr(0, pos);
+                mToConsume = pos + delim.size();
+                mScanned = 0;
+                return true;
+            }
+            mScanned = data.size();
+            if (mIn.free() == 0) {
+                WARN("record is longer than %u", (unsigned) mIn.capacity());
+                mFailed = true;
+                return false;
+            }
+            if (!fill()) {
+                return false;
+            }
+        }
+    }
+
+    // exactly n bytes, n up to the read buffer capacity
+    bool read(size_t n, std::string_view * out) {
+        release();
+        if (n > mIn.capacity()) {
+            return false;
+        }
+        while (mIn.size() < n) {
+            if (!fill()) return false;
+        }
+        *out = mIn.linearize().substr(0, n);
+        mToConsume = n;
+        return true;
+    }
+
+    // up to count bytes, the buffered ones first; 0 at the end of stream
+    int read(char * buff, int count) {
+        release();
+        if (mIn.empty() && count > 0 && !fill()) {
+            return mFailed ? -1 : 0;
+        }
+        return (int) mIn.read(buff, (size_t) count);
+    }
+
+    // buffered, sent when the ring is full or on flush(); writes larger
+    // than the ring go out with the buffered bytes in one gather write
+    bool write(const void * data, size_t size) {
+        if (mFailed) {
+            return false;
+        }
+        if (size <= mOut.free()) {
+            mOut.write(data, size);
+            return true;
+        }
+        if (size < mOut.capacity()) {
+            return flush() && mOut.write(data, size) == size;
+        }
+        TCPSocket::iovec_t iov[3];
+        int count = mOut.readable(iov);
+        TCPSocket::set_iov(iov[count++], data, size);
+        return send(iov, count);
+    }
+
+    bool write(std::string_view s) { return write(s.data(), s.size()); }
+
+    bool flush() {
+        TCPSocket::iovec_t iov[2];
+        int count = mOut.readable(iov);
+        return count == 0 || send(iov, count);
+    }
+
+private:
+    SOCKET mSocket;
+    RingBuffer mIn;
+    RingBuffer mOut;
+    size_t mToConsume;  // record returned by the last read
+    size_t mScanned;    // data already searched for the delimiter
+    bool mEof;
+    bool mFailed;
+    uint64_t mSyscalls;
+
+    void release() {
+        mIn.consume(mToConsume);
+        mToConsume = 0;
+    }
+
+    // one readv() into all the free space of the ring
+    bool fill() {
+        if (mEof || mFailed) {
+            return false;
+        }
+        TCPSocket::iovec_t iov[2];
+        int count = mIn.writable(iov);
+        for (;;) {
+            ++mSyscalls;
+            long n = TCPSocket::readv_some(mSocket, iov, count);
+            if (n > 0) {
+                mIn.commit((size_t) n);
+                return true;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                WARN("recv() err='%d'", TCPSocket::get_lasterror());
+                mFailed = true;
+            } else {
+                mEof = true;
+            }
+            return false;
+        }
+    }
+
+    // sends the output ring with the extra buffer, if any
+    bool send(TCPSocket::iovec_t * iov, int count) {
+        TCPSocket::iovec_t * p = iov;
+        while (count > 0) {
+            ++mSyscalls;
+            long n = TCPSocket::writev_some(mSocket, p, count);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                WARN("send() err='%d'", TCPSocket::get_lasterror());
+                mFailed = true;
+                return false;
+            }
+            TCPSocket::iov_advance(p, count, (size_t) n);
+        }
+        mOut.clear();
+        return true;
+    }
+};  // SocketStream
+
+#ifdef __linux__
+
+/*
+ * Edge-triggered epoll loop. Handlers are kept in the table indexed by
+ * descriptor, each slot has a generation so events of the descriptor
+ * that was closed and reused within one epoll_wait() batch are dropped.
+ * Everything but stop() and post() must be called from the loop thread.
+ */
+
+class EventLoop {
+public:
+    enum {
+        READ   = 1,
+        WRITE  = 2,
+        CLOSED = 4  // error or hang up
+    };
+    typedef std::function<void(SOCKET sd, unsigned events)> Handler;
+
+    EventLoop()
+        : mEpoll(::epoll_create1(EPOLL_CLOEXEC))
+        , mWakeup(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        , mStop(false)
+        , mEvents(1024)
+    {
+        if (mEpoll < 0 || mWakeup < 0) {
+            WARN("epoll_create1()/eventfd() err='%d'", errno);
+            return;
+        }
+        epoll_event ev;
+        ev.events  = EPOLLIN | EPOLLET;
+        ev.data.u64 = (uint64_t) -1;
+        ::epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWakeup, &ev);
+    }
+
+    ~EventLoop() {
+        if (mEpoll >= 0) ::close(mEpoll);
+        if (mWakeup >= 0) ::close(mWakeup);
+    }
+
+    bool isOk() const { return mEpoll >= 0 && mWakeup >= 0; }
+
+    // loop that runs on the calling thread or NULL
+    static EventLoop *& current() {
+        static thread_local EventLoop * loop = 0;
+        return loop;
+    }
+
+    bool add(SOCKET sd, unsigned events, Handler handler) {
+        if (sd < 0) return false;
+        if ((size_t) sd >= mSlots.size()) {
+            mSlots.resize(std::max<size_t>(sd + 1, mSlots.size() * 2));
+        }
+        Slot & slot = mSlots[sd];
+        if (slot.Active) {
+            return false;
+        }
+        epoll_event ev;
+        ev.events   = mask(events);
+        ev.data.u64 = ((uint64_t) (slot.Generation + 1) << 32) | (uint32_t) sd;
+        if (::epoll_ctl(mEpoll, EPOLL_CTL_ADD, sd, &ev) != 0) {
+            WARN("epoll_ctl(ADD) sd=%d err='%d'", sd, errno);
+            return false;
+        }
+        ++slot.Generation;
+        slot.Active  = true;
+        slot.Data    = 0;
+        slot.Callback = std::make_shared<Handler>(std::move(handler));
+        ++mCount;
+        return true;
+    }
+
+    bool modify(SOCKET sd, unsigned events) {
+        if (!has(sd)) return false;
+        epoll_event ev;
+        ev.events   = mask(events);
+        ev.data.u64 = ((uint64_t) mSlots[sd].Generation << 32) | (uint32_t) sd;
+        return ::epoll_ctl(mEpoll, EPOLL_CTL_MOD, sd, &ev) == 0;
+    }
+
+    // stop watching sd, the descriptor itself stays open
+    void remove(SOCKET sd) {
+        if (!has(sd)) return;
+        ::epoll_ctl(mEpoll, EPOLL_CTL_DEL, sd, 0);
+        Slot & slot = mSlots[sd];
+        slot.Active = false;
+        slot.Callback.reset();
+        --mCount;
+    }
+
+    bool has(SOCKET sd) const {
+        return sd >= 0 && (size_t) sd < mSlots.size() && mSlots[sd].Active;
+    }
+
+    size_t size() const { return mCount; }
+
+    // epoll_wait() calls made so far
+    uint64_t waits() const { return mWaits; }
+
+    // user pointer attached to sd, kept after remove() until the next add()
+    void setData(SOCKET sd, void * data) {
+        if (sd >= 0 && (size_t) sd < mSlots.size()) mSlots[sd].Data = data;
+    }
+    void * data(SOCKET sd) const {
+        return (sd >= 0 && (size_t) sd < mSlots.size()) ? mSlots[sd].Data : 0;
+    }
+
+    // runs the task on the loop thread, may be called from any thread
+    void post(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mTasksMutex);
+            mTasks.push_back(std::move(task));
+        }
+        wakeup();
+    }
+
+    std::vector<SOCKET> descriptors() const {
+        std::vector<SOCKET> result;
+        for (size_t i = 0; i < mSlots.size(); ++i)
+            if (mSlots[i].Active) result.push_back((SOCKET) i);
+        return result;
+    }
+
+    // waits once for events and dispatches them, -1 on error
+    int runOnce(int timeout_ms) {
+        ++mWaits;
+        int n = ::epoll_wait(mEpoll, &mEvents[0], (int) mEvents.size(), timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) return 0;
+            WARN("epoll_wait() err='%d'", errno);
+            return -1;
+        }
+        for (int i = 0; i < n; ++i) {
+            const epoll_event & ev = mEvents[i];
+            if (ev.data.u64 == (uint64_t) -1) {
+                uint64_t value;
+                while (::read(mWakeup, &value, sizeof(value)) > 0);
+                runTasks();
+                continue;
+            }
+            SOCKET   sd  = (SOCKET) (uint32_t) ev.data.u64;
+            uint32_t gen = (uint32_t) (ev.data.u64 >> 32);
+            if (!has(sd) || mSlots[sd].Generation != gen) {
+                continue;
+            }
+            unsigned events = 0;
+            if (ev.events & (EPOLLIN | EPOLLRDHUP)) events |= READ;
+            if (ev.events & EPOLLOUT)               events |= WRITE;
+            if (ev.events & (EPOLLERR | EPOLLHUP))  events |= CLOSED;
+            // handler may remove itself or the table may grow while it runs
+            std::shared_ptr<Handler> handler = mSlots[sd].Callback;
+            (*handler)(sd, events);
+        }
+        if (n == (int) mEvents.size()) {
+            mEvents.resize(mEvents.size() * 2);
+        }
+        return n;
+    }
+
+    void run() {
+        EventLoop * prev = current();
+        current() = this;
+        while (!mStop.load(std::memory_order_acquire)) {
+            if (runOnce(-1) < 0) break;
+        }
+        current() = prev;
+    }
+
+    // may be called from any thread
+    void stop() {
+        mStop.store(true, std::memory_order_release);
+        wakeup();
+    }
+
+private:
+    struct Slot {
+        bool Active = false;
+        uint32_t Generation = 0;
+        void * Data = 0;
+        std::shared_ptr<Handler> Callback;
+    };
+
+    int mEpoll;
+    int mWakeup;
+    std::atomic<bool> mStop;
+    std::vector<epoll_event> mEvents;
+    std::vector<Slot> mSlots;
+    size_t mCount = 0;
+    uint64_t mWaits = 0;
+    std::mutex mTasksMutex;
+    std::vector<std::function<void()> > mTasks;
+    std::vector<std::function<void()> > mRunning;
+
+    void wakeup() {
+        uint64_t one = 1;
+        if (::write(mWakeup, &one, sizeof(one)) < 0) {
+            WARN("eventfd write err='%d'", errno);
+        }
+    }
+
+    void runTasks() {
+        {
+            std::unique_lock<std::mutex> lock(mTasksMutex);
+            mRunning.swap(mTasks);
+        }
+        for (size_t i = 0; i < mRunning.size(); ++i) {
+            mRunning[i]();
+        }
+        mRunning.clear();
+    }
+
+    static uint32_t mask(unsigned events) {
+        uint32_t m = EPOLLET | EPOLLRDHUP;
+        if (events & READ)  m |= EPOLLIN;
+        if (events & WRITE) m |= EPOLLOUT;
+        return m;
+    }
+
+    EventLoop(const EventLoop &);
+    EventLoop operator= (const EventLoop &);
+};
+
+#endif // __linux__
+
+class TCPServer {
 public:
-    explicit TCPServer(unsigned port) { mIsOk = listenPort(port); }
+    // reuseport allows eventLoop() to run several threads each with
+    // its own listening socket on the same port (SO_REUSEPORT)
+    explicit TCPServer(unsigned port, bool reuseport = false)
+        : mReusePort(reuseport)
+    {
+        mIsOk = listenPort(port, false, reuseport);
+    }
     virtual ~TCPServer() {}
-    virtual void incomingConnection(SOCKET sd, sockaddr * sa, socklen_t sa_len) = 0;
+
+    // called by loop() for each accepted connection, sd is blocking
+    virtual void incomingConnection(SOCKET sd, sockaddr * sa, socklen_t sa_len) {
+        (void) sa; (void) sa_len;
+        CLOSE_SOCKET(sd);
+    }
+
+    // eventLoop() hooks, called on the loop thread with non-blocking sd.
+    // Read/write until EAGAIN (edge-triggered), call closeConnection()
+    // when done with the connection.
+    virtual void onAccept(SOCKET sd, sockaddr * sa, socklen_t sa_len) {
+        (void) sd; (void) sa; (void) sa_len;
+    }
+    virtual void onReadable(SOCKET sd) { (void) sd; }
+    virtual void onWritable(SOCKET sd) { (void) sd; }
+    virtual void onClose(SOCKET sd)    { (void) sd; }
 
     // no errors?
     bool isOk() { return mIsOk; }
 
+    // connections accepted so far and open now (eventLoop() only),
+    // NetMetrics has the same summed over all servers
+    uint64_t accepts() const { return mAccepts.load(std::memory_order_relaxed); }
+    int64_t activeConnections() const { return mActive.load(std::memory_order_relaxed); }
+
+    // port the server is listening on
+    unsigned port() const {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (::getsockname(mSrvSocket, (sockaddr*) &addr, &len) != 0) {
+            return 0;
+        }
+        return ntohs(addr.sin_port);
+    }
+
     // main server loop
     void loop() {
         if (!mIsOk) {
@@ -300,10 +1788,6 @@ public:
         sockaddr_in in_addr;
         socklen_t   in_addr_len;
         for (;;) {
-            if (listen(mSrvSocket , 10) == SOCKET_ERROR) {
-                WARN("listen() err='%d'", TCPSocket::get_lasterror());
-                break;
-            }
             in_addr_len = sizeof(in_addr);
             in_socket   = ::accept(mSrvSocket, (sockaddr*) &in_addr, &in_addr_len);
             if (in_socket <= 0) {
@@ -311,6 +1795,8 @@ public:
                 break;
             }
             LOG("accept() ip='%s'", inet_ntoa(in_addr.sin_addr));
+            mAccepts.fetch_add(1, std::memory_order_relaxed);
+            NetMetrics::add(NetMetrics::ACCEPTS);
             this->incomingConnection(in_socket, (sockaddr*) &in_addr, in_addr_len);
         }
 
@@ -319,67 +1805,906 @@ public:
         LOG("-LOOP");
     }
 
+#ifdef __linux__
+    // reactor server loop: edge-triggered epoll, non-blocking accept and
+    // readiness hooks for every connection, runs until stop().
+    // With num_threads > 1 every thread runs its own loop, and when the
+    // server was created with reuseport its own listening socket, so the
+    // kernel spreads connections across them. Hooks are then called
+    // concurrently, each connection always on the same thread.
+    void eventLoop(unsigned num_threads = 1) {
+        if (!mIsOk) {
+            WARN("can't enter server loop");
+            return;
+        }
+        if (num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        LOG("+EVLOOP threads=%u", num_threads);
+
+        std::vector<SOCKET> listeners(1, mSrvSocket);
+        for (unsigned i = 1; i < num_threads; ++i) {
+            SOCKET sd = mSrvSocket;
+            if (mReusePort) {
+                sd = openListener(port(), false, true);
+                if (sd == INVALID_SOCKET) {
+                    WARN("can't open SO_REUSEPORT listener, sharing the socket");
+                    sd = mSrvSocket;
+                }
+            }
+            listeners.push_back(sd);
+        }
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < num_threads; ++i) {
+            threads.emplace_back(&TCPServer::runEventLoop, this, listeners[i]);
+        }
+        runEventLoop(mSrvSocket);
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+        for (size_t i = 1; i < listeners.size(); ++i) {
+            if (listeners[i] != mSrvSocket) CLOSE_SOCKET(listeners[i]);
+        }
+        CLOSE_SOCKET(mSrvSocket);
+
+        LOG("-EVLOOP");
+    }
+
+    // leave eventLoop(), may be called from any thread
+    void stop() {
+        std::unique_lock<std::mutex> lock(mLoopsMutex);
+        mStopping = true;
+        for (size_t i = 0; i < mLoops.size(); ++i) {
+            mLoops[i]->stop();
+        }
+    }
+
+    // calls onClose() and closes the connection, from the loop thread
+    void closeConnection(SOCKET sd) {
+        EventLoop * loop = EventLoop::current();
+        if (loop) {
+            closeConnection(*loop, sd);
+        }
+    }
+#endif // __linux__
+
 protected:
     SOCKET mSrvSocket;
     bool mIsOk;
+    bool mReusePort;
+    std::atomic<uint64_t> mAccepts{0};
+    std::atomic<int64_t> mActive{0};
+
+    // bookkeeping of the connections served by the hooks
+    void countAccept() {
+        mAccepts.fetch_add(1, std::memory_order_relaxed);
+        mActive.fetch_add(1, std::memory_order_relaxed);
+        NetMetrics::add(NetMetrics::ACCEPTS);
+        NetMetrics::add(NetMetrics::ACTIVE);
+    }
+    void countClose() {
+        mActive.fetch_sub(1, std::memory_order_relaxed);
+        NetMetrics::add(NetMetrics::ACTIVE, -1);
+    }
+#ifdef __linux__
+    std::mutex mLoopsMutex;
+    std::vector<EventLoop*> mLoops;
+    bool mStopping = false;
+
+    void runEventLoop(SOCKET srv) {
+        EventLoop loop;
+        if (!loop.isOk()) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mLoopsMutex);
+            if (mStopping) {
+                return;
+            }
+            mLoops.push_back(&loop);
+        }
+        TCPSocket::set_nonblocking(srv, true);
+        EventLoop * pLoop = &loop;
+        loop.add(srv, EventLoop::READ, [this, pLoop](SOCKET sd, unsigned) {
+            acceptAll(*pLoop, sd);
+        });
+        loop.run();
+
+        // hooks of the connections closed here may need the loop as well
+        EventLoop * prev = EventLoop::current();
+        EventLoop::current() = &loop;
+        loop.remove(srv);
+        std::vector<SOCKET> rest = loop.descriptors();
+        for (size_t i = 0; i < rest.size(); ++i) {
+            closeConnection(loop, rest[i]);
+        }
+        EventLoop::current() = prev;
+        std::unique_lock<std::mutex> lock(mLoopsMutex);
+        mLoops.erase(std::find(mLoops.begin(), mLoops.end(), &loop));
+    }
+
+    void acceptAll(EventLoop & loop, SOCKET srv) {
+        EventLoop * pLoop = &loop;
+        for (;;) {
+            sockaddr_in in_addr;
+            socklen_t in_addr_len = sizeof(in_addr);
+            SOCKET sd = ::accept4(srv, (sockaddr*) &in_addr, &in_addr_len,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (sd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    WARN("accept4() err='%d'", errno);
+                }
+                break;
+            }
+            bool added = loop.add(sd, EventLoop::READ | EventLoop::WRITE,
+                [this, pLoop](SOCKET sd, unsigned events) {
+                    if (events & EventLoop::READ) {
+                        onReadable(sd);
+                    }
+                    if ((events & EventLoop::WRITE) && pLoop->has(sd)) {
+                        onWritable(sd);
+                    }
+                    if ((events & EventLoop::CLOSED) && pLoop->has(sd)) {
+                        closeConnection(*pLoop, sd);
+                    }
+                });
+            if (!added) {
+                CLOSE_SOCKET(sd);
+                continue;
+            }
+            countAccept();
+            onAccept(sd, (sockaddr*) &in_addr, in_addr_len);
+        }
+    }
+
+    void closeConnection(EventLoop & loop, SOCKET sd) {
+        if (!loop.has(sd)) {
+            return;
+        }
+        loop.remove(sd);
+        onClose(sd);
+        CLOSE_SOCKET(sd);
+        countClose();
+    }
+#endif // __linux__
+
+    bool listenPort(unsigned port, bool reuseaddr = false, bool reuseport = false) {
+        mSrvSocket = openListener(port, reuseaddr, reuseport);
+        return mSrvSocket != INVALID_SOCKET;
+    }
 
-    bool listenPort(unsigned port, bool reuseaddr = false) {
-        bool bRet = false;
-        mSrvSocket = ::socket(AF_INET, SOCK_STREAM, 0);
-        if (mSrvSocket  == INVALID_SOCKET) {
+    // socket options must be set before bind() to take effect
+    static SOCKET openListener(unsigned port, bool reuseaddr, bool reuseport) {
+        SOCKET sd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (sd == INVALID_SOCKET) {
             WARN("socket() err='%d'", TCPSocket::get_lasterror());
+            return INVALID_SOCKET;
+        }
+        TCPSocket::set_reuseaddr(sd, reuseaddr);
+        if (reuseport && !TCPSocket::set_reuseport(sd, true)) {
+            WARN("SO_REUSEPORT err='%d'", TCPSocket::get_lasterror());
+        }
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+
+        if (::bind(sd, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            WARN("bind() err='%d'", TCPSocket::get_lasterror());
+            CLOSE_SOCKET(sd);
+            return INVALID_SOCKET;
+        }
+        if (::listen(sd, SOMAXCONN) == SOCKET_ERROR) {
+            WARN("listen() err='%d'", TCPSocket::get_lasterror());
+            CLOSE_SOCKET(sd);
+            return INVALID_SOCKET;
+        }
+        return sd;
+    }
+};
+
+/*
+ * Keep-alive connections of HTTP clients by "host:port". A connection
+ * is taken with acquire() for one request and given back with release();
+ * idle ones are closed after the idle timeout. At most maxPerHost
+ * connections (busy and idle) are open to one host, acquire() waits for
+ * a free one up to the wait timeout. HTTP uses it for keep-alive requests
+ * only.
+ */
+
+class HTTPConnectionPool {
+public:
+    explicit HTTPConnectionPool(unsigned maxPerHost = 16, unsigned idleTimeoutMs = 30000,
+                                unsigned waitTimeoutMs = 10000)
+        : mMaxPerHost(maxPerHost)
+        , mIdleTimeout(idleTimeoutMs)
+        , mWaitTimeout(waitTimeoutMs)
+    {}
+
+    ~HTTPConnectionPool() { clear(); }
+
+    static HTTPConnectionPool & instance() {
+        static HTTPConnectionPool pool;
+        return pool;
+    }
+
+    void setMaxPerHost(unsigned v)   { std::unique_lock<std::mutex> lock(mMutex); mMaxPerHost = v; }
+    void setIdleTimeout(unsigned ms) { std::unique_lock<std::mutex> lock(mMutex); mIdleTimeout = ms; }
+    void setWaitTimeout(unsigned ms) { std::unique_lock<std::mutex> lock(mMutex); mWaitTimeout = ms; }
+
+    // connected socket, *reused tells it was idle in the pool; waiting
+    // for a free connection and connecting end by the deadline, then
+    // errno is ETIMEDOUT
+    SOCKET acquire(const std::string & host, unsigned port, bool * reused = 0,
+                   const Deadline & connectDeadline = Deadline()) {
+        const std::string key = makeKey(host, port);
+        std::unique_lock<std::mutex> lock(mMutex);
+        Host & h = mHosts[key];
+        const Deadline wait = Deadline::earliest(Deadline(mWaitTimeout), connectDeadline);
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(wait.infinite() ? 0x7fffffff : wait.remaining());
+        for (;;) {
+            dropExpired(h);
+            while (!h.Idle.empty()) {
+                SOCKET sd = h.Idle.back().Sd;
+                h.Idle.pop_back();
+                if (isAlive(sd)) {
+                    if (reused) *reused = true;
+                    return sd;
+                }
+                CLOSE_SOCKET(sd);
+                --h.Open;
+            }
+            if (h.Open < mMaxPerHost) {
+                break;
+            }
+            if (mCV.wait_until(lock, deadline) == std::cv_status::timeout) {
+                WARN("no free connection to %s", key.c_str());
+                errno = ETIMEDOUT;
+                return INVALID_SOCKET;
+            }
+        }
+        ++h.Open;
+        lock.unlock();
+
+        op::TCPSocket socket(host.c_str(), port, (unsigned) connectDeadline.remaining());
+        SOCKET sd = socket.sd();
+        socket.release();
+        if (sd == INVALID_SOCKET) {
+            const int err = errno;
+            lock.lock();
+            --h.Open;
+            mCV.notify_one();
+            errno = err;
         } else {
-            sockaddr_in addr;
-            memset(&addr, 0, sizeof(addr));
-            addr.sin_family      = AF_INET;
-            addr.sin_port        = htons(port);
-            addr.sin_addr.s_addr = INADDR_ANY;
-
-            if (::bind(mSrvSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
-                CLOSE_SOCKET(mSrvSocket);
-                WARN("bind() err='%d'", TCPSocket::get_lasterror());
-            } else {
-                TCPSocket::set_reuseaddr(mSrvSocket, reuseaddr);
-                bRet = true;
+            // requests are written whole, don't wait for acks between them
+            TCPSocket::set_nodelay(sd, true);
+        }
+        if (reused) *reused = false;
+        return sd;
+    }
+
+    // gives the connection back, not reusable one is closed
+    void release(const std::string & host, unsigned port, SOCKET sd, bool reusable) {
+        if (sd == INVALID_SOCKET) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mMutex);
+        Host & h = mHosts[makeKey(host, port)];
+        if (reusable && mIdleTimeout > 0) {
+            IdleSocket idle;
+            idle.Sd    = sd;
+            idle.Since = std::chrono::steady_clock::now();
+            h.Idle.push_back(idle);
+        } else {
+            CLOSE_SOCKET(sd);
+            --h.Open;
+        }
+        mCV.notify_one();
+    }
+
+    size_t idle(const std::string & host, unsigned port) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        std::map<std::string, Host>::iterator it = mHosts.find(makeKey(host, port));
+        return it != mHosts.end() ? it->second.Idle.size() : 0;
+    }
+
+    // closes all idle connections
+    void clear() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (std::map<std::string, Host>::iterator it = mHosts.begin(); it != mHosts.end(); ++it) {
+            for (size_t i = 0; i < it->second.Idle.size(); ++i) {
+                CLOSE_SOCKET(it->second.Idle[i].Sd);
             }
+            it->second.Open -= (unsigned) it->second.Idle.size();
+            it->second.Idle.clear();
+        }
+        mCV.notify_all();
+    }
+
+private:
+    struct IdleSocket {
+        SOCKET Sd;
+        std::chrono::steady_clock::time_point Since;
+    };
+    struct Host {
+        std::vector<IdleSocket> Idle;   // the most recent at the back
+        unsigned Open = 0;              // busy and idle
+    };
+
+    std::mutex mMutex;
+    std::condition_variable mCV;
+    std::map<std::string, Host> mHosts;
+    unsigned mMaxPerHost;
+    unsigned mIdleTimeout;
+    unsigned mWaitTimeout;
+
+    static std::string makeKey(const std::string & host, unsigned port) {
+        return host + ":" + std::to_string(port);
+    }
+
+    void dropExpired(Host & h) {
+        std::chrono::steady_clock::time_point limit =
+            std::chrono::steady_clock::now() - std::chrono::milliseconds(mIdleTimeout);
+        size_t n = 0;
+        for (; n < h.Idle.size() && h.Idle[n].Since < limit; ++n) {
+            CLOSE_SOCKET(h.Idle[n].Sd);
         }
-        return bRet;
+        h.Idle.erase(h.Idle.begin(), h.Idle.begin() + n);
+        h.Open -= (unsigned) n;
+    }
+
+    // idle connection must have nothing to read, otherwise peer closed it
+    static bool isAlive(SOCKET sd) {
+        char c;
+    #ifdef WIN32
+        u_long avail = 0;
+        return ::ioctlsocket(sd, FIONREAD, &avail) == 0 && avail == 0;
+    #else
+        int rc = ::recv(sd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    #endif
+    }
+
+    HTTPConnectionPool(const HTTPConnectionPool &);
+    HTTPConnectionPool operator= (const HTTPConnectionPool &);
+};
+
+/*
+ * Resumable parser of the HTTP/1.x response. feed() takes the stream in
+ * pieces of any size; status line and headers are collected up to the
+ * header limit and exposed as views, body bytes are handed to the sink
+ * as they arrive (chunked encoding already decoded), so memory used does
+ * not depend on the body size. Informational 1xx responses are skipped.
+ */
+
+class HTTPResponseParser {
+public:
+    typedef std::string_view view_t;
+    // gets body bytes, returns false to abort
+    typedef std::function<bool(const char * data, size_t size)> BodySink;
+
+    enum State {
+        HEAD,           // status line and headers
+        BODY_LENGTH,    // Content-Length bytes
+        CHUNK_SIZE,     // chunk size line
+        CHUNK_DATA,
+        CHUNK_END,      // CRLF after the chunk data
+        TRAILERS,
+        BODY_EOF,       // till the connection close
+        DONE,
+        FAILED
+    };
+
+    explicit HTTPResponseParser(size_t maxHeaderSize = 64 * 1024)
+        : mMaxHeaderSize(maxHeaderSize)
+    {
+        reset();
+    }
+
+    // ready for the next response, noBody for the answers to HEAD
+    void reset(bool noBody = false) {
+        mState = HEAD;
+        mNoBody = noBody;
+        mHead.clear();
+        mLine.clear();
+        mHeaders.clear();
+        mStatus = 0;
+        mReason = view_t();
+        mRemaining = 0;
+        mReceived = 0;
+        mContentLength = (uint64_t) -1;
+        mChunked = false;
+        mClose = false;
+    }
+
+    void setSink(BodySink sink) { mSink = std::move(sink); }
+
+    // consumes the piece of the stream, returns the number of bytes used:
+    // less than size only when the response is done or parsing failed
+    size_t feed(const char * data, size_t size) {
+        size_t used = 0;
+        while (used < size && mState != DONE && mState != FAILED) {
+            used += step(data + used, size - used);
+        }
+        return used;
+    }
+
+    // peer closed the connection, false if the response is incomplete
+    bool finish() {
+        if (mState == BODY_EOF) {
+            mState = DONE;
+        } else if (mState != DONE) {
+            mState = FAILED;
+        }
+        return mState == DONE;
+    }
+
+    State state() const        { return mState; }
+    bool isDone() const        { return mState == DONE; }
+    bool isFailed() const      { return mState == FAILED; }
+    bool headersDone() const   { return mState != HEAD && mState != FAILED; }
+
+    int status() const         { return mStatus; }
+    view_t reason() const      { return mReason; }
+    // status line and headers including the final empty line
+    const std::string & head() const { return mHead; }
+    const std::vector<std::pair<view_t, view_t> > & headers() const { return mHeaders; }
+
+    // value of the header (case-insensitive name) or empty view
+    view_t header(view_t name) const {
+        for (size_t i = 0; i < mHeaders.size(); ++i) {
+            if (equalsNoCase(mHeaders[i].first, name)) return mHeaders[i].second;
+        }
+        return view_t();
+    }
+    bool hasHeader(view_t name) const {
+        for (size_t i = 0; i < mHeaders.size(); ++i) {
+            if (equalsNoCase(mHeaders[i].first, name)) return true;
+        }
+        return false;
+    }
+
+    bool isChunked() const           { return mChunked; }
+    uint64_t contentLength() const   { return mContentLength; }  // -1 if unknown
+    uint64_t bodyReceived() const    { return mReceived; }
+
+    // connection may carry the next response
+    bool keepAlive() const { return mState == DONE && !mClose; }
+
+    static bool equalsNoCase(view_t a, view_t b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (::tolower((unsigned char) a[i]) != ::tolower((unsigned char) b[i])) return false;
+        return true;
+    }
+    static bool containsNoCase(view_t s, view_t what) {
+        return std::search(s.begin(), s.end(), what.begin(), what.end(), [](char a, char b) {
+            return ::tolower((unsigned char) a) == ::tolower((unsigned char) b);
+        }) != s.end();
+    }
+
+private:
+    static const size_t MAX_LINE = 4096;
+
+    State mState;
+    bool mNoBody;
+    size_t mMaxHeaderSize;
+    std::string mHead;
+    std::string mLine;      // partial chunk size or trailer line
+    std::vector<std::pair<view_t, view_t> > mHeaders;
+    int mStatus;
+    view_t mReason;
+    uint64_t mRemaining;
+    uint64_t mReceived;
+    uint64_t mContentLength;
+    bool mChunked;
+    bool mClose;
+    BodySink mSink;
+
+    bool body(const char * data, size_t size) {
+        mReceived += size;
+        if (mSink && !mSink(data, size)) {
+            mState = FAILED;
+            return false;
+        }
+        return true;
+    }
+
+    // collects the line ending with LF into mLine, returns bytes used
+    size_t line(const char * data, size_t size, bool * complete) {
+        const char * lf = (const char *) memchr(data, '\n', size);
+        size_t n = lf ? (size_t) (lf - data) + 1 : size;
+        mLine.append(data, n);
+        *complete = (lf != 0);
+        if (mLine.size() > MAX_LINE) {
+            mState = FAILED;
+        }
+        return n;
+    }
+
+    size_t step(const char * data, size_t size) {
+        switch (mState) {
+        case HEAD: {
+            size_t old = mHead.size();
+            mHead.append(data, size);
+            size_t end = mHead.find("\r\n\r\n", old > 3 ? old - 3 : 0);
+            if (end == std::string::npos) {
+                if (mHead.size() > mMaxHeaderSize) mState = FAILED;
+                return size;
+            }
+            mHead.resize(end + 4);
+            size_t used = end + 4 - old;
+            if (!parseHead()) {
+                mState = FAILED;
+            } else if (mStatus / 100 == 1 && mStatus != 101) {
+                mHead.clear();  // 100 Continue and friends
+                mHeaders.clear();
+            }
+            return used;
+        }
+        case BODY_LENGTH: {
+            size_t n = (size_t) std::min<uint64_t>(mRemaining, size);
+            mRemaining -= n;
+            if (body(data, n) && mRemaining == 0) mState = DONE;
+            return n;
+        }
+        case BODY_EOF:
+            body(data, size);
+            return size;
+        case CHUNK_SIZE: {
+            bool complete = false;
+            size_t n = line(data, size, &complete);
+            if (complete && mState != FAILED) {
+                char * end = 0;
+                mRemaining = strtoull(mLine.c_str(), &end, 16);
+                if (end == mLine.c_str()) {
+                    mState = FAILED;
+                } else {
+                    mState = (mRemaining == 0) ? TRAILERS : CHUNK_DATA;
+                }
+                mLine.clear();
+            }
+            return n;
+        }
+        case CHUNK_DATA: {
+            size_t n = (size_t) std::min<uint64_t>(mRemaining, size);
+            mRemaining -= n;
+            if (body(data, n) && mRemaining == 0) mState = CHUNK_END;
+            return n;
+        }
+        case CHUNK_END: {
+            bool complete = false;
+            size_t n = line(data, size, &complete);
+            if (complete && mState != FAILED) {
+                mState = (mLine == "\r\n" || mLine == "\n") ? CHUNK_SIZE : FAILED;
+                mLine.clear();
+            }
+            return n;
+        }
+        case TRAILERS: {
+            bool complete = false;
+            size_t n = line(data, size, &complete);
+            if (complete && mState != FAILED) {
+                if (mLine == "\r\n" || mLine == "\n") mState = DONE;
+                mLine.clear();
+            }
+            return n;
+        }
+        default:
+            return size;
+        }
+    }
+
+    bool parseHead() {
+        view_t head(mHead.data(), mHead.size() - 2);
+        size_t eol = head.find("\r\n");
+        view_t statusLine = head.substr(0, eol);
+        // HTTP/1.1 200 OK
+        if (statusLine.compare(0, 5, "HTTP/") != 0) return false;
+        size_t sp = statusLine.find(' ');
+        if (sp == view_t::npos) return false;
+        mStatus = atoi(statusLine.data() + sp + 1);
+        size_t sp2 = statusLine.find(' ', sp + 1);
+        mReason = (sp2 != view_t::npos) ? statusLine.substr(sp2 + 1) : view_t();
+        mClose = statusLine.compare(0, 8, "HTTP/1.0") == 0;
+
+        for (size_t pos = eol + 2; pos < head.size();) {
+            size_t end = head.find("\r\n", pos);
+            view_t h = head.substr(pos, end - pos);
+            pos = end + 2;
+            size_t colon = h.find(':');
+            if (colon == view_t::npos) continue;
+            view_t name = h.substr(0, colon), value = h.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back()  == ' ' || value.back()  == '\t')) value.remove_suffix(1);
+            mHeaders.push_back(std::make_pair(name, value));
+            if (equalsNoCase(name, "Content-Length")) {
+                mContentLength = strtoull(std::string(value).c_str(), 0, 10);
+            } else if (equalsNoCase(name, "Transfer-Encoding")) {
+                mChunked = containsNoCase(value, "chunked");
+            } else if (equalsNoCase(name, "Connection")) {
+                if (containsNoCase(value, "close")) mClose = true;
+                if (containsNoCase(value, "keep-alive")) mClose = false;
+            }
+        }
+
+        if (mStatus / 100 == 1 && mStatus != 101) {
+            mState = HEAD;
+        } else if (mNoBody || mStatus == 204 || mStatus == 304) {
+            mState = DONE;
+        } else if (mChunked) {
+            mState = CHUNK_SIZE;
+        } else if (mContentLength != (uint64_t) -1) {
+            mRemaining = mContentLength;
+            mState = (mRemaining == 0) ? DONE : BODY_LENGTH;
+        } else {
+            mState = BODY_EOF;
+            mClose = true;
+        }
+        return true;
+    }
+};
+
+#if (OPNET_HTTP_ZLIB == 1)
+
+/*
+ * Streaming inflate of a gzip or deflate body: the input is decoded as
+ * it arrives and handed on in pieces of at most CHUNK bytes, so nothing
+ * of the compressed body is buffered.
+ */
+
+class HTTPInflater {
+public:
+    typedef HTTPResponseParser::BodySink BodySink;
+    static constexpr size_t CHUNK = 16 * 1024;
+
+    HTTPInflater() : mState(IDLE), mOut(CHUNK) { memset(&mZ, 0, sizeof(mZ)); }
+    ~HTTPInflater() { reset(); }
+
+    HTTPInflater(const HTTPInflater &) = delete;
+    HTTPInflater & operator=(const HTTPInflater &) = delete;
+
+    // before the next body
+    void reset() {
+        if (mState >= DETECT) inflateEnd(&mZ);
+        memset(&mZ, 0, sizeof(mZ));
+        mState = IDLE;
+    }
+
+    // picks the decoder by Content-Encoding, false for bodies that are
+    // not compressed and are passed through
+    bool begin(std::string_view encoding) {
+        reset();
+        mState = PASS;
+        int bits;
+        if (HTTPResponseParser::containsNoCase(encoding, "gzip")) {
+            bits = 15 + 16;
+        } else if (HTTPResponseParser::containsNoCase(encoding, "deflate")) {
+            bits = 15;
+        } else {
+            return false;
+        }
+        if (inflateInit2(&mZ, bits) != Z_OK) {
+            return false;
+        }
+        mState = (bits == 15) ? DETECT : INFLATE;
+        return true;
+    }
+
+    bool started() const   { return mState != IDLE; }
+    // compressed stream was cut before its end
+    bool truncated() const { return mState == DETECT || mState == INFLATE; }
+
+    bool feed(const char * data, size_t size, const BodySink & sink) {
+        if (mState == PASS) {
+            return sink(data, size);
+        }
+        if (mState == DETECT && size > 0) {
+            // "deflate" is zlib wrapped by the spec, some servers send raw
+            // deflate: CMF byte of zlib is 0x?8 with window up to 32K
+            const unsigned char cmf = (unsigned char) data[0];
+            if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7) {
+                inflateReset2(&mZ, -15);
+            }
+            mState = INFLATE;
+        }
+        if (mState != INFLATE) {
+            return mState == DONE ? size == 0 : true;
+        }
+        mZ.next_in  = (Bytef *) data;
+        mZ.avail_in = (uInt) size;
+        for (;;) {
+            mZ.next_out  = (Bytef *) &mOut[0];
+            mZ.avail_out = (uInt) mOut.size();
+            int rc = inflate(&mZ, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                WARN("inflate() err=%d", rc);
+                return false;
+            }
+            size_t n = mOut.size() - mZ.avail_out;
+            if (n > 0 && !sink(&mOut[0], n)) {
+                return false;
+            }
+            if (rc == Z_STREAM_END) {
+                mState = DONE;
+                return true;
+            }
+            if ((mZ.avail_in == 0 && mZ.avail_out > 0) || rc == Z_BUF_ERROR) {
+                return true;
+            }
+        }
+    }
+
+private:
+    enum State { IDLE, PASS, DETECT, INFLATE, DONE };
+
+    State mState;
+    z_stream mZ;
+    std::vector<char> mOut;
+};  // HTTPInflater
+
+#endif // OPNET_HTTP_ZLIB
+
+/*
+ * Request head serialized into the buffer that is kept between requests,
+ * so steady state serialization does no allocations. The body is not
+ * copied here, it is sent from the caller's memory with a gather write.
+ */
+
+class HTTPHeaderBuilder {
+public:
+    typedef std::string_view view_t;
+
+    explicit HTTPHeaderBuilder(size_t capacity = 4096)
+        : mBuff(capacity)
+        , mSize(0)
+    {}
+
+    void clear() { mSize = 0; }
+
+    // "METHOD /uri?query HTTP/1.1"
+    HTTPHeaderBuilder & requestLine(view_t method, view_t uri, view_t query = view_t()) {
+        append(method);
+        append(' ');
+        if (uri.empty() || uri[0] != '/') append('/');
+        append(uri);
+        if (!query.empty()) {
+            append('?');
+            append(query);
+        }
+        append(" HTTP/1.1\r\n");
+        return *this;
+    }
+
+    // "HTTP/1.1 200 OK"
+    HTTPHeaderBuilder & statusLine(int status, view_t reason) {
+        char code[4] = { (char) ('0' + status / 100 % 10), (char) ('0' + status / 10 % 10),
+                         (char) ('0' + status % 10), ' ' };
+        append("HTTP/1.1 ");
+        append(view_t(code, 4));
+        append(reason);
+        append("\r\n");
+        return *this;
+    }
+
+    HTTPHeaderBuilder & header(view_t name, view_t value) {
+        append(name);
+        append(": ");
+        append(value);
+        append("\r\n");
+        return *this;
+    }
+
+    HTTPHeaderBuilder & header(view_t name, uint64_t value) {
+        char digits[24];
+        char * end = digits + sizeof(digits);
+        char * p = end;
+        do { *--p = (char) ('0' + value % 10); value /= 10; } while (value);
+        return header(name, view_t(p, end - p));
+    }
+
+    // the empty line that ends the head
+    HTTPHeaderBuilder & end() {
+        append("\r\n");
+        return *this;
+    }
+
+    view_t str() const  { return view_t(mBuff.data(), mSize); }
+    const char * data() const { return mBuff.data(); }
+    size_t size() const { return mSize; }
+
+private:
+    std::vector<char> mBuff;
+    size_t mSize;
+
+    void append(char c) {
+        if (mSize == mBuff.size()) mBuff.resize(mBuff.size() * 2 + 16);
+        mBuff[mSize++] = c;
+    }
+    void append(view_t s) {
+        if (mSize + s.size() > mBuff.size()) {
+            mBuff.resize(std::max(mBuff.size() * 2, mSize + s.size()));
+        }
+        memcpy(&mBuff[mSize], s.data(), s.size());
+        mSize += s.size();
     }
 };
 
 class HTTP {
+public:
+    typedef HTTPResponseParser::BodySink BodySink;
+
 private:
-    op::TCPSocket mSocket;
-    std::vector<char> mData;
-    const char * mBody;
+    HTTPConnectionPool * mPool;
+    HTTPResponseParser mResponse;
+    HTTPHeaderBuilder mHead;
+    std::vector<char> mData;    // body when no sink is given
+    std::vector<char> mRecvBuffer;
     std::string mHost;
+    unsigned mPort;
     bool mKeepAlive;
     bool mGzip;
     std::string mCookie;
     unsigned mTimeout;
+    unsigned mConnectTimeout;
+    unsigned mIOTimeout;
+    bool mTimedOut;
+    NetMetrics::clock::time_point mSentAt;
+#if (OPNET_HTTP_ZLIB == 1)
+    HTTPInflater mInflater;
+#endif
 
 public:
+    // status of requests that ran out of time, see setTimeout()
+    static constexpr int TIMED_OUT = 599;
+
     explicit HTTP(const std::string & host, unsigned port = 80)
-        : mSocket(host.c_str(), port)
-        , mBody(0)
+        : mPool(&HTTPConnectionPool::instance())
+        , mRecvBuffer(16 * 1024)
         , mHost(host)
+        , mPort(port)
         , mKeepAlive(false)
         , mGzip(false)
         , mTimeout((unsigned)-1)
+        , mConnectTimeout((unsigned)-1)
+        , mIOTimeout((unsigned)-1)
+        , mTimedOut(false)
     {}
 
-    const char * headers() const { return &mData[0]; }
-    const char * body()    const { return mBody; }
+    const char * headers() const { return mResponse.head().c_str(); }
+    const char * body()    const { return mData.empty() ? 0 : &mData[0]; }
+    size_t bodySize()      const { return mData.empty() ? 0 : mData.size() - 1; }
 
+    // parsed status line and headers of the last response
+    const HTTPResponseParser & response() const { return mResponse; }
+
+    // keep-alive connections are taken from and returned to the pool
     void setKeepAlive(bool value){ mKeepAlive = value; }
     bool isKeepAlive() const     {  return mKeepAlive; }
 
+    void setPool(HTTPConnectionPool * pool) { mPool = pool; }
+
+    // asks for compressed bodies, with OPNET_HTTP_ZLIB they are inflated
+    // on the fly and body() or the sink get the decoded bytes
     void setGzip(bool value)     { mGzip = value; }
     bool isGzip() const          {  return mGzip; }
 
     void setCookie(const std::string & v) { mCookie = v; }
 
-    void setTimeout(unsigned v) { mTimeout = v; }
+    // deadlines in ms, (unsigned) -1 for none: the whole request, the
+    // connect and every wait for the socket to send or receive; when one
+    // expires the request returns TIMED_OUT and the connection is closed
+    void setTimeout(unsigned ms)        { mTimeout = ms; }
+    void setConnectTimeout(unsigned ms) { mConnectTimeout = ms; }
+    void setIOTimeout(unsigned ms)      { mIOTimeout = ms; }
+
+    // the last request ran out of time
+    bool timedOut() const { return mTimedOut; }
 
     int GET(const std::string & uri, const std::string & data = std::string()) {
         return request("GET", uri, data);
@@ -389,85 +2714,402 @@ public:
         return request("POST", uri, data);
     }
 
-    int request(const std::string & method, const std::string & uri, const std::string & d = std::string()) {
-        if (!mSocket.isOk()) {
-            return 500;
+    // body is passed to the sink piece by piece instead of body()
+    int GET(const std::string & uri, const std::string & data, BodySink sink) {
+        return request("GET", uri, data, std::move(sink));
+    }
+
+    // body is sent straight from the caller's memory
+    int POST(const std::string & uri, const char * body, size_t size,
+             const std::string & contentType, BodySink sink = BodySink()) {
+        return perform("POST", uri, std::string_view(), std::string_view(body, size),
+                       contentType, std::move(sink));
+    }
+
+    int request(const std::string & method, const std::string & uri,
+                const std::string & d = std::string(), BodySink sink = BodySink()) {
+        if (!method.compare("POST")) {
+            return perform(method, uri, std::string_view(), d, FORM_URLENCODED, std::move(sink));
+        }
+        return perform(method, uri, d, std::string_view(), std::string_view(), std::move(sink));
+    }
+
+    int perform(std::string_view method, std::string_view uri, std::string_view query,
+                std::string_view body, std::string_view contentType, BodySink sink = BodySink()) {
+        mData.clear();
+        mTimedOut = false;
+        const Deadline deadline(mTimeout);
+        const NetMetrics::clock::time_point started = NetMetrics::clock::now();
+        NetMetrics::add(NetMetrics::HTTP_REQUESTS);
+
+        mHead.clear();
+        writeHead(mHead, method, uri, query, body, contentType, isKeepAlive());
+        TCPSocket::iovec_t iov[2];
+        TCPSocket::set_iov(iov[0], mHead.data(), mHead.size());
+        TCPSocket::set_iov(iov[1], body.data(), body.size());
+        const int iovCount = body.empty() ? 1 : 2;
+        const size_t total = mHead.size() + body.size();
+#if (OPNET_HTTP_LOG_REQ == 1)
+        JUSTLOG("%.*s", (int) mHead.size(), mHead.data());
+#endif
+        mResponse.reset(method == "HEAD");
+        if (!sink) {
+            sink = [this](const char * data, size_t size) {
+                mData.insert(mData.end(), data, data + size);
+                return true;
+            };
+        }
+        mResponse.setSink(decoding(std::move(sink)));
+
+        // idle connection may be closed by the server in the meantime,
+        // then the request is repeated once on a new one
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = false;
+            SOCKET sd = connectSocket(&reused, Deadline::earliest(deadline, Deadline(mConnectTimeout)));
+            if (sd == INVALID_SOCKET) {
+                mTimedOut = (errno == ETIMEDOUT);
+                break;
+            }
+            bool reusable = false;
+            size_t received = 0;
+            int status = -1;
+            TCPSocket::iovec_t v[2] = { iov[0], iov[1] };
+            if (TCPSocket::writev_all(sd, v, iovCount,
+                    Deadline::earliest(deadline, Deadline(mIOTimeout))) == (long) total) {
+                mSentAt = NetMetrics::clock::now();
+                status = readResponse(sd, &reusable, &received, deadline);
+            } else {
+                mTimedOut = (errno == ETIMEDOUT);
+            }
+            releaseSocket(sd, reusable);
+            if (status >= 0) {
+                return counted(status, started);
+            }
+            if (mTimedOut || !reused || received > 0) {
+                break;
+            }
         }
+        mData.clear();
+        return counted(mTimedOut ? TIMED_OUT : 500, started);
+    }
 
-//        bool hasTimeout = (mTimeout != (unsigned) -1);
-//        if (hasTimeout) {
-//            TCPSocket::set_rcvtimeo(mSocket.sd(), 0, 300);
-//        }
+    struct Request {
+        std::string Method;
+        std::string Uri;
+        std::string Data;
+    };
+
+    struct Response {
+        int Status = 500;
+        std::string Headers;
+        std::string Body;
+        double LatencyMs = 0;   // since the batch was started
+    };
+
+    // HTTP/1.1 pipelining: all requests are written back-to-back on one
+    // connection with gather writes while the answers are read and matched
+    // in order. Returns the number of answered requests, the rest get 500.
+    size_t pipeline(const std::vector<Request> & requests, std::vector<Response> * responses,
+                    double * totalMs = 0) {
+        typedef std::chrono::steady_clock clock;
+        const clock::time_point start = clock::now();
+
+        responses->assign(requests.size(), Response());
+        if (requests.empty()) {
+            return 0;
+        }
+        // all heads go to one buffer, bodies are sent from the requests
+        mHead.clear();
+        std::vector<size_t> offsets(requests.size() + 1, 0);
+        for (size_t i = 0; i < requests.size(); ++i) {
+            const Request & r = requests[i];
+            const bool post = !r.Method.compare("POST");
+            const bool last = (i + 1 == requests.size());
+            writeHead(mHead, r.Method, r.Uri,
+                post ? std::string_view() : std::string_view(r.Data),
+                post ? std::string_view(r.Data) : std::string_view(),
+                post ? FORM_URLENCODED : std::string_view(),
+                isKeepAlive() || !last);
+            offsets[i + 1] = mHead.size();
+        }
+        std::vector<TCPSocket::iovec_t> iov;
+        iov.reserve(requests.size() * 2);
+        for (size_t i = 0; i < requests.size(); ++i) {
+            TCPSocket::iovec_t v;
+            TCPSocket::set_iov(v, mHead.data() + offsets[i], offsets[i + 1] - offsets[i]);
+            iov.push_back(v);
+            if (!requests[i].Method.compare("POST") && !requests[i].Data.empty()) {
+                TCPSocket::set_iov(v, requests[i].Data.data(), requests[i].Data.size());
+                iov.push_back(v);
+            }
+        }
 
-        bool postMethod = (!method.compare("POST"));
+        mTimedOut = false;
+        const Deadline deadline(mTimeout);
+        NetMetrics::add(NetMetrics::HTTP_REQUESTS, (int64_t) requests.size());
+        size_t answered = 0;
+        // as in perform(): a reused connection closed by the server before
+        // any answer byte came is replaced once and the batch sent again
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = false;
+            size_t received = 0;
+            SOCKET sd = connectSocket(&reused, Deadline::earliest(deadline, Deadline(mConnectTimeout)));
+            if (sd == INVALID_SOCKET) {
+                mTimedOut = (errno == ETIMEDOUT);
+                if (mTimedOut) {
+                    for (size_t i = 0; i < responses->size(); ++i) (*responses)[i].Status = TIMED_OUT;
+                }
+                break;
+            }
+            TCPSocket::set_nonblocking(sd, true);
+
+            // writes advance the vectors, each attempt starts from a copy
+            std::vector<TCPSocket::iovec_t> out(iov);
+            TCPSocket::iovec_t * pending = &out[0];
+            int pendingCount = (int) out.size();
+            bool broken = false;
+            Response * current = &(*responses)[0];
+            mResponse.reset(!requests[0].Method.compare("HEAD"));
+            mResponse.setSink(decoding([&current](const char * data, size_t size) {
+                current->Body.append(data, size);
+                return true;
+            }));
+
+            bool firstByte = true;
+            while (answered < requests.size() && !broken) {
+                pollfd pfd;
+                pfd.fd      = sd;
+                pfd.events  = POLLIN | (pendingCount > 0 ? POLLOUT : 0);
+                pfd.revents = 0;
+                int ready = ::poll(&pfd, 1, Deadline::earliest(deadline, Deadline(mIOTimeout)).remaining());
+                if (ready < 0) {
+                    if (errno == EINTR) continue;
+                    broken = true;
+                    break;
+                }
+                if (ready == 0) {
+                    mTimedOut = true;
+                    broken = true;
+                    for (size_t i = answered; i < responses->size(); ++i) (*responses)[i].Status = TIMED_OUT;
+                    break;
+                }
+                if ((pfd.revents & POLLOUT) && pendingCount > 0) {
+                    long n = TCPSocket::writev_some(sd, pending, pendingCount);
+                    if (n < 0 && !IS_EAGAIN) {
+                        broken = true;
+                    } else if (n > 0) {
+                        TCPSocket::iov_advance(pending, pendingCount, (size_t) n);
+                    }
+                }
+                if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+                    continue;
+                }
+                int rc = ::recv(sd, &mRecvBuffer[0], (int) mRecvBuffer.size(), 0);
+                NetMetrics::io(NetMetrics::BYTES_IN, rc);
+                if (rc < 0) {
+                    if (!IS_EAGAIN) broken = true;
+                    continue;
+                }
+                received += (size_t) rc;
+                if (rc > 0 && firstByte) {
+                    firstByte = false;
+                    NetMetrics::time(NetMetrics::FIRST_BYTE_TIME, start);
+                }
+                if (rc == 0) {
+                    if (mResponse.finish() && decoded()) {
+                        current->Status  = mResponse.status();
+                        current->Headers = mResponse.head();
+                        current->LatencyMs = std::chrono::duration<double, std::milli>(
+                            clock::now() - start).count();
+                        ++answered;
+                    }
+                    broken = true;
+                    break;
+                }
+                // one read may hold the tail of one answer and the next ones
+                for (size_t used = 0; used < (size_t) rc && !broken;) {
+                    used += mResponse.feed(&mRecvBuffer[0] + used, (size_t) rc - used);
+                    if (mResponse.isFailed()) {
+                        broken = true;
+                    } else if (mResponse.isDone() && !decoded()) {
+                        broken = true;
+                    } else if (mResponse.isDone()) {
+                        current->Status    = mResponse.status();
+                        current->Headers   = mResponse.head();
+                        current->LatencyMs = std::chrono::duration<double, std::milli>(
+                            clock::now() - start).count();
+                        if (!mResponse.keepAlive()) broken = true;
+                        if (++answered == requests.size()) break;
+                        current = &(*responses)[answered];
+                        mResponse.reset(!requests[answered].Method.compare("HEAD"));
+                        resetDecoding();
+                    }
+                }
+            }
 
-        std::stringstream ss;
-        ss << method << " ";
-        if (uri.at(0) != '/')
-            ss << '/';
-        ss << uri;
-        if (!postMethod && !d.empty()) {
-            ss << "?" << d;
+            mResponse.setSink(BodySink());
+            TCPSocket::set_nonblocking(sd, false);
+            releaseSocket(sd, !broken && pendingCount == 0);
+            if (!broken || mTimedOut || !reused || received > 0) {
+                break;
+            }
         }
-        ss << " HTTP/1.1\r\n";
-        ss << "Host: " <<  mHost << "\r\n";
-        if (isGzip()) {
-            ss << "Accept-Encoding: gzip, deflate\r\n";
+        if (totalMs) {
+            *totalMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
         }
-        ss << "User-Agent: opHttp/1.1\r\n";
-        if (postMethod) {
-            ss << "Content-Type: application/x-www-form-urlencoded\r\n"
-               << "Content-Length: " << d.size() << "\r\n";
+        countPipeline(*responses);
+        return answered;
+    }
+
+private:
+    static constexpr std::string_view FORM_URLENCODED = "application/x-www-form-urlencoded";
+
+    // only keep-alive requests go through the pool and its per-host limit,
+    // the rest open their own connection and close it afterwards
+    SOCKET connectSocket(bool * reused, const Deadline & connectDeadline) {
+        if (mKeepAlive) {
+            return mPool->acquire(mHost, mPort, reused, connectDeadline);
         }
-        if (!mCookie.empty()) {
-            ss << "Cookie: " << mCookie << "\r\n";
+        *reused = false;
+        op::TCPSocket socket(mHost.c_str(), mPort, (unsigned) connectDeadline.remaining());
+        SOCKET sd = socket.sd();
+        socket.release();
+        if (sd != INVALID_SOCKET) {
+            TCPSocket::set_nodelay(sd, true);
         }
-        if (isKeepAlive() == false) {
-            ss << "Connection: close\r\n";
+        return sd;
+    }
+
+    void releaseSocket(SOCKET sd, bool reusable) {
+        if (mKeepAlive) {
+            mPool->release(mHost, mPort, sd, reusable);
+        } else if (sd != INVALID_SOCKET) {
+            CLOSE_SOCKET(sd);
         }
-        ss << "\r\n";
-        if (postMethod) {
-            ss << d;
+    }
+
+    // NetMetrics of the finished request
+    int counted(int status, NetMetrics::clock::time_point started) const {
+        NetMetrics::time(NetMetrics::HTTP_TIME, started);
+        if (status >= 500) NetMetrics::add(NetMetrics::HTTP_ERRORS);
+        if (mTimedOut) NetMetrics::add(NetMetrics::HTTP_TIMEOUTS);
+        return status;
+    }
+
+    void countPipeline(const std::vector<Response> & responses) const {
+        for (size_t i = 0; i < responses.size(); ++i) {
+            const Response & r = responses[i];
+            if (r.LatencyMs > 0) NetMetrics::time(NetMetrics::HTTP_TIME, (uint64_t) (r.LatencyMs * 1000));
+            if (r.Status >= 500) NetMetrics::add(NetMetrics::HTTP_ERRORS);
+            if (r.Status == TIMED_OUT) NetMetrics::add(NetMetrics::HTTP_TIMEOUTS);
         }
+    }
 
-        {
-        const std::string & h = ss.str();
-        mSocket.write_all(h.c_str(), h.size());
-#if (OPNET_HTTP_LOG_REQ == 1)
-        JUSTLOG("%s", h.c_str());
+    // with setGzip() compressed bodies are inflated before the sink
+    BodySink decoding(BodySink sink) {
+        resetDecoding();
+#if (OPNET_HTTP_ZLIB == 1)
+        if (isGzip()) {
+            return [this, sink](const char * data, size_t size) {
+                if (!mInflater.started()) {
+                    mInflater.begin(mResponse.header("Content-Encoding"));
+                }
+                return mInflater.feed(data, size, sink);
+            };
+        }
+#endif
+        return sink;
+    }
+
+    void resetDecoding() {
+#if (OPNET_HTTP_ZLIB == 1)
+        mInflater.reset();
+#endif
+    }
+
+    // the compressed body, if any, was complete
+    bool decoded() const {
+#if (OPNET_HTTP_ZLIB == 1)
+        return !mInflater.truncated();
+#else
+        return true;
 #endif
+    }
+
+    void writeHead(HTTPHeaderBuilder & head, std::string_view method, std::string_view uri,
+                   std::string_view query, std::string_view body, std::string_view contentType,
+                   bool keepAlive) const {
+        head.requestLine(method, uri, query);
+        head.header("Host", mHost);
+        if (isGzip()) {
+            head.header("Accept-Encoding", "gzip, deflate");
+        }
+        head.header("User-Agent", "opHttp/1.1");
+        if (!body.empty() || method == "POST" || method == "PUT") {
+            if (!contentType.empty()) {
+                head.header("Content-Type", contentType);
+            }
+            head.header("Content-Length", (uint64_t) body.size());
         }
+        if (!mCookie.empty()) {
+            head.header("Cookie", mCookie);
+        }
+        if (keepAlive == false) {
+            head.header("Connection", "close");
+        }
+        head.end();
+    }
 
-        unsigned total = 0;
-//        unsigned tsStart = GetTickCount();
+    // feeds the parser until the response is complete, -1 on i/o errors
+    // and expired deadlines
+    int readResponse(SOCKET sd, bool * reusable, size_t * received, const Deadline & deadline) {
+        *reusable = false;
+        *received = 0;
         for (;;) {
-            if (total + 4096 > mData.size())
-                mData.resize(mData.size() + 4096);
-            int rc = mSocket.read_all(&mData[0]+total, 4096);
+            const Deadline wait = Deadline::earliest(deadline, Deadline(mIOTimeout));
+            if (!wait.infinite()) {
+                int ready = TCPSocket::wait_io(sd, POLLIN, wait);
+                if (ready <= 0) {
+                    mTimedOut = (ready == 0);
+                    WARN("recv() sd=%d timed out", sd);
+                    return -1;
+                }
+            }
+            int rc = ::recv(sd, &mRecvBuffer[0], (int) mRecvBuffer.size(), 0);
+            NetMetrics::io(NetMetrics::BYTES_IN, rc);
+            if (rc < 0) {
+                WARN("recv() sd=%d err='%d'", sd, TCPSocket::get_lasterror());
+                return -1;
+            }
+            if (rc > 0 && *received == 0) {
+                NetMetrics::time(NetMetrics::FIRST_BYTE_TIME, mSentAt);
+            }
             if (rc == 0) {
+                if (!mResponse.finish() || !decoded()) return -1;
                 break;
             }
-            if (rc < 0) {
-                return 500;
+            *received += (size_t) rc;
+            size_t used = mResponse.feed(&mRecvBuffer[0], (size_t) rc);
+            if (mResponse.isFailed()) {
+                return -1;
+            }
+            if (mResponse.isDone()) {
+                if (!decoded()) {
+                    WARN("compressed body is truncated");
+                    return -1;
+                }
+                // bytes past the response mean the stream is out of sync
+                *reusable = mResponse.keepAlive() && used == (size_t) rc;
+                break;
             }
-            total += (unsigned) rc;
-//            if (hasTimeout && (GetTickCount() - tsStart >= mTimeout))
-//                return 500;
-        }
-        if (mData.empty()) {
-            return 500;
         }
-        // разделяем заголовки и тело отклика
-        mData[total] = '\0';
 #if (OPNET_HTTP_LOG_RESP == 1)
-        JUSTLOG("%s", &mData[0]);
+        JUSTLOG("%s", mResponse.head().c_str());
 #endif
-        char * p = strstr(&mData[0], "\r\n\r\n");
-        mBody = p ? p + 4 : NULL;
-
-        // ищем ответ сервера
-        p = strchr(&mData[0], ' ');
-        return p ? atoi(++p) : 500;
+        if (!mData.empty() || mResponse.bodyReceived() == 0) {
+            mData.push_back('\0');
+        }
+        return mResponse.status();
     }
 };
 
@@ -0,0 +1,300 @@
+//
+// Copyright (C) 2026 Oleg Polivets. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 
+// 1. Redistributions of source code must retain the above copyright 
+//    notice, this list of conditions and the following disclaimer.  
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.  
+// 3. Neither the name of the project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission. 
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+// SUCH DAMAGE.
+// 
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <vector>
+#include "pool.hpp"
+
+namespace op {
+
+/*
+ * Параллельные алгоритмы поверх TaskPool. Диапазон режется на куски по
+ * grain элементов (0 - автоматически, около 8 кусков на поток), куски
+ * разбирают потоки пула и сам вызывающий поток, поэтому вызов из задания
+ * пула не блокирует его. Возврат - когда обработаны все куски; первое
+ * исключение из тела пробрасывается вызывающему.
+ */
+
+namespace detail {
+
+// куски [0, Count) раздаются по одному через атомарный счетчик
+struct ChunkState {
+    std::atomic<size_t> Next{0};
+    std::atomic<size_t> Done{0};
+    size_t Count = 0;
+    void (*Run)(void * body, size_t chunk) = 0;
+    void * Body = 0;        // валидно, пока не обработаны все куски
+    std::mutex Mutex;
+    std::condition_variable CV;
+    bool Finished = false;
+    std::exception_ptr Error;
+
+    void work() {
+        for (;;) {
+            const size_t chunk = Next.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= Count) {
+                return;
+            }
+            try {
+                Run(Body, chunk);
+            } catch (...) {
+                std::unique_lock<std::mutex> lock(Mutex);
+                if (!Error) Error = std::current_exception();
+            }
+            if (Done.fetch_add(1, std::memory_order_acq_rel) + 1 == Count) {
+                std::unique_lock<std::mutex> lock(Mutex);
+                Finished = true;
+                CV.notify_all();
+            }
+        }
+    }
+};
+
+// body(chunk) для каждого куска, вызывающий поток участвует сам
+template <typename Body>
+void run_chunks(TaskPool & pool, size_t chunks, Body & body) {
+    if (chunks == 0) {
+        return;
+    }
+    auto state = std::make_shared<ChunkState>();
+    state->Count = chunks;
+    state->Body = &body;
+    state->Run = [](void * b, size_t chunk) { (*static_cast<Body*>(b))(chunk); };
+    const size_t helpers = std::min(chunks - 1, pool.threads());
+    if (helpers > 0) {
+        std::vector<PoolTask> tasks;
+        tasks.reserve(helpers);
+        for (size_t i = 0; i < helpers; ++i) {
+            tasks.emplace_back([state] { state->work(); });
+        }
+        pool.QueueJobs(std::move(tasks));
+    }
+    state->work();
+    std::unique_lock<std::mutex> lock(state->Mutex);
+    state->CV.wait(lock, [&state] { return state->Finished; });
+    if (state->Error) {
+        std::rethrow_exception(state->Error);
+    }
+}
+
+inline size_t auto_grain(TaskPool & pool, size_t n, size_t grain) {
+    if (grain > 0) {
+        return grain;
+    }
+    const size_t chunks = 8 * std::max<size_t>(pool.threads(), 1);
+    return std::max<size_t>((n + chunks - 1) / chunks, 1);
+}
+
+// начало куска в A для диагонали diag слияния A и B (merge path),
+// при равенстве элементы A идут первыми, как в std::merge
+template <typename It1, typename It2, typename Compare>
+size_t merge_split(It1 a, size_t na, It2 b, size_t nb, size_t diag, Compare & comp) {
+    size_t lo = diag > nb ? diag - nb : 0;
+    size_t hi = std::min(diag, na);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (!comp(b[diag - 1 - mid], a[mid])) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// один проход слияния соседних отрезков bounds из src в dst,
+// каждое слияние режется на куски не короче grain
+template <typename Src, typename Dst, typename Compare>
+void merge_round(TaskPool & pool, Src src, Dst dst, const std::vector<size_t> & bounds,
+                 size_t grain, Compare & comp) {
+    struct Piece { size_t Begin, Mid, End, Diag0, Diag1; };
+    const size_t pairs = (bounds.size() - 1) / 2;
+    const size_t target = 4 * std::max<size_t>(pool.threads(), 1);
+    std::vector<Piece> pieces;
+    for (size_t p = 0; p < pairs; ++p) {
+        const size_t begin = bounds[2 * p], mid = bounds[2 * p + 1], end = bounds[2 * p + 2];
+        size_t parts = std::max<size_t>((target + pairs - 1) / pairs, 1);
+        parts = std::max<size_t>(std::min(parts, (end - begin) / grain), 1);
+        for (size_t k = 0; k < parts; ++k) {
+            pieces.push_back(Piece{begin, mid, end, (end - begin) * k / parts,
+                                   (end - begin) * (k + 1) / parts});
+        }
+    }
+    // нечетный последний отрезок переносится как есть
+    const bool odd = (bounds.size() - 1) % 2 == 1;
+    auto body = [&](size_t chunk) {
+        if (chunk == pieces.size()) {
+            std::move(src + bounds[bounds.size() - 2], src + bounds.back(), dst + bounds[bounds.size() - 2]);
+            return;
+        }
+        const Piece & piece = pieces[chunk];
+        const size_t na = piece.Mid - piece.Begin, nb = piece.End - piece.Mid;
+        const size_t i0 = merge_split(src + piece.Begin, na, src + piece.Mid, nb, piece.Diag0, comp);
+        const size_t i1 = merge_split(src + piece.Begin, na, src + piece.Mid, nb, piece.Diag1, comp);
+        std::merge(std::make_move_iterator(src + piece.Begin + i0),
+                   std::make_move_iterator(src + piece.Begin + i1),
+                   std::make_move_iterator(src + piece.Mid + (piece.Diag0 - i0)),
+                   std::make_move_iterator(src + piece.Mid + (piece.Diag1 - i1)),
+                   dst + piece.Begin + piece.Diag0, comp);
+    };
+    run_chunks(pool, pieces.size() + (odd ? 1 : 0), body);
+}
+
+} // namespace detail
+
+// f(i) для каждого i из [first, last)
+template <typename Index, typename F>
+void parallel_for(TaskPool & pool, Index first, Index last, F && f, size_t grain = 0) {
+    if (!(first < last)) {
+        return;
+    }
+    const size_t n = last - first;
+    grain = detail::auto_grain(pool, n, grain);
+    auto body = [&](size_t chunk) {
+        const Index begin = first + chunk * grain;
+        const Index end = first + std::min(n, (chunk + 1) * grain);
+        for (Index i = begin; i != end; ++i) {
+            f(i);
+        }
+    };
+    detail::run_chunks(pool, (n + grain - 1) / grain, body);
+}
+
+// *out++ = op(*first++); возвращает конец выходного диапазона
+template <typename It, typename Out, typename Op>
+Out parallel_transform(TaskPool & pool, It first, It last, Out out, Op op, size_t grain = 0) {
+    const size_t n = last - first;
+    if (n == 0) {
+        return out;
+    }
+    grain = detail::auto_grain(pool, n, grain);
+    auto body = [&](size_t chunk) {
+        const size_t begin = chunk * grain, end = std::min(n, begin + grain);
+        std::transform(first + begin, first + end, out + begin, op);
+    };
+    detail::run_chunks(pool, (n + grain - 1) / grain, body);
+    return out + n;
+}
+
+// init op x0 op x1 ...; op должна быть ассоциативной, порядок
+// аргументов сохраняется, коммутативность не нужна
+template <typename It, typename T, typename Op>
+T parallel_reduce(TaskPool & pool, It first, It last, T init, Op op, size_t grain = 0) {
+    const size_t n = last - first;
+    if (n == 0) {
+        return init;
+    }
+    grain = detail::auto_grain(pool, n, grain);
+    const size_t chunks = (n + grain - 1) / grain;
+    std::vector<std::optional<T> > partial(chunks);
+    auto body = [&](size_t chunk) {
+        It begin = first + chunk * grain, end = first + std::min(n, (chunk + 1) * grain);
+        T acc = *begin;
+        for (++begin; begin != end; ++begin) {
+            acc = op(std::move(acc), *begin);
+        }
+        partial[chunk].emplace(std::move(acc));
+    };
+    detail::run_chunks(pool, chunks, body);
+    for (size_t i = 0; i < chunks; ++i) {
+        init = op(std::move(init), std::move(*partial[i]));
+    }
+    return init;
+}
+
+template <typename It>
+typename std::iterator_traits<It>::value_type
+parallel_reduce(TaskPool & pool, It first, It last) {
+    typedef typename std::iterator_traits<It>::value_type T;
+    return parallel_reduce(pool, first, last, T(), std::plus<T>());
+}
+
+// устойчивая сортировка слиянием: отрезки сортируются std::stable_sort
+// параллельно, затем попарно сливаются, каждое слияние тоже режется
+// на куски (merge path); нужен буфер на n элементов, он заполняется
+// перемещением, конструктор по умолчанию у T не нужен
+template <typename It, typename Compare = std::less<typename std::iterator_traits<It>::value_type> >
+void parallel_sort(TaskPool & pool, It first, It last, Compare comp = Compare(), size_t grain = 0) {
+    typedef typename std::iterator_traits<It>::value_type T;
+    const size_t n = last - first;
+    if (grain == 0) {
+        grain = 4096;
+    }
+    size_t runs = 1;
+    while (runs < pool.threads() && n / (runs * 2) >= grain) {
+        runs *= 2;
+    }
+    if (runs == 1) {
+        std::stable_sort(first, last, comp);
+        return;
+    }
+    std::vector<size_t> bounds(runs + 1);
+    for (size_t i = 0; i <= runs; ++i) {
+        bounds[i] = n * i / runs;
+    }
+    auto sort_run = [&](size_t run) {
+        std::stable_sort(first + bounds[run], first + bounds[run + 1], comp);
+    };
+    detail::run_chunks(pool, runs, sort_run);
+
+    std::vector<T> buffer;
+    buffer.reserve(n);
+    buffer.insert(buffer.end(), std::make_move_iterator(first), std::make_move_iterator(last));
+    bool inBuffer = false;
+    while (bounds.size() > 2) {
+        if (inBuffer) {
+            detail::merge_round(pool, buffer.begin(), first, bounds, grain, comp);
+        } else {
+            detail::merge_round(pool, first, buffer.begin(), bounds, grain, comp);
+        }
+        inBuffer = !inBuffer;
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != n) {
+            merged.push_back(n);
+        }
+        bounds.swap(merged);
+    }
+    if (inBuffer) {
+        auto copy = [&](size_t chunk) {
+            const size_t begin = chunk * grain, end = std::min(n, begin + grain);
+            std::move(buffer.begin() + begin, buffer.begin() + end, first + begin);
+        };
+        detail::run_chunks(pool, (n + grain - 1) / grain, copy);
+    }
+}
+
+} // namespace op
@@ -5,18 +5,268 @@
 #include <condition_variable>
 #include <vector>
 #include <queue>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include <optional>
+#include <exception>
+#include <stdexcept>
+#include <new>
+#include <cstddef>
 
 namespace op {
 
+/*
+ * Дек Chase-Lev: владелец кладет и забирает с одного конца без
+ * блокировок, остальные потоки крадут с другого. Хранит указатели,
+ * массив растет вдвое, старые массивы живут до разрушения дека.
+ */
+
+template <typename P>
+class StealingDeque {
+    struct Array {
+        int64_t Mask;
+        std::unique_ptr<std::atomic<P>[]> Items;
+
+        explicit Array(int64_t size) : Mask(size - 1), Items(new std::atomic<P>[size]) {}
+        P get(int64_t i) const { return Items[i & Mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, P p) { Items[i & Mask].store(p, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> mTop;
+    std::atomic<int64_t> mBottom;
+    std::atomic<Array*> mArray;
+    std::vector<std::unique_ptr<Array> > mArrays;   // текущий и старые
+
+public:
+    explicit StealingDeque(int64_t capacity = 256) : mTop(0), mBottom(0) {
+        int64_t size = 2;
+        while (size < capacity) size <<= 1;
+        mArrays.emplace_back(new Array(size));
+        mArray.store(mArrays.back().get(), std::memory_order_relaxed);
+    }
+
+    // только поток-владелец
+    void push(P p) {
+        const int64_t b = mBottom.load(std::memory_order_relaxed);
+        const int64_t t = mTop.load(std::memory_order_acquire);
+        Array * a = mArray.load(std::memory_order_relaxed);
+        if (b - t > a->Mask) {
+            a = grow(a, t, b);
+        }
+        a->put(b, p);
+        mBottom.store(b + 1, std::memory_order_release);
+    }
+
+    // только поток-владелец, последний положенный или nullptr
+    P pop() {
+        const int64_t b = mBottom.load(std::memory_order_relaxed) - 1;
+        Array * a = mArray.load(std::memory_order_relaxed);
+        mBottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = mTop.load(std::memory_order_relaxed);
+        if (t > b) {
+            mBottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        P p = a->get(b);
+        if (t == b) {
+            // последний элемент, соревнуемся с ворами
+            if (!mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                p = nullptr;
+            }
+            mBottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return p;
+    }
+
+    // любой поток, самый старый элемент; nullptr если пусто или обогнали
+    P steal() {
+        int64_t t = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = mBottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Array * a = mArray.load(std::memory_order_acquire);
+        P p = a->get(t);
+        if (!mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return p;
+    }
+
+    bool empty() const {
+        return mBottom.load(std::memory_order_acquire) <= mTop.load(std::memory_order_acquire);
+    }
+
+private:
+    Array * grow(Array * a, int64_t t, int64_t b) {
+        Array * bigger = new Array((a->Mask + 1) * 2);
+        for (int64_t i = t; i < b; ++i) {
+            bigger->put(i, a->get(i));
+        }
+        mArrays.emplace_back(bigger);
+        mArray.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    StealingDeque(const StealingDeque &);
+    StealingDeque & operator= (const StealingDeque &);
+}; // StealingDeque
+
+/*
+ * Ограниченная MPMC очередь Вьюкова: кольцо ячеек с номером
+ * последовательности, push()/pop() без блокировок, один CAS на
+ * операцию. Емкость округляется до степени двойки.
+ */
+
+template <typename T>
+class BoundedQueue {
+    struct Cell {
+        std::atomic<size_t> Sequence;
+        T Data;
+    };
+
+    const size_t mMask;
+    std::unique_ptr<Cell[]> mCells;
+    alignas(64) std::atomic<size_t> mEnqueuePos;
+    alignas(64) std::atomic<size_t> mDequeuePos;
+
+public:
+    explicit BoundedQueue(size_t capacity)
+        : mMask(RoundUp(capacity) - 1)
+        , mCells(new Cell[mMask + 1])
+        , mEnqueuePos(0)
+        , mDequeuePos(0) {
+        for (size_t i = 0; i <= mMask; ++i) {
+            mCells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // false если очередь полна, data тогда не тронут
+    bool push(T && data) {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Cell * cell;
+        for (;;) {
+            cell = &mCells[pos & mMask];
+            const size_t seq = cell->Sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->Data = std::move(data);
+        cell->Sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // false если очередь пуста
+    bool pop(T & data) {
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Cell * cell;
+        for (;;) {
+            cell = &mCells[pos & mMask];
+            const size_t seq = cell->Sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+            if (diff == 0) {
+                if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = mDequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        data = std::move(cell->Data);
+        cell->Sequence.store(pos + mMask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // приблизительно, если параллельно идут push()/pop()
+    size_t size() const {
+        const size_t head = mDequeuePos.load(std::memory_order_acquire);
+        const size_t tail = mEnqueuePos.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return mMask + 1; }
+
+private:
+    static size_t RoundUp(size_t n) {
+        size_t size = 2;
+        while (size < n) size <<= 1;
+        return size;
+    }
+
+    BoundedQueue(const BoundedQueue &);
+    BoundedQueue & operator= (const BoundedQueue &);
+}; // BoundedQueue
+
 template <typename T>
 class WorkerPool {
-    bool mTerminate = false;          // завершаемся?
+public:
+    enum Scheduling {
+        SHARED_QUEUE,   // одна очередь под мьютексом
+        WORK_STEALING   // у каждого потока свой дек, свободные потоки крадут
+    };
+
+    // что делает QueueJob() с заполненной BoundedQueue
+    enum FullPolicy {
+        BLOCK,          // ждет, пока потоки пула освободят место
+        FAIL,           // возвращает false
+        OVERWRITE       // выбрасывает самое старое задание
+    };
+
+private:
+    struct Worker {
+        WorkerPool * Pool;
+        StealingDeque<T*> Jobs;
+        uint32_t Seed;                // для выбора жертвы
+    };
+
+    std::atomic<bool> mTerminate{false}; // завершаемся?
     std::mutex mQueueMutex;           // мьюткс, защищающий очередь
     std::condition_variable mMutexCV;
     std::vector<std::thread> mThreads;
-    std::queue<T> mJobs;
+    std::queue<T> mJobs;              // задания извне пула
+    Scheduling mScheduling = SHARED_QUEUE;
+    std::vector<std::unique_ptr<Worker> > mWorkers;
+    std::atomic<unsigned> mSleeping{0};   // потоки, ждущие на mMutexCV (меняется под мьютексом)
+    std::unique_ptr<BoundedQueue<T> > mBounded;   // вместо mJobs, если задана
+    FullPolicy mFullPolicy = BLOCK;
+    std::condition_variable mSpaceCV;
+    std::atomic<unsigned> mBlocked{0};    // производители, ждущие на mSpaceCV
+    std::atomic<uint64_t> mDropped{0};
 
     void Loop();
+    void BoundedLoop();
+    bool PushBounded(T && job);
+    void Popped();
+    void StealingLoop(Worker * self);
+    T * Steal(Worker * self);
+    T * TakeQueued(Worker * self);
+    bool HasWork();
+    void Wake(size_t jobs = 1);
+
+    // поток пула, на котором мы выполняемся, или 0
+    static Worker *& Current() {
+        static thread_local Worker * worker = 0;
+        return worker;
+    }
 
 protected:
     virtual void ServeJob(T job) = 0;
@@ -25,48 +275,280 @@ public:
     WorkerPool() {};
     virtual ~WorkerPool() {};
 
-    void Start(unsigned int num_threads);
-    void QueueJob(T job);
+    void Start(unsigned int num_threads, Scheduling scheduling = SHARED_QUEUE);
+    void SetBoundedQueue(size_t capacity, FullPolicy policy = BLOCK);
+    bool QueueJob(T job);
+    template <typename It>
+    size_t QueueJobs(It first, It last);
+
+    // из временного контейнера задания перемещаются, иначе копируются
+    template <typename Range>
+    size_t QueueJobs(Range && jobs) {
+        if constexpr (std::is_lvalue_reference<Range>::value) {
+            return QueueJobs(std::begin(jobs), std::end(jobs));
+        } else {
+            return QueueJobs(std::make_move_iterator(std::begin(jobs)),
+                             std::make_move_iterator(std::end(jobs)));
+        }
+    }
     void Stop();
     bool busy();
+    uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+    size_t threads() const { return mThreads.size(); }
 }; // WorkerPool
 
 template <class T>
-void WorkerPool<T>::Start(unsigned int num_threads) {
+void WorkerPool<T>::Start(unsigned int num_threads, Scheduling scheduling) {
     // Max # of threads the system supports
     if (num_threads == 0) {
         num_threads = std::thread::hardware_concurrency();
     }
+    // после Stop() пул можно запустить снова
+    mTerminate = false;
+    mScheduling = scheduling;
+    if (mScheduling == WORK_STEALING) {
+        for (uint32_t ii = 0; ii < num_threads; ++ii) {
+            mWorkers.emplace_back(new Worker());
+            mWorkers.back()->Pool = this;
+            mWorkers.back()->Seed = 2654435761u * (ii + 1);
+        }
+        for (uint32_t ii = 0; ii < num_threads; ++ii) {
+            mThreads.emplace_back(std::thread(&WorkerPool::StealingLoop, this, mWorkers[ii].get()));
+        }
+        return;
+    }
     for (uint32_t ii = 0; ii < num_threads; ++ii) {
-        mThreads.emplace_back(std::thread(&WorkerPool::Loop, this));
+        mThreads.emplace_back(mBounded ? std::thread(&WorkerPool::BoundedLoop, this)
+                                       : std::thread(&WorkerPool::Loop, this));
     }
 }
 
+// до Start(): задания извне пула идут через BoundedQueue без мьютекса,
+// мьютекс нужен только чтобы заснуть или разбудить
+template <class T>
+void WorkerPool<T>::SetBoundedQueue(size_t capacity, FullPolicy policy) {
+    mBounded.reset(capacity > 0 ? new BoundedQueue<T>(capacity) : 0);
+    mFullPolicy = policy;
+}
+
 template <class T>
 void WorkerPool<T>::Loop() {
     for (;;) {
-        T job; {
-            std::unique_lock<std::mutex> lock(mQueueMutex);
-            mMutexCV.wait(lock, [this] {
-                return !mJobs.empty() || mTerminate;
-            });
-            if (mTerminate) {
-                return;
-            }
-            job = mJobs.front();
-            mJobs.pop();
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        while (mJobs.empty() && !mTerminate) {
+            mSleeping.fetch_add(1, std::memory_order_relaxed);
+            mMutexCV.wait(lock);
+            mSleeping.fetch_sub(1, std::memory_order_relaxed);
         }
+        if (mTerminate) {
+            return;
+        }
+        T job(std::move(mJobs.front()));
+        mJobs.pop();
+        lock.unlock();
         ServeJob(std::move(job));
     }
 }
 
 template <class T>
-void WorkerPool<T>::QueueJob(T sd) {
-    {
+void WorkerPool<T>::BoundedLoop() {
+    T job;
+    while (!mTerminate.load(std::memory_order_acquire)) {
+        if (mBounded->pop(job)) {
+            Popped();
+            ServeJob(std::move(job));
+            continue;
+        }
         std::unique_lock<std::mutex> lock(mQueueMutex);
-        mJobs.push(sd);
+        mSleeping.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!mTerminate && mBounded->empty()) {
+            mMutexCV.wait(lock);
+        }
+        mSleeping.fetch_sub(1, std::memory_order_relaxed);
     }
-    mMutexCV.notify_one();
+}
+
+template <class T>
+void WorkerPool<T>::StealingLoop(Worker * self) {
+    Current() = self;
+    while (!mTerminate.load(std::memory_order_acquire)) {
+        T * job = self->Jobs.pop();
+        if (!job) job = Steal(self);
+        if (!job) job = TakeQueued(self);
+        if (job) {
+            ServeJob(std::move(*job));
+            delete job;
+            continue;
+        }
+        // работы нет: засыпаем, но сначала проверяем еще раз после
+        // mSleeping, QueueJob() проверяет mSleeping после публикации
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        mSleeping.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!mTerminate && !HasWork()) {
+            mMutexCV.wait(lock);
+        }
+        mSleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+    Current() = 0;
+}
+
+// обходит остальные потоки начиная со случайного
+template <class T>
+T * WorkerPool<T>::Steal(Worker * self) {
+    const size_t n = mWorkers.size();
+    if (n < 2) {
+        return 0;
+    }
+    self->Seed ^= self->Seed << 13;
+    self->Seed ^= self->Seed >> 17;
+    self->Seed ^= self->Seed << 5;
+    const size_t start = self->Seed % n;
+    for (size_t i = 0; i < n; ++i) {
+        Worker * victim = mWorkers[(start + i) % n].get();
+        if (victim == self) continue;
+        if (T * job = victim->Jobs.steal()) {
+            return job;
+        }
+    }
+    return 0;
+}
+
+// задания извне пула: одно на выполнение, часть в свой дек, чтобы
+// остальные потоки могли их украсть не трогая мьютекс
+template <class T>
+T * WorkerPool<T>::TakeQueued(Worker * self) {
+    if (mBounded) {
+        T job;
+        if (!mBounded->pop(job)) {
+            return 0;
+        }
+        Popped();
+        return new T(std::move(job));
+    }
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    if (mJobs.empty()) {
+        return 0;
+    }
+    T * job = new T(std::move(mJobs.front()));
+    mJobs.pop();
+    const size_t share = std::min<size_t>(mJobs.size() / mWorkers.size(), 32);
+    for (size_t i = 0; i < share; ++i) {
+        self->Jobs.push(new T(std::move(mJobs.front())));
+        mJobs.pop();
+    }
+    lock.unlock();
+    Wake(share);
+    return job;
+}
+
+// под mQueueMutex
+template <class T>
+bool WorkerPool<T>::HasWork() {
+    if (!mJobs.empty() || (mBounded && !mBounded->empty())) {
+        return true;
+    }
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        if (!mWorkers[i]->Jobs.empty()) return true;
+    }
+    return false;
+}
+
+// будит не больше спящих потоков, чем появилось заданий
+template <class T>
+void WorkerPool<T>::Wake(size_t jobs) {
+    if (jobs == 0) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const unsigned sleeping = mSleeping.load(std::memory_order_relaxed);
+    if (sleeping == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    if (jobs >= sleeping) {
+        mMutexCV.notify_all();
+        return;
+    }
+    for (size_t i = 0; i < jobs; ++i) {
+        mMutexCV.notify_one();
+    }
+}
+
+// место в BoundedQueue освободилось; ждущих производителей будим, когда
+// очередь опустела наполовину, а не на каждое задание
+template <class T>
+void WorkerPool<T>::Popped() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mBlocked.load(std::memory_order_relaxed) > 0
+            && mBounded->size() <= mBounded->capacity() / 2) {
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        mSpaceCV.notify_all();
+    }
+}
+
+template <class T>
+bool WorkerPool<T>::PushBounded(T && job) {
+    while (!mBounded->push(std::move(job))) {
+        if (mFullPolicy == FAIL) {
+            return false;
+        }
+        if (mFullPolicy == OVERWRITE) {
+            T oldest;
+            if (mBounded->pop(oldest)) {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        // пачка может заполнить очередь раньше, чем кого-то разбудила
+        if (mSleeping.load(std::memory_order_relaxed) > 0) {
+            mMutexCV.notify_all();
+        }
+        mBlocked.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!mTerminate && mBounded->size() >= mBounded->capacity()) {
+            mSpaceCV.wait(lock);
+        }
+        mBlocked.fetch_sub(1, std::memory_order_relaxed);
+        if (mTerminate) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class T>
+bool WorkerPool<T>::QueueJob(T sd) {
+    return QueueJobs(std::make_move_iterator(&sd), std::make_move_iterator(&sd + 1)) == 1;
+}
+
+// пачка заданий ставится под одной блокировкой (или без нее), потом
+// будится столько потоков, сколько нужно; возвращает число поставленных,
+// меньше при FullPolicy FAIL или остановке пула
+template <class T>
+template <typename It>
+size_t WorkerPool<T>::QueueJobs(It first, It last) {
+    size_t n = 0;
+    Worker * self = Current();
+    if (mScheduling == WORK_STEALING && self && self->Pool == this) {
+        // из задания пула: в свой дек, без блокировок
+        for (; first != last; ++first, ++n) {
+            self->Jobs.push(new T(*first));
+        }
+    } else if (mBounded) {
+        for (; first != last; ++first, ++n) {
+            if (!PushBounded(T(*first))) break;
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        for (; first != last; ++first, ++n) {
+            mJobs.emplace(*first);
+        }
+    }
+    Wake(n);
+    return n;
 }
 
 template <class T>
@@ -74,7 +556,10 @@ bool WorkerPool<T>::busy() {
     bool poolbusy;
     {
         std::unique_lock<std::mutex> lock(mQueueMutex);
-        poolbusy = !mJobs.empty();
+        poolbusy = !mJobs.empty() || (mBounded && !mBounded->empty());
+        for (size_t i = 0; i < mWorkers.size() && !poolbusy; ++i) {
+            poolbusy = !mWorkers[i]->Jobs.empty();
+        }
     }
     return poolbusy;
 }
@@ -86,10 +571,391 @@ void WorkerPool<T>::Stop() {
         mTerminate = true;
     }
     mMutexCV.notify_all();
+    mSpaceCV.notify_all();
     for (std::thread& active_thread : mThreads) {
         active_thread.join();
     }
     mThreads.clear();
+    // невыполненные задания деков
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        while (T * job = mWorkers[i]->Jobs.pop()) delete job;
+    }
+    mWorkers.clear();
+    // и очередей; уничтожаются вне мьютекса - деструктор задания может
+    // поставить новое
+    std::queue<T> jobs;
+    {
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        jobs.swap(mJobs);
+    }
+    while (!jobs.empty()) jobs.pop();
+    if (mBounded) {
+        T job;
+        while (mBounded->pop(job)) job = T();
+    }
+}
+
+/*
+ * Задание без аргументов и результата, стираемого типа, только перемещаемое.
+ * Функторы до INLINE_SIZE байт (лямбды с парой указателей в захвате) лежат
+ * внутри объекта, без обращений к куче, большие - в куче.
+ */
+
+class PoolTask {
+public:
+    enum { INLINE_SIZE = 48 };
+
+    PoolTask() {}
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, PoolTask>::value>::type>
+    PoolTask(F && f) {
+        typedef typename std::decay<F>::type Fn;
+        if constexpr (sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t)
+                      && std::is_nothrow_move_constructible<Fn>::value) {
+            new (mStorage) Fn(std::forward<F>(f));
+            mTable = &Inline<Fn>::Table;
+        } else {
+            *reinterpret_cast<Fn**>(mStorage) = new Fn(std::forward<F>(f));
+            mTable = &Heap<Fn>::Table;
+        }
+    }
+
+    PoolTask(PoolTask && other) noexcept { take(other); }
+    PoolTask & operator= (PoolTask && other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+    ~PoolTask() { reset(); }
+
+    void operator()() { mTable->Invoke(mStorage); }
+    explicit operator bool() const { return mTable != 0; }
+    bool inlined() const { return mTable && mTable->Inlined; }
+
+    void reset() {
+        if (mTable) {
+            mTable->Destroy(mStorage);
+            mTable = 0;
+        }
+    }
+
+private:
+    struct Table {
+        void (*Invoke)(void *);
+        void (*Move)(void * from, void * to);
+        void (*Destroy)(void *);
+        bool Inlined;
+    };
+
+    template <typename Fn>
+    struct Inline {
+        static void Invoke(void * p) { (*static_cast<Fn*>(p))(); }
+        static void Move(void * from, void * to) {
+            new (to) Fn(std::move(*static_cast<Fn*>(from)));
+            static_cast<Fn*>(from)->~Fn();
+        }
+        static void Destroy(void * p) { static_cast<Fn*>(p)->~Fn(); }
+        static constexpr PoolTask::Table Table = { Invoke, Move, Destroy, true };
+    };
+
+    template <typename Fn>
+    struct Heap {
+        static void Invoke(void * p) { (**static_cast<Fn**>(p))(); }
+        static void Move(void * from, void * to) { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); }
+        static void Destroy(void * p) { delete *static_cast<Fn**>(p); }
+        static constexpr PoolTask::Table Table = { Invoke, Move, Destroy, false };
+    };
+
+    void take(PoolTask & other) {
+        mTable = other.mTable;
+        if (mTable) {
+            mTable->Move(other.mStorage, mStorage);
+            other.mTable = 0;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char mStorage[INLINE_SIZE];
+    const Table * mTable = 0;
+
+    PoolTask(const PoolTask &);
+    PoolTask & operator= (const PoolTask &);
+}; // PoolTask
+
+class TaskPool;
+
+template <typename R>
+class Future;
+
+namespace detail {
+
+// общее состояние Future: результат или исключение и продолжения,
+// которые запускаются потоком, завершившим задание
+template <typename R>
+struct FutureState {
+    typedef typename std::conditional<std::is_void<R>::value, char, R>::type Value_t;
+
+    std::mutex Mutex;
+    std::condition_variable CV;
+    bool Ready = false;
+    std::optional<Value_t> Value;
+    std::exception_ptr Error;
+    std::vector<PoolTask> Continuations;
+
+    void finish() {
+        std::vector<PoolTask> continuations;
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            Ready = true;
+            continuations.swap(Continuations);
+        }
+        CV.notify_all();
+        for (size_t i = 0; i < continuations.size(); ++i) {
+            continuations[i]();
+        }
+    }
+
+    void fail(std::exception_ptr error) {
+        Error = error;
+        finish();
+    }
+
+    // f сразу, если результат уже есть, иначе по готовности
+    void subscribe(PoolTask f) {
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            if (!Ready) {
+                Continuations.push_back(std::move(f));
+                return;
+            }
+        }
+        f();
+    }
+
+    // выполняет f и сохраняет ее результат или исключение
+    template <typename F>
+    void run(F && f) {
+        try {
+            if constexpr (std::is_void<R>::value) {
+                f();
+                Value.emplace();
+            } else {
+                Value.emplace(f());
+            }
+        } catch (...) {
+            Error = std::current_exception();
+        }
+        finish();
+    }
+};
+
+// задание с Future: уничтоженное невыполненным (Stop(), вытеснение из
+// BoundedQueue, отказ QueueJob) завершает Future ошибкой, а не оставляет
+// его вечно неготовым
+template <typename R, typename F>
+class FutureTask {
+public:
+    FutureTask(std::shared_ptr<FutureState<R> > state, F f)
+        : mState(std::move(state)), mFn(std::move(f)) {}
+    FutureTask(FutureTask &&) = default;
+    ~FutureTask() {
+        if (mState) {
+            mState->fail(std::make_exception_ptr(std::runtime_error("TaskPool: task was not run")));
+        }
+    }
+
+    void operator()() {
+        std::shared_ptr<FutureState<R> > state = std::move(mState);
+        state->run(mFn);
+    }
+
+private:
+    std::shared_ptr<FutureState<R> > mState;
+    F mFn;
+};
+
+// тип результата f(R&) или f() для R = void
+template <typename R, typename F>
+struct ThenResult {
+    typedef typename std::invoke_result<F, R &>::type type;
+};
+
+template <typename F>
+struct ThenResult<void, F> {
+    typedef typename std::invoke_result<F>::type type;
+};
+
+} // namespace detail
+
+/*
+ * Результат задания TaskPool. then() ставит продолжение в пул по готовности
+ * результата, не занимая поток ожиданием; get()/wait() блокируют и
+ * предназначены для потоков вне пула. Исключение задания передается в get()
+ * и по цепочке then(), продолжения после ошибки не вызываются. У Future
+ * без пула (when_all от пустого списка) продолжение выполняется в потоке,
+ * вызвавшем then().
+ */
+
+template <typename R>
+class Future {
+    template <typename> friend class Future;
+    friend class TaskPool;
+    template <typename U>
+    friend Future<typename std::conditional<std::is_void<U>::value, void, std::vector<U> >::type>
+    when_all(std::vector<Future<U> > futures);
+
+    std::shared_ptr<detail::FutureState<R> > mState;
+    TaskPool * mPool = 0;
+
+    Future(std::shared_ptr<detail::FutureState<R> > state, TaskPool * pool)
+        : mState(std::move(state)), mPool(pool) {}
+
+public:
+    Future() {}
+
+    bool valid() const { return mState != 0; }
+
+    bool ready() const {
+        std::unique_lock<std::mutex> lock(mState->Mutex);
+        return mState->Ready;
+    }
+
+    void wait() const {
+        std::unique_lock<std::mutex> lock(mState->Mutex);
+        mState->CV.wait(lock, [this] { return mState->Ready; });
+    }
+
+    // значение остается в общем состоянии, его можно забрать через std::move
+    typename std::add_lvalue_reference<R>::type get() const {
+        wait();
+        if (mState->Error) {
+            std::rethrow_exception(mState->Error);
+        }
+        if constexpr (!std::is_void<R>::value) {
+            return *mState->Value;
+        }
+    }
+
+    // f(R &) или f() для Future<void>
+    template <typename F>
+    Future<typename detail::ThenResult<R, typename std::decay<F>::type>::type> then(F && f);
+}; // Future
+
+class TaskPool : public WorkerPool<PoolTask> {
+public:
+    explicit TaskPool(unsigned int num_threads = 0, Scheduling scheduling = WORK_STEALING) {
+        Start(num_threads, scheduling);
+    }
+    // оставшиеся в очереди задания завершают свои Future ошибкой
+    ~TaskPool() {
+        mStopping = true;
+        Stop();
+    }
+
+    template <typename F>
+    Future<typename std::invoke_result<typename std::decay<F>::type &>::type> submit(F && f) {
+        typedef typename std::decay<F>::type Fn;
+        typedef typename std::invoke_result<Fn &>::type R;
+        auto state = std::make_shared<detail::FutureState<R> >();
+        // не поставленное задание завершит state ошибкой само
+        post(detail::FutureTask<R, Fn>(state, Fn(std::forward<F>(f))));
+        return Future<R>(state, this);
+    }
+
+    // без Future; false, если очередь полна или пул останавливается
+    template <typename F>
+    bool post(F && f) {
+        PoolTask task(std::forward<F>(f));
+        return !mStopping && QueueJob(std::move(task));
+    }
+
+protected:
+    // при остановке продолжения уже не ставятся в очередь
+    std::atomic<bool> mStopping{false};
+
+    void ServeJob(PoolTask task) override {
+        task();
+    }
+}; // TaskPool
+
+template <typename R>
+template <typename F>
+Future<typename detail::ThenResult<R, typename std::decay<F>::type>::type> Future<R>::then(F && f) {
+    typedef typename std::decay<F>::type Fn;
+    typedef typename detail::ThenResult<R, Fn>::type U;
+    auto next = std::make_shared<detail::FutureState<U> >();
+    std::shared_ptr<detail::FutureState<R> > state = mState;
+    TaskPool * pool = mPool;
+    mState->subscribe(PoolTask([state, next, pool, fn = Fn(std::forward<F>(f))]() mutable {
+        if (state->Error) {
+            next->fail(state->Error);
+            return;
+        }
+        auto call = [state, fn = std::move(fn)]() mutable {
+            if constexpr (std::is_void<R>::value) {
+                return fn();
+            } else {
+                return fn(*state->Value);
+            }
+        };
+        detail::FutureTask<U, decltype(call)> job(next, std::move(call));
+        if (!pool) {
+            // без пула (when_all от пустого списка) - сразу в этом потоке
+            job();
+            return;
+        }
+        // не поставленное задание завершит next ошибкой само
+        pool->post(std::move(job));
+    }));
+    return Future<U>(next, mPool);
+}
+
+// готов, когда готовы все; значения в порядке futures, при ошибке -
+// первое исключение по порядку
+template <typename R>
+Future<typename std::conditional<std::is_void<R>::value, void, std::vector<R> >::type>
+when_all(std::vector<Future<R> > futures) {
+    typedef typename std::conditional<std::is_void<R>::value, void, std::vector<R> >::type Out;
+    struct Join {
+        std::atomic<size_t> Left;
+        std::vector<Future<R> > Inputs;
+    };
+    auto all = std::make_shared<detail::FutureState<Out> >();
+    TaskPool * pool = futures.empty() ? 0 : futures[0].mPool;
+    if (futures.empty()) {
+        all->run([] { return Out(); });
+        return Future<Out>(all, pool);
+    }
+    auto join = std::make_shared<Join>();
+    join->Left = futures.size();
+    join->Inputs = futures;
+    for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].mState->subscribe(PoolTask([join, all] {
+            if (join->Left.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            // последний: собираем без пула, здесь только копирование значений
+            for (size_t k = 0; k < join->Inputs.size(); ++k) {
+                if (join->Inputs[k].mState->Error) {
+                    all->fail(join->Inputs[k].mState->Error);
+                    return;
+                }
+            }
+            all->run([&join] {
+                if constexpr (!std::is_void<R>::value) {
+                    Out values;
+                    values.reserve(join->Inputs.size());
+                    for (size_t k = 0; k < join->Inputs.size(); ++k) {
+                        values.push_back(*join->Inputs[k].mState->Value);
+                    }
+                    return values;
+                }
+            });
+        }));
+    }
+    return Future<Out>(all, pool);
 }
 
 } // namespace op
@@ -8,6 +8,16 @@
 #include "debug.hpp"
 #include "url.hpp"
 #include "eval.hpp"
+#include "logscan.hpp"
+#include "pool.hpp"
+#include "parallel.hpp"
+#include "net.hpp"
+#include "httpserver.hpp"
+#include "uring.hpp"
+#include "coro.hpp"
+#include <thread>
+#include <map>
+#include <set>
 
 // Eval //////////////////////////////////////////////////////// //
 
@@ -85,6 +95,1557 @@ TEST(URL, Decode) {
     }
 }
 
+TEST(URL, QueryParams) {
+    op::URL url = op::URL::Parse("http://host/path?utm=a%20b&id=1&&tag=x&flag&tag=y+z#frag");
+    op::QueryParams q = url.Params();
+    ASSERT_EQ(q.size(), 5u);
+    ASSERT_EQ(q.raw("utm"), "a%20b");
+    ASSERT_EQ(q.value("utm"), "a b");
+    ASSERT_EQ(q.value("id"), "1");
+    ASSERT_TRUE(q.has("flag"));
+    ASSERT_EQ(q.raw("flag"), "");
+    ASSERT_FALSE(q.has("missing"));
+    ASSERT_EQ(q.value("missing", "def"), "def");
+    ASSERT_EQ(q.count("tag"), 2u);
+    std::vector<std::string> tags = q.values("tag");
+    ASSERT_EQ(tags.size(), 2u);
+    ASSERT_EQ(tags[0], "x");
+    ASSERT_EQ(tags[1], "y z");
+    ASSERT_EQ(q.at(4).Value, "y+z");
+}
+
+TEST(URL, ParseView) {
+    op::URLView url = op::URLView::Parse("protocol://host:port/path/on/server?query");
+    ASSERT_EQ(url.Protocol, "protocol");
+    ASSERT_EQ(url.Host, "host");
+    ASSERT_EQ(url.Port, "port");
+    ASSERT_EQ(url.Path, "path/on/server");
+    ASSERT_EQ(url.QueryString, "query");
+
+    url = op::URLView::Parse("/relative/path?redirect=http://other/x");
+    ASSERT_EQ(url.Protocol, "");
+    ASSERT_EQ(url.Host, "");
+    ASSERT_EQ(url.Path, "relative/path");
+    ASSERT_EQ(url.QueryString, "redirect=http://other/x");
+}
+
+TEST(URL, Canonical) {
+    std::string canonical;
+    uint64_t h1 = op::URLCanonical::Hash(
+        "HTTP://Example.COM:80/a/./b/../c/%7euser/%3f?b=2&a=%41#frag", &canonical);
+    ASSERT_EQ(canonical, "http://example.com/a/c/~user/%3F?a=A&b=2");
+    uint64_t h2 = op::URLCanonical::Hash("http://example.com/a/c/~user/%3F?a=A&b=2");
+    ASSERT_EQ(h1, h2);
+    ASSERT_NE(h1, op::URLCanonical::Hash("http://example.com/a/c/~user/%3F?a=A&b=3"));
+
+    ASSERT_EQ(op::URLCanonical::String("https://host:8443"), "https://host:8443/");
+    ASSERT_EQ(op::URLCanonical::String("https://host:443/x/y/.."), "https://host/x/");
+    ASSERT_EQ(op::URLCanonical::String("http://host/../a b/%2e%2E/c"), "http://host/c");
+    ASSERT_EQ(op::URLCanonical::String("http://host/p?b&a=1&&ab=0"), "http://host/p?a=1&ab=0&b");
+}
+
+// URLScanner ////////////////////////////////////////////////// //
+
+TEST(URLScanner, scan) {
+    std::string log;
+    for (int i = 0; i < 20000; ++i) {
+        if (i % 2) {
+            log += "10.0.0.1 - - [10/Oct/2000:13:55:36] \"GET /api/v1?id=";
+            log += std::to_string(i);
+            log += "&utm=x HTTP/1.1\" 200 2326\r\n";
+        } else {
+            log += "http://example.com/index.html?id=1&ref=a\n";
+        }
+    }
+    log += "\n";
+    op::URLStats stats;
+    op::URLScanner scanner;
+    scanner.scan(log.data(), log.data() + log.size(), &stats, 3);
+    ASSERT_EQ(stats.Lines, 20000u);
+    ASSERT_EQ(stats.Urls, 20000u);
+    ASSERT_EQ(stats.Hosts["example.com"], 10000u);
+    ASSERT_EQ(stats.Hosts[""], 10000u);
+    ASSERT_EQ(stats.Paths["api/v1"], 10000u);
+    ASSERT_EQ(stats.QueryKeys["id"], 20000u);
+    auto top = op::URLStats::top(stats.QueryKeys, 2);
+    ASSERT_EQ(top.size(), 2u);
+    ASSERT_EQ(top[0].first, "id");
+    ASSERT_EQ(top[1].first, "ref");
+}
+
+TEST(URLScanner, reuse) {
+    std::string log = "http://a.com/x?k=1\nhttp://b.com/y\n";
+    op::URLScanner scanner;
+    for (int round = 1; round <= 2; ++round) {
+        op::URLStats stats;
+        scanner.scan(log.data(), log.data() + log.size(), &stats, 2);
+        ASSERT_EQ(stats.Lines, 2u) << round;
+        ASSERT_EQ(stats.Hosts["a.com"], 1u) << round;
+    }
+    op::URLStats empty;
+    scanner.scan(log.data(), log.data(), &empty, 2);
+    ASSERT_EQ(empty.Lines, 0u);
+}
+
+// WorkerPool ////////////////////////////////////////////////// //
+
+TEST(StealingDeque, ownerAndThieves) {
+    const int N = 100000;
+    std::vector<int> items(N);
+    std::vector<std::atomic<int> > seen(N);
+    op::StealingDeque<int*> deque(4);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; ++t) {
+        thieves.emplace_back([&] {
+            while (!done || !deque.empty()) {
+                if (int * p = deque.steal()) ++seen[p - &items[0]];
+            }
+        });
+    }
+    for (int i = 0; i < N; ++i) {
+        deque.push(&items[i]);
+        if (i % 3 == 0) {
+            if (int * p = deque.pop()) ++seen[p - &items[0]];
+        }
+    }
+    while (int * p = deque.pop()) ++seen[p - &items[0]];
+    done = true;
+    for (auto & th : thieves) th.join();
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(seen[i], 1) << i;
+    }
+}
+
+// каждое задание глубины d порождает два задания глубины d-1
+class TreePool : public op::WorkerPool<int> {
+public:
+    std::atomic<int> leaves{0};
+
+protected:
+    void ServeJob(int depth) override {
+        if (depth == 0) {
+            ++leaves;
+            return;
+        }
+        QueueJob(depth - 1);
+        QueueJob(depth - 1);
+    }
+};
+
+TEST(WorkerPool, workStealing) {
+    for (int mode = 0; mode < 2; ++mode) {
+        TreePool pool;
+        pool.Start(4, mode ? TreePool::WORK_STEALING : TreePool::SHARED_QUEUE);
+        pool.QueueJob(12);
+        for (int i = 0; i < 100; ++i) pool.QueueJob(0);
+        for (int i = 0; i < 5000 && pool.leaves < 4096 + 100; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(pool.leaves, 4096 + 100) << mode;
+        ASSERT_FALSE(pool.busy());
+        pool.Stop();
+    }
+}
+
+// запоминает номера выполненных заданий
+class SumPool : public op::WorkerPool<int> {
+public:
+    std::atomic<int> served{0};
+    std::atomic<long> sum{0};
+
+protected:
+    void ServeJob(int job) override {
+        sum += job;
+        ++served;
+    }
+};
+
+TEST(WorkerPool, boundedQueue) {
+    {
+        SumPool pool;
+        pool.SetBoundedQueue(4, SumPool::FAIL);
+        for (int i = 0; i < 4; ++i) ASSERT_TRUE(pool.QueueJob(i));
+        ASSERT_FALSE(pool.QueueJob(4));
+        ASSERT_TRUE(pool.busy());
+        pool.Start(1);
+        while (pool.served < 4) std::this_thread::yield();
+        pool.Stop();
+        ASSERT_EQ(pool.sum, 0 + 1 + 2 + 3);
+    }
+    {
+        SumPool pool;
+        pool.SetBoundedQueue(4, SumPool::OVERWRITE);
+        for (int i = 0; i < 10; ++i) ASSERT_TRUE(pool.QueueJob(i));
+        ASSERT_EQ(pool.dropped(), 6u);
+        pool.Start(1);
+        while (pool.served < 4) std::this_thread::yield();
+        pool.Stop();
+        ASSERT_EQ(pool.sum, 6 + 7 + 8 + 9);
+    }
+    for (int mode = 0; mode < 2; ++mode) {
+        SumPool pool;
+        pool.SetBoundedQueue(16, SumPool::BLOCK);
+        pool.Start(2, mode ? SumPool::WORK_STEALING : SumPool::SHARED_QUEUE);
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 4; ++t) {
+            producers.emplace_back([&pool] {
+                for (int i = 1; i <= 5000; ++i) pool.QueueJob(i);
+            });
+        }
+        for (auto & th : producers) th.join();
+        while (pool.served < 4 * 5000) std::this_thread::yield();
+        pool.Stop();
+        ASSERT_EQ(pool.sum, 4L * 5000 * 5001 / 2) << mode;
+    }
+}
+
+// задания, которые нельзя копировать
+class MovePool : public op::WorkerPool<std::unique_ptr<int> > {
+public:
+    std::atomic<int> served{0};
+    std::atomic<long> sum{0};
+
+protected:
+    void ServeJob(std::unique_ptr<int> job) override {
+        sum += *job;
+        ++served;
+    }
+};
+
+TEST(WorkerPool, moveOnlyBatches) {
+    for (int mode = 0; mode < 3; ++mode) {
+        MovePool pool;
+        if (mode == 2) pool.SetBoundedQueue(64);
+        pool.Start(3, mode == 1 ? MovePool::WORK_STEALING : MovePool::SHARED_QUEUE);
+        std::vector<std::unique_ptr<int> > batch;
+        for (int i = 1; i <= 1000; ++i) batch.emplace_back(new int(i));
+        ASSERT_EQ(pool.QueueJobs(std::move(batch)), 1000u);
+        ASSERT_TRUE(pool.QueueJob(std::unique_ptr<int>(new int(1000))));
+        while (pool.served < 1001) std::this_thread::yield();
+        pool.Stop();
+        ASSERT_EQ(pool.sum, 1000L * 1001 / 2 + 1000) << mode;
+    }
+    // из lvalue контейнера задания копируются
+    SumPool pool;
+    std::vector<int> jobs(100, 2);
+    pool.Start(2);
+    ASSERT_EQ(pool.QueueJobs(jobs), 100u);
+    while (pool.served < 100) std::this_thread::yield();
+    pool.Stop();
+    ASSERT_EQ(pool.sum, 200);
+    ASSERT_EQ(jobs.size(), 100u);
+}
+
+TEST(PoolTask, smallBuffer) {
+    int calls = 0;
+    op::PoolTask small([&calls] { ++calls; });
+    ASSERT_TRUE(small.inlined());
+    char big[128] = {1};
+    op::PoolTask large([&calls, big] { calls += big[0]; });
+    ASSERT_FALSE(large.inlined());
+    std::unique_ptr<int> owned(new int(10));
+    op::PoolTask moveOnly([&calls, p = std::move(owned)] { calls += *p; });
+    op::PoolTask moved(std::move(moveOnly));
+    ASSERT_FALSE(moveOnly);
+    small();
+    large();
+    moved();
+    ASSERT_EQ(calls, 12);
+}
+
+TEST(TaskPool, futures) {
+    op::TaskPool pool(2);
+    auto text = pool.submit([] { return 21; })
+        .then([](int x) { return x * 2; })
+        .then([](int x) { return std::to_string(x); });
+    ASSERT_EQ(text.get(), "42");
+
+    auto failed = pool.submit([]() -> int { throw std::runtime_error("boom"); })
+        .then([](int x) { return x + 1; });
+    ASSERT_THROW(failed.get(), std::runtime_error);
+
+    std::vector<op::Future<int> > parts;
+    for (int i = 0; i < 100; ++i) {
+        parts.push_back(pool.submit([i] { return i; }));
+    }
+    auto total = op::when_all(parts).then([](std::vector<int> & values) {
+        long sum = 0;
+        for (size_t i = 0; i < values.size(); ++i) sum += values[i];
+        return sum;
+    });
+    ASSERT_EQ(total.get(), 99L * 100 / 2);
+    ASSERT_EQ(op::when_all(parts).get()[7], 7);
+
+    std::atomic<int> done{0};
+    std::vector<op::Future<void> > steps;
+    for (int i = 0; i < 10; ++i) {
+        steps.push_back(pool.submit([&done] { ++done; }));
+    }
+    op::when_all(steps).get();
+    ASSERT_EQ(done, 10);
+    ASSERT_TRUE(op::when_all(std::vector<op::Future<int> >()).get().empty());
+    auto none = op::when_all(std::vector<op::Future<int> >()).then([](std::vector<int> & values) {
+        return (int) values.size() + 1;
+    });
+    ASSERT_EQ(none.then([](int & n) { return n * 2; }).get(), 2);
+}
+
+TEST(TaskPool, stopWithQueued) {
+    for (int mode = 0; mode < 2; ++mode) {
+        op::Future<int> slow, slowNext, queued, queuedNext;
+        {
+            op::TaskPool pool(1, mode ? op::TaskPool::WORK_STEALING : op::TaskPool::SHARED_QUEUE);
+            slow = pool.submit([] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                return 0;
+            });
+            slowNext = slow.then([](int & v) { return v + 1; });
+            queued = pool.submit([] { return 1; });
+            queuedNext = queued.then([](int & v) { return v + 1; });
+        }
+        // не выполненные при остановке пула Future готовы, с ошибкой
+        ASSERT_TRUE(queued.ready());
+        ASSERT_THROW(queued.get(), std::runtime_error);
+        ASSERT_THROW(queuedNext.get(), std::runtime_error);
+        ASSERT_TRUE(slow.ready());
+        ASSERT_THROW(slowNext.get(), std::runtime_error);
+    }
+}
+
+TEST(Parallel, algorithms) {
+    op::TaskPool pool(3);
+    for (size_t n : {0, 1, 1000, 100001}) {
+        std::vector<int> v(n);
+        for (size_t i = 0; i < n; ++i) v[i] = (int) ((i * 7919) % 1000);
+
+        std::vector<int> seen(n, 0);
+        op::parallel_for(pool, (size_t) 0, n, [&seen](size_t i) { ++seen[i]; });
+        ASSERT_EQ(std::count(seen.begin(), seen.end(), 1), (long) n);
+
+        std::vector<int> twice(n);
+        op::parallel_transform(pool, v.begin(), v.end(), twice.begin(), [](int x) { return 2 * x; });
+        long sum = op::parallel_reduce(pool, v.begin(), v.end(), 0L, [](long a, long b) { return a + b; });
+        ASSERT_EQ(op::parallel_reduce(pool, twice.begin(), twice.end(), 0L,
+                                      [](long a, long b) { return a + b; }), 2 * sum);
+
+        // устойчивость: при равных ключах сохраняется исходный порядок
+        std::vector<std::pair<int, size_t> > keyed(n), expected;
+        for (size_t i = 0; i < n; ++i) keyed[i] = std::make_pair(v[i] % 10, i);
+        expected = keyed;
+        auto byKey = [](const std::pair<int, size_t> & a, const std::pair<int, size_t> & b) {
+            return a.first < b.first;
+        };
+        std::stable_sort(expected.begin(), expected.end(), byKey);
+        op::parallel_sort(pool, keyed.begin(), keyed.end(), byKey, 1000);
+        ASSERT_TRUE(keyed == expected) << n;
+
+        // без конструктора по умолчанию
+        struct Item {
+            explicit Item(int key) : Key(key) {}
+            int Key;
+        };
+        std::vector<Item> items;
+        for (size_t i = 0; i < n; ++i) items.emplace_back(v[i]);
+        op::parallel_sort(pool, items.begin(), items.end(),
+                          [](const Item & a, const Item & b) { return a.Key < b.Key; }, 1000);
+        std::sort(v.begin(), v.end());
+        for (size_t i = 0; i < n; ++i) ASSERT_EQ(items[i].Key, v[i]);
+    }
+    // вложенный вызов из задания пула выполняется, а не блокирует поток
+    std::atomic<int> inner{0};
+    op::parallel_for(pool, 0, 8, [&](int) {
+        op::parallel_for(pool, 0, 100, [&inner](int) { ++inner; });
+    });
+    ASSERT_EQ(inner, 800);
+}
+
+// Net ///////////////////////////////////////////////////////// //
+
+class EchoServer : public op::TCPServer {
+public:
+    explicit EchoServer(bool reuseport = false) : op::TCPServer(0, reuseport) {}
+    std::atomic<int> accepted{0};
+    std::atomic<int> closed{0};
+
+    void onAccept(SOCKET, sockaddr *, socklen_t) override { ++accepted; }
+    void onClose(SOCKET) override { ++closed; }
+    void onReadable(SOCKET sd) override {
+        char buff[4096];
+        for (;;) {
+            int rc = ::recv(sd, buff, sizeof(buff), 0);
+            if (rc > 0) {
+                op::TCPSocket::write_all(sd, buff, rc);
+            } else {
+                if (rc == 0 || errno != EAGAIN) closeConnection(sd);
+                break;
+            }
+        }
+    }
+};
+
+TEST(DNSCache, hostsFile) {
+    char path[] = "/tmp/ophostsXXXXXX";
+    int fd = ::mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    std::ofstream(path) << "# test hosts\n10.0.0.1 alpha alpha.local\n10.0.0.2\tbeta # comment\n";
+
+    std::atomic<int> calls(0);
+    op::DNSCache::Resolver hosts = op::DNSCache::hostsFile(path);
+    op::DNSCache cache(60000, 60000);
+    cache.setResolver([&calls, hosts](const std::string & host, in_addr * addr) {
+        ++calls;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return hosts(host, addr);
+    });
+
+    in_addr addr;
+    ASSERT_TRUE(cache.lookup("alpha.local", &addr));
+    ASSERT_EQ(std::string(inet_ntoa(addr)), "10.0.0.1");
+    ASSERT_TRUE(cache.lookup("alpha.local", &addr));
+    ASSERT_TRUE(cache.lookup("beta", &addr));
+    ASSERT_EQ(std::string(inet_ntoa(addr)), "10.0.0.2");
+    ASSERT_EQ(calls, 2);
+
+    // negative answers are cached too
+    ASSERT_FALSE(cache.lookup("gamma", &addr));
+    ASSERT_FALSE(cache.lookup("gamma", &addr));
+    ASSERT_EQ(calls, 3);
+
+    // concurrent lookups share one resolution
+    std::vector<std::thread> threads;
+    std::atomic<int> found(0);
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&cache, &found] {
+            in_addr a;
+            if (cache.lookup("alpha", &a)) ++found;
+        });
+    }
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    ASSERT_EQ(found, 8);
+    ASSERT_EQ(calls, 4);
+
+    // expired entries are resolved again
+    std::ofstream(path) << "10.0.0.3 gamma\n";
+    cache.setTTL(10, 10);
+    cache.clear();
+    ASSERT_TRUE(cache.lookup("gamma", &addr));
+    ASSERT_EQ(calls, 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_TRUE(cache.lookup("gamma", &addr));
+    ASSERT_EQ(calls, 6);
+    ASSERT_FALSE(cache.lookup("alpha", &addr));
+
+    // a throwing resolver leaves no entry pending behind
+    cache.setResolver([](const std::string &, in_addr *) -> bool {
+        throw std::runtime_error("resolver failed");
+    });
+    ASSERT_THROW(cache.lookup("delta", &addr), std::runtime_error);
+    ASSERT_THROW(cache.lookup("delta", &addr), std::runtime_error);
+    cache.setResolver(hosts);
+    cache.clear();
+    ASSERT_EQ(cache.size(), 0u);
+    ASSERT_TRUE(cache.lookup("gamma", &addr));
+    ::unlink(path);
+}
+
+TEST(UDPSocket, batch) {
+    op::UDPSocket rx;
+    ASSERT_TRUE(rx.isOk());
+    ASSERT_TRUE(rx.bind("127.0.0.1", 0));
+    op::UDPSocket::set_rcvbuf(rx.sd(), 1 << 20);
+    op::UDPSocket tx("127.0.0.1", rx.port());
+
+    const unsigned count = 100;
+    std::vector<std::string> sent(count);
+    op::UDPBatch out(32);
+    for (unsigned i = 0; i < count;) {
+        out.clear();
+        for (; i < count && !out.full(); ++i) {
+            sent[i] = "datagram " + std::to_string(i);
+            ASSERT_TRUE(out.add(sent[i].data(), sent[i].size()));
+        }
+        ASSERT_EQ(tx.write_batch(out), (int) out.size());
+    }
+
+    op::UDPBatch in(16, 64);
+    std::vector<std::string> received;
+    std::atomic<bool> stop(false);
+    uint64_t total = rx.receive(in, [&received, count](const op::UDPBatch & b) {
+        EXPECT_LE(b.size(), b.capacity());
+        for (unsigned i = 0; i < b.size(); ++i) {
+            received.push_back(std::string(b.data(i), b.length(i)));
+            EXPECT_EQ(ntohs(b.from(i).sin_port) != 0, true);
+        }
+        return received.size() < count;
+    }, stop);
+    ASSERT_EQ(total, count);
+    ASSERT_EQ(received, sent);
+
+    // longer than the slot
+    std::string big(100, 'x');
+    ASSERT_EQ(tx.write_all(big.data(), (int) big.size()), (int) big.size());
+    ASSERT_EQ(rx.read_batch(in), 1);
+    ASSERT_TRUE(in.truncated(0));
+    ASSERT_EQ(in.length(0), 64u);
+    ASSERT_EQ(rx.read_batch(in, MSG_DONTWAIT), 0);
+}
+
+TEST(RingBuffer, wrap) {
+    op::RingBuffer ring(100);
+    ASSERT_EQ(ring.capacity(), 128u);
+    std::string a(100, 'a'), b(60, 'b');
+    ASSERT_EQ(ring.write(a.data(), a.size()), a.size());
+    char tmp[100];
+    ASSERT_EQ(ring.read(tmp, 90), 90u);
+    ASSERT_EQ(ring.write(b.data(), b.size()), b.size());
+    op::TCPSocket::iovec_t iov[2];
+    ASSERT_EQ(ring.readable(iov), 2);
+    ASSERT_EQ(ring.linearize(), std::string(10, 'a') + b);
+    ASSERT_EQ(ring.readable(iov), 1);
+    ASSERT_EQ(ring.write(a.data(), a.size()), 58u);
+    ASSERT_EQ(ring.free(), 0u);
+}
+
+TEST(SocketStream, lines) {
+    int sv[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    op::SocketStream out(sv[0], 256, 256);
+    op::SocketStream in(sv[1], 64, 64);
+
+    // small writes are sent together
+    std::vector<std::string> lines;
+    for (int i = 0; i < 20; ++i) {
+        lines.push_back("line " + std::to_string(i));
+        ASSERT_TRUE(out.write(lines.back()));
+        ASSERT_TRUE(out.write(i % 2 ? "\r\n" : "\n"));
+    }
+    ASSERT_EQ(out.syscalls(), 0u);
+    ASSERT_TRUE(out.flush());
+    ASSERT_EQ(out.syscalls(), 1u);
+
+    // lines cross the end of the 64 bytes ring
+    std::string_view line;
+    for (int i = 0; i < 20; ++i) {
+        ASSERT_TRUE(in.readLine(&line));
+        ASSERT_EQ(line, lines[i]);
+    }
+    ASSERT_LT(in.syscalls(), 20u);
+
+    ASSERT_TRUE(out.write("key=value;;tail"));
+    ASSERT_TRUE(out.flush());
+    ASSERT_TRUE(in.readUntil("=", &line));
+    ASSERT_EQ(line, "key");
+    ASSERT_TRUE(in.readUntil(";;", &line));
+    ASSERT_EQ(line, "value");
+    ASSERT_TRUE(in.read(4, &line));
+    ASSERT_EQ(line, "tail");
+
+    // larger than the write ring goes out in one gather write
+    std::string big(1000, 'z');
+    ASSERT_TRUE(out.write("head"));
+    ASSERT_TRUE(out.write(big));
+    ASSERT_EQ(out.syscalls(), 3u);
+    ::shutdown(sv[0], SHUT_WR);
+    std::string got;
+    char buff[100];
+    int n;
+    while ((n = in.read(buff, sizeof(buff))) > 0) got.append(buff, n);
+    ASSERT_EQ(n, 0);
+    ASSERT_EQ(got, "head" + big);
+    ASSERT_TRUE(in.eof());
+    ASSERT_FALSE(in.readLine(&line));
+    ::close(sv[0]);
+    ::close(sv[1]);
+}
+
+TEST(TCPServer, eventLoop) {
+    EchoServer server;
+    ASSERT_TRUE(server.isOk());
+    std::thread th([&server] { server.eventLoop(); });
+
+    const int count = 200;
+    std::vector<std::unique_ptr<op::TCPSocket> > clients;
+    for (int i = 0; i < count; ++i) {
+        clients.emplace_back(new op::TCPSocket("127.0.0.1", server.port()));
+        ASSERT_TRUE(clients.back()->isOk());
+    }
+    for (int i = 0; i < count; ++i) {
+        std::string msg = "ping" + std::to_string(i);
+        ASSERT_EQ(clients[i]->write_all(msg.c_str(), msg.size()), (int) msg.size());
+    }
+    for (int i = 0; i < count; ++i) {
+        std::string msg = "ping" + std::to_string(i);
+        std::vector<char> buff(msg.size());
+        ASSERT_EQ(clients[i]->read_all(&buff[0], buff.size()), (int) msg.size());
+        ASSERT_EQ(std::string(buff.begin(), buff.end()), msg);
+    }
+    clients.resize(count / 2);
+    while (server.closed < count / 2) std::this_thread::yield();
+
+    server.stop();
+    th.join();
+    ASSERT_EQ(server.accepted, count);
+    ASSERT_EQ(server.closed, count);
+}
+
+TEST(TCPServer, eventLoopReusePort) {
+    EchoServer server(true);
+    ASSERT_TRUE(server.isOk());
+    std::thread th([&server] { server.eventLoop(3); });
+
+    const int count = 100;
+    for (int i = 0; i < count; ++i) {
+        op::TCPSocket client("127.0.0.1", server.port());
+        ASSERT_TRUE(client.isOk());
+        ASSERT_EQ(client.write_all("ping", 4), 4);
+        char buff[4];
+        ASSERT_EQ(client.read_all(buff, 4), 4);
+        ASSERT_EQ(std::string(buff, 4), "ping");
+    }
+    while (server.closed < count) std::this_thread::yield();
+
+    server.stop();
+    th.join();
+    ASSERT_EQ(server.accepted, count);
+}
+
+// HTTP //////////////////////////////////////////////////////// //
+
+// answers "GET /len" with Content-Length, "GET /chunked" with chunked body
+// and anything else with the body till the connection close
+class CannedHTTPServer : public op::TCPServer {
+public:
+    CannedHTTPServer() : op::TCPServer(0) {}
+    std::atomic<int> accepted{0};
+    std::atomic<bool> dropReused{false};   // closes the next used connection unanswered
+    std::map<SOCKET, std::string> in;
+    std::set<SOCKET> used;
+
+    void onAccept(SOCKET, sockaddr *, socklen_t) override { ++accepted; }
+    void onClose(SOCKET sd) override {
+        in.erase(sd);
+        used.erase(sd);
+    }
+    void onReadable(SOCKET sd) override {
+        char buff[4096];
+        int rc;
+        while ((rc = ::recv(sd, buff, sizeof(buff), 0)) > 0) {
+            in[sd].append(buff, rc);
+        }
+        if (rc == 0 || errno != EAGAIN) {
+            closeConnection(sd);
+            return;
+        }
+        if (used.count(sd) && dropReused.exchange(false)) {
+            closeConnection(sd);
+            return;
+        }
+        used.insert(sd);
+        std::string & req = in[sd];
+        for (size_t end; (end = req.find("\r\n\r\n")) != std::string::npos;) {
+            std::string head = req.substr(0, end);
+            size_t length = 0, cl = head.find("Content-Length: ");
+            if (cl != std::string::npos) length = atoi(head.c_str() + cl + 16);
+            if (req.size() < end + 4 + length) break;
+            std::string body = req.substr(end + 4, length);
+            req.erase(0, end + 4 + length);
+            std::string resp;
+            if (head.compare(0, 11, "POST /echo ") == 0) {
+                resp = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size())
+                     + "\r\n\r\n" + body;
+            } else if (head.compare(0, 9, "GET /len ") == 0) {
+                resp = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+            } else if (head.compare(0, 13, "GET /chunked ") == 0) {
+                resp = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "3\r\nabc\r\nA;ext=1\r\n0123456789\r\n0\r\nX-Trailer: 1\r\n\r\n";
+            } else {
+                resp = "HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\nnot found";
+                op::TCPSocket::write_all(sd, resp.c_str(), resp.size());
+                closeConnection(sd);
+                return;
+            }
+            op::TCPSocket::write_all(sd, resp.c_str(), resp.size());
+        }
+    }
+};
+
+TEST(HTTP, ResponseParser) {
+    const std::string resp =
+        "HTTP/1.1 100 Continue\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nServer: test\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n1;x=y\r\n \r\n5\r\nworld\r\n0\r\nTrailer: 1\r\n\r\n"
+        "HTTP/1.1 204 No Content\r\n\r\n";
+    // whole stream at once and byte by byte must give the same result
+    for (size_t piece = resp.size(); piece > 0; piece = (piece == 1 ? 0 : 1)) {
+        std::string body;
+        op::HTTPResponseParser parser;
+        parser.setSink([&body](const char * data, size_t size) {
+            body.append(data, size);
+            return true;
+        });
+        size_t pos = 0;
+        while (!parser.isDone()) {
+            ASSERT_FALSE(parser.isFailed());
+            ASSERT_LT(pos, resp.size());
+            size_t n = std::min(piece, resp.size() - pos);
+            pos += parser.feed(resp.data() + pos, n);
+        }
+        ASSERT_EQ(parser.status(), 200);
+        ASSERT_EQ(parser.reason(), "OK");
+        ASSERT_EQ(parser.header("server"), "test");
+        ASSERT_TRUE(parser.isChunked());
+        ASSERT_TRUE(parser.keepAlive());
+        ASSERT_EQ(body, "hello world");
+        ASSERT_EQ(parser.bodyReceived(), 11u);
+
+        parser.reset();
+        pos += parser.feed(resp.data() + pos, resp.size() - pos);
+        ASSERT_TRUE(parser.isDone());
+        ASSERT_EQ(parser.status(), 204);
+        ASSERT_EQ(pos, resp.size());
+    }
+    {
+        op::HTTPResponseParser parser(32);
+        std::string big = "HTTP/1.1 200 OK\r\nX-Long: " + std::string(64, 'a');
+        parser.feed(big.data(), big.size());
+        ASSERT_TRUE(parser.isFailed());
+    }
+    {
+        op::HTTPResponseParser parser;
+        std::string eof = "HTTP/1.0 200 OK\r\n\r\nbody";
+        ASSERT_EQ(parser.feed(eof.data(), eof.size()), eof.size());
+        ASSERT_FALSE(parser.isDone());
+        ASSERT_TRUE(parser.finish());
+        ASSERT_FALSE(parser.keepAlive());
+        ASSERT_EQ(parser.bodyReceived(), 4u);
+    }
+}
+
+TEST(HTTP, HeaderBuilder) {
+    op::HTTPHeaderBuilder head(8);
+    head.requestLine("GET", "path", "a=1")
+        .header("Host", "example.com")
+        .header("Content-Length", (uint64_t) 1234567890123ULL)
+        .end();
+    ASSERT_EQ(head.str(), "GET /path?a=1 HTTP/1.1\r\nHost: example.com\r\n"
+                          "Content-Length: 1234567890123\r\n\r\n");
+    head.clear();
+    head.requestLine("HEAD", "/").end();
+    ASSERT_EQ(head.str(), "HEAD / HTTP/1.1\r\n\r\n");
+}
+
+TEST(HTTP, keepAlive) {
+    CannedHTTPServer server;
+    ASSERT_TRUE(server.isOk());
+    std::thread th([&server] { server.eventLoop(); });
+
+    op::HTTPConnectionPool pool(2);
+    op::HTTP http("127.0.0.1", server.port());
+    http.setPool(&pool);
+    http.setKeepAlive(true);
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(http.GET("/len"), 200);
+        ASSERT_EQ(std::string(http.body(), http.bodySize()), "hello");
+        ASSERT_EQ(http.GET("/chunked"), 200);
+        ASSERT_EQ(std::string(http.body(), http.bodySize()), "abc0123456789");
+    }
+    ASSERT_EQ(server.accepted, 1);
+    ASSERT_EQ(pool.idle("127.0.0.1", server.port()), 1u);
+
+    std::vector<std::string> pieces;
+    ASSERT_EQ(http.GET("/chunked", "", [&pieces](const char * data, size_t size) {
+        pieces.emplace_back(data, size);
+        return true;
+    }), 200);
+    ASSERT_EQ(pieces.size(), 2u);
+    ASSERT_EQ(pieces[0] + pieces[1], "abc0123456789");
+    ASSERT_EQ(http.body(), nullptr);
+    ASSERT_EQ(http.response().header("Transfer-Encoding"), "chunked");
+
+    ASSERT_EQ(http.GET("/missing"), 404);
+    ASSERT_EQ(std::string(http.body()), "not found");
+    ASSERT_EQ(pool.idle("127.0.0.1", server.port()), 0u);
+    ASSERT_EQ(http.GET("/len"), 200);
+    ASSERT_EQ(server.accepted, 2);
+
+    std::string payload(1 << 20, 'x');
+    ASSERT_EQ(http.POST("/echo", payload.data(), payload.size(), "application/octet-stream"), 200);
+    ASSERT_EQ(http.bodySize(), payload.size());
+    ASSERT_EQ(http.POST("/echo", "a=1&b=2"), 200);
+    ASSERT_EQ(std::string(http.body()), "a=1&b=2");
+    ASSERT_EQ(server.accepted, 2);
+
+    std::vector<op::HTTP::Request> batch;
+    for (int i = 0; i < 300; ++i) {
+        op::HTTP::Request r;
+        r.Method = "GET";
+        r.Uri = (i % 2) ? "/chunked" : "/len";
+        batch.push_back(r);
+    }
+    std::vector<op::HTTP::Response> answers;
+    double total = 0;
+    ASSERT_EQ(http.pipeline(batch, &answers, &total), batch.size());
+    ASSERT_EQ(server.accepted, 2);
+    for (size_t i = 0; i < answers.size(); ++i) {
+        ASSERT_EQ(answers[i].Status, 200);
+        ASSERT_EQ(answers[i].Body, (i % 2) ? "abc0123456789" : "hello");
+        ASSERT_LE(answers[i].LatencyMs, total);
+    }
+    // a reused connection closed by the server is replaced once
+    server.dropReused = true;
+    ASSERT_EQ(http.pipeline(batch, &answers), batch.size());
+    ASSERT_EQ(server.accepted, 3);
+    ASSERT_EQ(answers[299].Body, "abc0123456789");
+    batch[150].Uri = "/missing";
+    ASSERT_EQ(http.pipeline(batch, &answers), 151u);
+    ASSERT_EQ(answers[150].Status, 404);
+    ASSERT_EQ(answers[151].Status, 500);
+
+    http.setKeepAlive(false);
+    ASSERT_EQ(http.GET("/len"), 200);
+    ASSERT_EQ(pool.idle("127.0.0.1", server.port()), 0u);
+
+    // without keep-alive the pool and its per-host limit are not used
+    op::HTTPConnectionPool full(0, 30000, 50);
+    http.setPool(&full);
+    ASSERT_EQ(http.GET("/len"), 200);
+    ASSERT_EQ(std::string(http.body(), http.bodySize()), "hello");
+
+    server.stop();
+    th.join();
+}
+
+// HTTPServer ////////////////////////////////////////////////// //
+
+TEST(HTTP, timeouts) {
+    // backlog 0 listener that never accepts: once its queue is full
+    // the handshakes of the next connects are not answered
+    SOCKET listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(::bind(listener, (sockaddr *) &addr, sizeof(addr)), 0);
+    ASSERT_EQ(::listen(listener, 0), 0);
+    socklen_t len = sizeof(addr);
+    ::getsockname(listener, (sockaddr *) &addr, &len);
+    const unsigned port = ntohs(addr.sin_port);
+
+    std::vector<std::unique_ptr<op::TCPSocket> > queued;
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start;
+    for (int i = 0; i < 8; ++i) {
+        start = clock::now();
+        queued.emplace_back(new op::TCPSocket("127.0.0.1", port, 100));
+        if (!queued.back()->isOk()) break;
+    }
+    ASSERT_FALSE(queued.back()->isOk());
+    ASSERT_EQ(errno, ETIMEDOUT);
+    ASSERT_LT(clock::now() - start, std::chrono::milliseconds(1000));
+
+    op::HTTPConnectionPool pool;
+    op::HTTP http("127.0.0.1", port);
+    http.setPool(&pool);
+    http.setConnectTimeout(100);
+    ASSERT_EQ(http.GET("/"), op::HTTP::TIMED_OUT);
+    ASSERT_TRUE(http.timedOut());
+    queued.clear();
+    ::close(listener);
+
+    // server that answers too late
+    op::HTTPServer server(0);
+    server.route("GET", "/slow", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        resp.set(200, "late");
+    });
+    server.route("GET", "/fast", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        resp.set(200, "fast");
+    });
+    std::thread th([&server] { server.run(); });
+    op::HTTP client("127.0.0.1", server.port());
+    client.setPool(&pool);
+    client.setTimeout(100);
+    start = clock::now();
+    ASSERT_EQ(client.GET("/slow"), op::HTTP::TIMED_OUT);
+    ASSERT_LT(clock::now() - start, std::chrono::milliseconds(250));
+    client.setTimeout((unsigned) -1);
+    client.setIOTimeout(1000);
+    ASSERT_EQ(client.GET("/fast"), 200);
+    ASSERT_FALSE(client.timedOut());
+    server.stop();
+    th.join();
+}
+
+#if (OPNET_HTTP_ZLIB == 1)
+static std::string compress(const std::string & data, int windowBits) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&z, data.size()), 0);
+    z.next_in = (Bytef *) data.data();
+    z.avail_in = (uInt) data.size();
+    z.next_out = (Bytef *) &out[0];
+    z.avail_out = (uInt) out.size();
+    deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+TEST(HTTP, inflate) {
+    std::string text;
+    for (int i = 0; i < 20000; ++i) text += "line " + std::to_string(i * 7919 % 10007) + "\n";
+    op::HTTPServer server(0);
+    ASSERT_TRUE(server.isOk());
+    const char * encodings[][2] = {
+        { "/gzip", "gzip" }, { "/deflate", "deflate" }, { "/raw", "deflate" }, { "/cut", "gzip" }
+    };
+    const int bits[] = { 15 + 16, 15, -15, 15 + 16 };
+    for (int i = 0; i < 4; ++i) {
+        std::string body = compress(text, bits[i]);
+        if (i == 3) body.resize(body.size() / 2);
+        std::string encoding = encodings[i][1];
+        server.route("GET", encodings[i][0], [body, encoding](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+            resp.set(200, body);
+            resp.Headers.push_back(std::make_pair("Content-Encoding", encoding));
+        });
+    }
+    server.route("GET", "/plain", [text](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        resp.set(200, text);
+    });
+    std::thread th([&server] { server.run(); });
+
+    op::HTTPConnectionPool pool;
+    op::HTTP http("127.0.0.1", server.port());
+    http.setPool(&pool);
+    http.setKeepAlive(true);
+    http.setGzip(true);
+    for (const char * uri : { "/gzip", "/deflate", "/raw", "/plain" }) {
+        ASSERT_EQ(http.GET(uri), 200) << uri;
+        ASSERT_EQ(std::string(http.body(), http.bodySize()), text) << uri;
+    }
+    size_t biggest = 0, total = 0;
+    ASSERT_EQ(http.GET("/gzip", "", [&biggest, &total](const char *, size_t size) {
+        biggest = std::max(biggest, size);
+        total += size;
+        return true;
+    }), 200);
+    ASSERT_EQ(total, text.size());
+    ASSERT_LE(biggest, op::HTTPInflater::CHUNK);
+    ASSERT_EQ(http.GET("/cut"), 500);
+
+    std::vector<op::HTTP::Request> batch(3);
+    batch[0].Method = batch[1].Method = batch[2].Method = "GET";
+    batch[0].Uri = "/gzip";
+    batch[1].Uri = "/plain";
+    batch[2].Uri = "/raw";
+    std::vector<op::HTTP::Response> answers;
+    ASSERT_EQ(http.pipeline(batch, &answers), 3u);
+    for (size_t i = 0; i < answers.size(); ++i) {
+        ASSERT_EQ(answers[i].Body, text);
+    }
+    server.stop();
+    th.join();
+}
+#endif
+
+class URingEcho : public op::URingServer {
+public:
+    explicit URingEcho(unsigned buffers = 512, size_t bufferSize = 4096)
+        : op::URingServer(0, buffers, bufferSize) {}
+    std::atomic<int> connected{0}, disconnected{0};
+    std::atomic<bool> refuse{false}, again{false};
+    void onConnect(SOCKET sd) override {
+        ++connected;
+        if (refuse) disconnect(sd);
+    }
+    void onData(SOCKET sd, const char * data, size_t size) override {
+        if (size >= 4 && !memcmp(data, "quit", 4)) {
+            disconnect(sd);
+            return;
+        }
+        send(sd, data, size);
+    }
+    void onDisconnect(SOCKET sd) override {
+        ++disconnected;
+        if (again) disconnect(sd);
+    }
+};
+
+TEST(URingServer, echo) {
+    for (int b = 0; b < 2; ++b) {
+        const op::URingServer::Backend backend = b ? op::URingServer::AUTO : op::URingServer::EPOLL;
+        URingEcho server;
+        ASSERT_TRUE(server.isOk());
+        std::thread th([&server, backend] { server.run(backend); });
+
+        const int count = 20;
+        std::vector<std::unique_ptr<op::TCPSocket> > clients;
+        for (int i = 0; i < count; ++i) {
+            clients.emplace_back(new op::TCPSocket("127.0.0.1", server.port()));
+            ASSERT_TRUE(clients.back()->isOk());
+        }
+        std::string big(256 * 1024, 0);
+        for (size_t i = 0; i < big.size(); ++i) big[i] = (char) (i % 251);
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < count; ++i) {
+                std::string msg = "ping" + std::to_string(i * 100 + round);
+                ASSERT_EQ(clients[i]->write_all(msg.c_str(), msg.size()), (int) msg.size());
+                std::vector<char> buff(msg.size());
+                ASSERT_EQ(clients[i]->read_all(&buff[0], buff.size()), (int) msg.size());
+                ASSERT_EQ(std::string(buff.begin(), buff.end()), msg);
+            }
+        }
+        // more than the provided buffers hold at once
+        std::thread writer([&clients, &big] { clients[0]->write_all(big.data(), big.size()); });
+        std::string back(big.size(), 0);
+        ASSERT_EQ(clients[0]->read_all(&back[0], back.size()), (int) back.size());
+        writer.join();
+        ASSERT_TRUE(back == big);
+
+        ASSERT_EQ(clients[1]->write_all("quit", 4), 4);
+        char c;
+        ASSERT_EQ(clients[1]->read_all(&c, 1), 0);
+        clients.clear();
+        while (server.disconnected < count) std::this_thread::yield();
+
+        server.stop();
+        th.join();
+        ASSERT_EQ(server.connected, count);
+        if (b) {
+            ASSERT_EQ(server.backend() == op::URingServer::URING, op::IOURing::supported());
+        }
+    }
+}
+
+TEST(URingServer, disconnectFromHooks) {
+    for (int b = 0; b < 2; ++b) {
+        const op::URingServer::Backend backend = b ? op::URingServer::AUTO : op::URingServer::EPOLL;
+        // one small buffer: recv runs out of it and ends with ENOBUFS
+        URingEcho server(1, 16);
+        ASSERT_TRUE(server.isOk());
+        std::thread th([&server, backend] { server.run(backend); });
+
+        char c;
+        for (int i = 0; i < 10; ++i) {
+            op::TCPSocket client("127.0.0.1", server.port());
+            ASSERT_TRUE(client.isOk());
+            std::string msg = "quit" + std::string(100, 'x');
+            client.write_all(msg.data(), msg.size());
+            ASSERT_EQ(client.read_all(&c, 1), 0);
+        }
+        server.refuse = true;
+        for (int i = 0; i < 10; ++i) {
+            op::TCPSocket client("127.0.0.1", server.port());
+            ASSERT_TRUE(client.isOk());
+            ASSERT_EQ(client.read_all(&c, 1), 0);
+        }
+        // the final recv of a closed client disconnects from onDisconnect()
+        server.refuse = false;
+        server.again = true;
+        for (int i = 0; i < 10; ++i) {
+            op::TCPSocket client("127.0.0.1", server.port());
+            ASSERT_TRUE(client.isOk());
+            char back[4];
+            client.write_all("ping", 4);
+            ASSERT_EQ(client.read_all(back, 4), 4);
+        }
+        while (server.disconnected < 30) std::this_thread::yield();
+
+        server.stop();
+        th.join();
+        ASSERT_EQ(server.connected, 30);
+        ASSERT_EQ(server.disconnected, 30);
+    }
+}
+
+TEST(URingFileReader, read) {
+    char path[] = "/tmp/opuringXXXXXX";
+    int fd = ::mkstemp(path);
+    ASSERT_GE(fd, 0);
+    std::string data(1000 * 1000 + 123, 0);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = (char) (i * 31 % 253);
+    ASSERT_EQ(::write(fd, data.data(), data.size()), (ssize_t) data.size());
+
+    for (int uring = 0; uring < 2; ++uring) {
+        op::URingFileReader reader(4, 64 * 1024, uring != 0);
+        ASSERT_EQ(reader.usesURing(), uring && op::IOURing::supported());
+        std::string out;
+        ASSERT_EQ(reader.read(fd, [&out](const char * p, size_t n, uint64_t offset) {
+            EXPECT_EQ(offset, out.size());
+            out.append(p, n);
+            return true;
+        }), (int64_t) data.size());
+        ASSERT_TRUE(out == data);
+
+        out.clear();
+        ASSERT_EQ(reader.read(fd, 999000, 5000, [&out](const char * p, size_t n, uint64_t) {
+            out.append(p, n);
+            return true;
+        }), 1123);
+        ASSERT_EQ(out, data.substr(999000));
+    }
+    ::close(fd);
+    ::unlink(path);
+}
+
+TEST(HTTPServer, routes) {
+    for (unsigned workers = 0; workers < 3; workers += 2) {
+        op::HTTPServer server(0);
+        ASSERT_TRUE(server.isOk());
+        server.setWorkers(workers);
+        server.route("GET", "/hello", [](const op::HTTPRequest & req, op::HTTPServerResponse & resp) {
+            resp.set(200, "hello " + req.params().value("name", "nobody"));
+        });
+        server.route("POST", "/echo", [](const op::HTTPRequest & req, op::HTTPServerResponse & resp) {
+            resp.set(200, std::string(req.Body), "application/octet-stream");
+        });
+        server.route("GET", "/static/*", [](const op::HTTPRequest & req, op::HTTPServerResponse & resp) {
+            resp.set(200, std::string(req.Path));
+        });
+        server.route("GET", "/static/deep/*", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+            resp.set(200, "deep");
+        });
+        std::thread th([&server] { server.run(); });
+
+        op::HTTPConnectionPool pool;
+        op::HTTP http("127.0.0.1", server.port());
+        http.setPool(&pool);
+        http.setKeepAlive(true);
+        ASSERT_EQ(http.GET("/hello", "name=a%20b"), 200);
+        ASSERT_EQ(std::string(http.body()), "hello a b");
+        ASSERT_EQ(http.POST("/echo", "payload"), 200);
+        ASSERT_EQ(std::string(http.body()), "payload");
+        ASSERT_EQ(http.GET("/static/css/site.css"), 200);
+        ASSERT_EQ(std::string(http.body()), "/static/css/site.css");
+        ASSERT_EQ(http.GET("/static/deep/x"), 200);
+        ASSERT_EQ(std::string(http.body()), "deep");
+        ASSERT_EQ(http.GET("/missing"), 404);
+        ASSERT_EQ(http.GET("/echo"), 405);
+        ASSERT_EQ(http.request("HEAD", "/hello"), 200);
+        ASSERT_TRUE(std::string(http.body()).empty());
+        ASSERT_NE(std::string(http.headers()).find("Content-Length: 12"), std::string::npos);
+        ASSERT_EQ(http.GET("/hello"), 200);
+        ASSERT_EQ(std::string(http.body()), "hello nobody");
+        ASSERT_EQ(http.request("HEAD", "/echo"), 405);
+        ASSERT_TRUE(std::string(http.body()).empty());
+        ASSERT_EQ(pool.idle("127.0.0.1", server.port()), 1u);
+
+        std::vector<op::HTTP::Request> batch(100);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i].Method = "GET";
+            batch[i].Uri = "/hello";
+            batch[i].Data = "name=" + std::to_string(i);
+        }
+        std::vector<op::HTTP::Response> answers;
+        ASSERT_EQ(http.pipeline(batch, &answers), batch.size());
+        for (size_t i = 0; i < answers.size(); ++i) {
+            ASSERT_EQ(answers[i].Body, "hello " + std::to_string(i));
+        }
+
+        http.setKeepAlive(false);
+        ASSERT_EQ(http.GET("/hello"), 200);
+        ASSERT_FALSE(std::string(http.headers()).find("Connection: close") == std::string::npos);
+
+        // requests written before a half-close are still answered
+        op::TCPSocket raw("127.0.0.1", server.port());
+        ASSERT_TRUE(raw.isOk());
+        std::string twice = "GET /hello?name=x HTTP/1.1\r\nHost: a\r\n\r\n"
+                            "GET /hello?name=y HTTP/1.1\r\nHost: a\r\n\r\n";
+        ASSERT_EQ(raw.write_all(twice.data(), twice.size()), (long) twice.size());
+        ::shutdown(raw.sd(), SHUT_WR);
+        std::string answer;
+        char buff[4096];
+        for (int rc; (rc = ::recv(raw.sd(), buff, sizeof(buff), 0)) > 0;) {
+            answer.append(buff, rc);
+        }
+        ASSERT_NE(answer.find("hello x"), std::string::npos) << answer;
+        ASSERT_NE(answer.find("hello y"), std::string::npos) << answer;
+
+        server.stop();
+        th.join();
+    }
+}
+
+TEST(HTTPServer, parseRange) {
+    uint64_t first = 0, last = 0;
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=0-99", 1000, &first, &last), 1);
+    ASSERT_EQ(first, 0u);
+    ASSERT_EQ(last, 99u);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=900-", 1000, &first, &last), 1);
+    ASSERT_EQ(last, 999u);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=-10", 1000, &first, &last), 1);
+    ASSERT_EQ(first, 990u);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=500-5000", 1000, &first, &last), 1);
+    ASSERT_EQ(last, 999u);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=1000-", 1000, &first, &last), -1);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=-0", 1000, &first, &last), -1);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=0-1,5-6", 1000, &first, &last), 0);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("bytes=9-1", 1000, &first, &last), 0);
+    ASSERT_EQ(op::HTTPFileBody::parseRange("items=0-1", 1000, &first, &last), 0);
+}
+
+// sends one request with Connection: close and reads the whole answer
+static std::string raw_request(unsigned port, const std::string & request) {
+    op::TCPSocket client("127.0.0.1", port);
+    std::string answer;
+    if (client.write_all(request.c_str(), request.size()) != (int) request.size()) {
+        return answer;
+    }
+    char buff[16 * 1024];
+    int rc;
+    while ((rc = client.recvthis(buff, sizeof(buff))) > 0) {
+        answer.append(buff, rc);
+    }
+    return answer;
+}
+
+TEST(HTTPServer, contentLength) {
+    op::HTTPRequest req;
+    std::string second = "GET /admin HTTP/1.1\r\nConnection: close\r\n\r\n";
+    std::string huge = "POST /echo HTTP/1.1\r\nContent-Length: 18446744073709551615\r\n\r\n" + second;
+    ASSERT_EQ(op::HTTPRequest::parse(huge.data(), huge.size(), &req), -1);
+    std::string big = "POST /echo HTTP/1.1\r\nContent-Length: 1000000\r\n\r\n";
+    ASSERT_EQ(op::HTTPRequest::parse(big.data(), big.size(), &req, 1024, 1024), -2);
+    std::string garbage = "POST /echo HTTP/1.1\r\nContent-Length: 12abc\r\n\r\n";
+    ASSERT_EQ(op::HTTPRequest::parse(garbage.data(), garbage.size(), &req), -1);
+    std::string twice = "POST /echo HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 40\r\n\r\nab";
+    ASSERT_EQ(op::HTTPRequest::parse(twice.data(), twice.size(), &req), -1);
+    std::string same = "POST /echo HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\nab";
+    ASSERT_EQ(op::HTTPRequest::parse(same.data(), same.size(), &req), (long) same.size());
+    ASSERT_EQ(std::string(req.Body), "ab");
+
+    op::HTTPServer server(0);
+    ASSERT_TRUE(server.isOk());
+    server.setMaxRequestSize(1024);
+    server.route("POST", "/echo", [](const op::HTTPRequest & r, op::HTTPServerResponse & resp) {
+        resp.set(200, std::string(r.Body));
+    });
+    server.route("GET", "/admin", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        resp.set(200, "admin");
+    });
+    std::thread th([&server] { server.run(); });
+
+    // the pipelined request after a bad length is never served
+    std::string answer = raw_request(server.port(), huge);
+    ASSERT_EQ(answer.compare(0, 12, "HTTP/1.1 400"), 0) << answer;
+    ASSERT_EQ(answer.find("admin"), std::string::npos) << answer;
+    answer = raw_request(server.port(), twice + second);
+    ASSERT_EQ(answer.compare(0, 12, "HTTP/1.1 400"), 0) << answer;
+    ASSERT_EQ(answer.find("admin"), std::string::npos) << answer;
+    answer = raw_request(server.port(), big);
+    ASSERT_EQ(answer.compare(0, 12, "HTTP/1.1 413"), 0) << answer;
+    answer = raw_request(server.port(), same + second);
+    ASSERT_NE(answer.find("admin"), std::string::npos) << answer;
+
+    server.stop();
+    th.join();
+}
+
+TEST(HTTPServer, serveFiles) {
+    char dir[] = "/tmp/opfilesXXXXXX";
+    ASSERT_TRUE(::mkdtemp(dir) != 0);
+    std::string small(1000, 0), large(300 * 1024, 0);
+    for (size_t i = 0; i < small.size(); ++i) small[i] = (char) ('a' + i % 26);
+    for (size_t i = 0; i < large.size(); ++i) large[i] = (char) (i * 7);
+    std::ofstream(std::string(dir) + "/small.txt", std::ios::binary) << small;
+    std::ofstream(std::string(dir) + "/large.bin", std::ios::binary) << large;
+
+    op::HTTPServer server(0);
+    ASSERT_TRUE(server.isOk());
+    server.serveFiles("/files/", dir);
+    std::thread th([&server] { server.run(); });
+
+    op::HTTPConnectionPool pool;
+    op::HTTP http("127.0.0.1", server.port());
+    http.setPool(&pool);
+    http.setKeepAlive(true);
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(http.GET("/files/large.bin"), 200);
+        ASSERT_EQ(http.bodySize(), large.size());
+        ASSERT_TRUE(memcmp(http.body(), large.data(), large.size()) == 0);
+        ASSERT_EQ(http.GET("/files/small.txt"), 200);
+        ASSERT_EQ(std::string(http.body(), http.bodySize()), small);
+        ASSERT_EQ(http.response().header("Content-Type"), "text/plain");
+    }
+    ASSERT_EQ(http.GET("/files/none.txt"), 404);
+
+    // cached file is reopened when it changes on disk
+    std::ofstream(std::string(dir) + "/small.txt", std::ios::binary) << "changed";
+    ASSERT_EQ(http.GET("/files/small.txt"), 200);
+    ASSERT_EQ(std::string(http.body(), http.bodySize()), "changed");
+    std::ofstream(std::string(dir) + "/small.txt", std::ios::binary) << small;
+
+    std::string answer = raw_request(server.port(),
+        "GET /files/large.bin HTTP/1.1\r\nRange: bytes=100000-100009\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(answer.compare(0, 12, "HTTP/1.1 206"), 0);
+    ASSERT_NE(answer.find("Content-Range: bytes 100000-100009/307200"), std::string::npos);
+    ASSERT_EQ(answer.substr(answer.find("\r\n\r\n") + 4), large.substr(100000, 10));
+
+    answer = raw_request(server.port(),
+        "GET /files/small.txt HTTP/1.1\r\nRange: bytes=-5\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(answer.compare(0, 12, "HTTP/1.1 206"), 0);
+    ASSERT_EQ(answer.substr(answer.find("\r\n\r\n") + 4), small.substr(995));
+
+    answer = raw_request(server.port(),
+        "GET /files/small.txt HTTP/1.1\r\nRange: bytes=2000-\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(answer.compare(0, 12, "HTTP/1.1 416"), 0);
+    ASSERT_NE(answer.find("Content-Range: bytes */1000"), std::string::npos);
+
+    answer = raw_request(server.port(), "GET /files/../etc/passwd HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(answer.compare(0, 12, "HTTP/1.1 403"), 0);
+
+    // clients dropping a sendfile() download don't get the process killed
+    // by SIGPIPE, and the server doesn't change its disposition
+    std::ofstream(std::string(dir) + "/huge.bin", std::ios::binary) << std::string(16 << 20, 'h');
+    for (int i = 0; i < 3; ++i) {
+        op::TCPSocket raw("127.0.0.1", server.port());
+        std::string req = "GET /files/huge.bin HTTP/1.1\r\n\r\n";
+        ASSERT_EQ(raw.write_all(req.data(), req.size()), (long) req.size());
+        char buff[1024];
+        ASSERT_EQ(raw.read_all(buff, sizeof(buff)), (long) sizeof(buff));
+    }
+    ASSERT_EQ(http.GET("/files/small.txt"), 200);
+    struct sigaction sa;
+    ASSERT_EQ(::sigaction(SIGPIPE, 0, &sa), 0);
+    ASSERT_TRUE(sa.sa_handler == SIG_DFL);
+
+    server.stop();
+    th.join();
+    ::unlink((std::string(dir) + "/small.txt").c_str());
+    ::unlink((std::string(dir) + "/large.bin").c_str());
+    ::unlink((std::string(dir) + "/huge.bin").c_str());
+    ::rmdir(dir);
+}
+
+TEST(NetMetrics, histogram) {
+    ASSERT_EQ(op::NetMetrics::bucket(0), 0u);
+    ASSERT_EQ(op::NetMetrics::bucket(1), 1u);
+    ASSERT_EQ(op::NetMetrics::bucket(1000), 10u);
+    ASSERT_EQ(op::NetMetrics::bucket((uint64_t) -1), op::NetMetrics::BUCKETS - 1);
+
+    const op::NetMetrics::Snapshot before = op::NetMetrics::snapshot();
+    for (int i = 0; i < 98; ++i) op::NetMetrics::time(op::NetMetrics::DNS_TIME, 100);
+    op::NetMetrics::time(op::NetMetrics::DNS_TIME, 5000);
+    std::thread([] { op::NetMetrics::time(op::NetMetrics::DNS_TIME, 70000); }).join();
+    op::NetMetrics::error(ECONNRESET);
+
+    const op::NetMetrics::Snapshot d = op::NetMetrics::snapshot().since(before);
+    const op::NetMetrics::Histogram & h = d[op::NetMetrics::DNS_TIME];
+    ASSERT_EQ(h.Count, 100u);
+    ASSERT_EQ(h.SumUs, 98u * 100 + 5000 + 70000);
+    ASSERT_EQ(h.percentile(0.5), 128u);
+    ASSERT_EQ(h.percentile(0.99), 8192u);
+    ASSERT_EQ(h.percentile(1.0), 131072u);
+    ASSERT_EQ(d.Errors.at(ECONNRESET), 1u);
+    ASSERT_NE(d.text().find("opnet_dns_time_us_bucket{le=\"128\"} 98\n"), std::string::npos);
+    ASSERT_NE(d.text().find("opnet_dns_time_us_count 100\n"), std::string::npos);
+}
+
+TEST(NetMetrics, counters) {
+    op::HTTPServer server(0);
+    server.route("GET", "/hello", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        resp.set(200, "hello");
+    });
+    std::thread th([&server] { server.run(); });
+
+    const op::NetMetrics::Snapshot before = op::NetMetrics::snapshot();
+    op::HTTPConnectionPool pool;
+    op::HTTP http("127.0.0.1", server.port());
+    http.setPool(&pool);
+    http.setKeepAlive(true);
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(http.GET("/hello"), 200);
+    }
+    ASSERT_EQ(server.accepts(), 1u);
+    ASSERT_EQ(server.activeConnections(), 1);
+    pool.clear();
+
+    // closed port, the connect is refused
+    SOCKET sd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(sd, (sockaddr *) &addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    ::getsockname(sd, (sockaddr *) &addr, &len);
+    op::TCPSocket refused("127.0.0.1", ntohs(addr.sin_port));
+    ASSERT_FALSE(refused.isOk());
+    ::close(sd);
+
+    while (server.activeConnections() > 0) std::this_thread::yield();
+    const op::NetMetrics::Snapshot d = op::NetMetrics::snapshot().since(before);
+    server.stop();
+    th.join();
+
+    ASSERT_EQ(d[op::NetMetrics::HTTP_REQUESTS], 3u);
+    ASSERT_EQ(d[op::NetMetrics::HTTP_ERRORS], 0u);
+    ASSERT_EQ(d[op::NetMetrics::HTTP_TIME].Count, 3u);
+    ASSERT_EQ(d[op::NetMetrics::FIRST_BYTE_TIME].Count, 3u);
+    ASSERT_EQ(d[op::NetMetrics::CONNECTS], 2u);
+    ASSERT_EQ(d[op::NetMetrics::CONNECT_ERRORS], 1u);
+    ASSERT_EQ(d[op::NetMetrics::CONNECT_TIME].Count, 1u);
+    ASSERT_EQ(d.Errors.at(ECONNREFUSED), 1u);
+    ASSERT_EQ(d[op::NetMetrics::ACCEPTS], 1u);
+    ASSERT_EQ(d[op::NetMetrics::ACTIVE], 0u);
+    ASSERT_GT(d[op::NetMetrics::BYTES_OUT], 0u);
+    ASSERT_GT(d[op::NetMetrics::BYTES_IN], 0u);
+    ASSERT_GE(d[op::NetMetrics::SYSCALLS], 6u);
+}
+
+#ifdef __cpp_impl_coroutine
+// Coroutines /////////////////////////////////////////////////// //
+
+static op::Task<int> wait_readable(op::AsyncLoop * loop, SOCKET sd, unsigned ms,
+                                   op::CancelToken * cancel) {
+    co_return co_await loop->wait(sd, op::EventLoop::READ, op::Deadline(ms), cancel);
+}
+
+static op::Task<> expect_wait(op::AsyncLoop * loop, SOCKET sd, unsigned ms,
+                              op::CancelToken * cancel, int expected, int * done) {
+    EXPECT_EQ(co_await wait_readable(loop, sd, ms, cancel), expected);
+    ++*done;
+}
+
+static op::Task<> cancel_later(op::AsyncLoop * loop, op::CancelToken * cancel, int * done) {
+    EXPECT_EQ(co_await loop->sleep(20), 0);
+    cancel->cancel();
+    ++*done;
+}
+
+TEST(AsyncLoop, deadlines) {
+    int sv[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+    op::AsyncLoop loop;
+    ASSERT_TRUE(loop.attach(sv[0]));
+    ASSERT_TRUE(loop.attach(sv[1]));
+    op::CancelToken cancel;
+    int done = 0;
+
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point start = clock::now();
+    loop.spawn(expect_wait(&loop, sv[0], 50, 0, ETIMEDOUT, &done));
+    loop.spawn(expect_wait(&loop, sv[1], -1, &cancel, ECANCELED, &done));
+    loop.spawn(cancel_later(&loop, &cancel, &done));
+    loop.run();
+    ASSERT_EQ(done, 3);
+    ASSERT_EQ(loop.active(), 0u);
+    ASSERT_GE(clock::now() - start, std::chrono::milliseconds(50));
+    ASSERT_LT(clock::now() - start, std::chrono::milliseconds(1000));
+
+    // cancelled token fails at once, data wakes the reader
+    loop.spawn(expect_wait(&loop, sv[0], -1, &cancel, ECANCELED, &done));
+    cancel.reset();
+    loop.spawn(expect_wait(&loop, sv[0], 1000, &cancel, 0, &done));
+    loop.spawn(expect_wait(&loop, sv[0], 1000, 0, EBUSY, &done));
+    ASSERT_EQ(::send(sv[1], "x", 1, 0), 1);
+    loop.run();
+    ASSERT_EQ(done, 6);
+    loop.detach(sv[0]);
+    loop.detach(sv[1]);
+    ::close(sv[0]);
+    ::close(sv[1]);
+}
+
+static op::Task<> echo_client(op::AsyncLoop * loop, unsigned port, int id, int * ok) {
+    op::AsyncSocket s(*loop);
+    if (!co_await s.async_connect("127.0.0.1", port, op::Deadline(2000))) co_return;
+    const std::string msg = "ping" + std::to_string(id);
+    for (int round = 0; round < 3; ++round) {
+        if (co_await s.async_write(msg.data(), msg.size()) != (long) msg.size()) co_return;
+        std::string got;
+        char buff[64];
+        while (got.size() < msg.size()) {
+            long n = co_await s.async_read(buff, sizeof(buff), op::Deadline(2000));
+            if (n <= 0) co_return;
+            got.append(buff, n);
+        }
+        if (got != msg) co_return;
+    }
+    ++*ok;
+}
+
+TEST(AsyncSocket, echo) {
+    EchoServer server;
+    ASSERT_TRUE(server.isOk());
+    std::thread th([&server] { server.eventLoop(); });
+
+    op::AsyncLoop loop;
+    const int count = 200;
+    int ok = 0;
+    for (int i = 0; i < count; ++i) {
+        loop.spawn(echo_client(&loop, server.port(), i, &ok));
+    }
+    loop.run();
+    ASSERT_EQ(ok, count);
+
+    server.stop();
+    th.join();
+}
+
+static op::Task<> http_client(op::AsyncLoop * loop, unsigned port, int id, int * ok) {
+    op::AsyncHTTP http(*loop, "127.0.0.1", port);
+    http.setKeepAlive(true);
+    http.setTimeout(5000);
+    for (int i = 0; i < 2; ++i) {
+        int status = co_await http.async_request("GET", "/hello", "id=" + std::to_string(id));
+        EXPECT_EQ(status, 200);
+        EXPECT_EQ(http.body(), "hello " + std::to_string(id));
+    }
+    ++*ok;
+}
+
+static op::Task<> http_slow(op::AsyncLoop * loop, unsigned port, op::CancelToken * cancel,
+                            int expected, int * ok) {
+    op::AsyncHTTP http(*loop, "127.0.0.1", port);
+    http.setCancel(cancel);
+    if (!cancel) http.setTimeout(100);
+    EXPECT_EQ(co_await http.async_request("GET", "/slow"), expected);
+    EXPECT_EQ(http.timedOut(), cancel == 0);
+    EXPECT_EQ(http.cancelled(), cancel != 0);
+    ++*ok;
+}
+
+TEST(AsyncHTTP, requests) {
+    op::HTTPServer server(0);
+    server.route("GET", "/hello", [](const op::HTTPRequest & req, op::HTTPServerResponse & resp) {
+        resp.set(200, "hello " + std::string(req.Query.substr(3)));
+    });
+    server.route("GET", "/slow", [](const op::HTTPRequest &, op::HTTPServerResponse & resp) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        resp.set(200, "late");
+    });
+    server.setWorkers(2);
+    std::thread th([&server] { server.run(); });
+
+    op::AsyncLoop loop;
+    const int count = 100;
+    int ok = 0;
+    for (int i = 0; i < count; ++i) {
+        loop.spawn(http_client(&loop, server.port(), i, &ok));
+    }
+    loop.run();
+    ASSERT_EQ(ok, count);
+
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point start = clock::now();
+    op::CancelToken cancel;
+    ok = 0;
+    loop.spawn(http_slow(&loop, server.port(), 0, op::AsyncHTTP::TIMED_OUT, &ok));
+    loop.spawn(http_slow(&loop, server.port(), &cancel, 500, &ok));
+    loop.spawn(cancel_later(&loop, &cancel, &ok));
+    loop.run();
+    ASSERT_EQ(ok, 3);
+    ASSERT_LT(clock::now() - start, std::chrono::milliseconds(250));
+
+    server.stop();
+    th.join();
+}
+#endif // __cpp_impl_coroutine
+
 int main(int argc, char ** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
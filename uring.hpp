@@ -0,0 +1,786 @@
+//
+// Copyright (C) 2026 Oleg Polivets. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 
+// 1. Redistributions of source code must retain the above copyright 
+//    notice, this list of conditions and the following disclaimer.  
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.  
+// 3. Neither the name of the project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission. 
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+// SUCH DAMAGE.
+// 
+
+#pragma once
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/eventfd.h>
+#include <deque>
+#include <memory>
+#include "net.hpp"
+
+namespace op {
+
+/*
+ * io_uring ring over the raw syscalls, liburing is not needed. Entries
+ * are queued with sqe() and go to the kernel with one submit() that
+ * may also wait for completions. A ring belongs to one thread.
+ */
+
+class IOURing {
+public:
+    explicit IOURing(unsigned entries = 256)
+        : mFd(-1), mSqRing(0), mCqRing(0), mSqes(0), mSqRingSize(0), mCqRingSize(0)
+        , mSqTail(0), mSqSubmitted(0), mEnters(0)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        mFd = (int) ::syscall(__NR_io_uring_setup, entries, &p);
+        if (mFd < 0) {
+            WARN("io_uring_setup() err='%d'", errno);
+            return;
+        }
+        mSqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        mCqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+        }
+        mSqRing = map(mSqRingSize, IORING_OFF_SQ_RING);
+        mCqRing = single ? mSqRing : map(mCqRingSize, IORING_OFF_CQ_RING);
+        mSqes = (io_uring_sqe *) map(p.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+        if (!mSqRing || !mCqRing || !mSqes) {
+            close();
+            return;
+        }
+        mSqEntries = p.sq_entries;
+        mSqesSize  = p.sq_entries * sizeof(io_uring_sqe);
+        mSqHeadP   = (unsigned *) (mSqRing + p.sq_off.head);
+        mSqTailP   = (unsigned *) (mSqRing + p.sq_off.tail);
+        mSqMask    = *(unsigned *) (mSqRing + p.sq_off.ring_mask);
+        mSqArray   = (unsigned *) (mSqRing + p.sq_off.array);
+        mCqHeadP   = (unsigned *) (mCqRing + p.cq_off.head);
+        mCqTailP   = (unsigned *) (mCqRing + p.cq_off.tail);
+        mCqMask    = *(unsigned *) (mCqRing + p.cq_off.ring_mask);
+        mCqes      = (io_uring_cqe *) (mCqRing + p.cq_off.cqes);
+        mSqTail = mSqSubmitted = *mSqTailP;
+    }
+
+    ~IOURing() { close(); }
+
+    IOURing(const IOURing &) = delete;
+    IOURing & operator=(const IOURing &) = delete;
+
+    bool isOk() const { return mFd >= 0; }
+
+    // io_uring works here and knows everything used by URingServer and
+    // URingFileReader: multishot accept and recv came with Linux 6.0
+    static bool supported() {
+        static const bool value = probe();
+        return value;
+    }
+
+    // next free submission entry, zeroed; 0 when the queue is full
+    io_uring_sqe * sqe() {
+        const unsigned head = __atomic_load_n(mSqHeadP, __ATOMIC_ACQUIRE);
+        if (mSqTail - head >= mSqEntries) {
+            return 0;
+        }
+        const unsigned idx = mSqTail & mSqMask;
+        io_uring_sqe * e = &mSqes[idx];
+        memset(e, 0, sizeof(*e));
+        mSqArray[idx] = idx;
+        ++mSqTail;
+        return e;
+    }
+
+    // entry to fill, submits the queued ones first when the queue is full
+    io_uring_sqe * next() {
+        io_uring_sqe * e = sqe();
+        while (!e && submit() >= 0) {
+            e = sqe();
+        }
+        return e;
+    }
+
+    // hands the queued entries to the kernel and waits for waitFor
+    // completions, one io_uring_enter() for both; -1 on errors
+    int submit(unsigned waitFor = 0) {
+        __atomic_store_n(mSqTailP, mSqTail, __ATOMIC_RELEASE);
+        const unsigned toSubmit = mSqTail - mSqSubmitted;
+        if (toSubmit == 0 && waitFor == 0) {
+            return 0;
+        }
+        for (;;) {
+            ++mEnters;
+            int rc = (int) ::syscall(__NR_io_uring_enter, mFd, toSubmit, waitFor,
+                                     waitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+            if (rc < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EBUSY || errno == EAGAIN) return 0;  // completions to reap first
+                WARN("io_uring_enter() err='%d'", errno);
+                return -1;
+            }
+            mSqSubmitted += (unsigned) rc;
+            return rc;
+        }
+    }
+
+    // calls f(cqe) for every ready completion, returns their number
+    template <class F>
+    unsigned completions(F f) {
+        unsigned head = *mCqHeadP;
+        const unsigned tail = __atomic_load_n(mCqTailP, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        for (; head != tail; ++head, ++n) {
+            f(mCqes[head & mCqMask]);
+        }
+        __atomic_store_n(mCqHeadP, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // pins the buffers for IORING_OP_READ_FIXED/WRITE_FIXED
+    bool registerBuffers(const iovec * iov, unsigned count) {
+        if (::syscall(__NR_io_uring_register, mFd, IORING_REGISTER_BUFFERS, iov, count) != 0) {
+            WARN("IORING_REGISTER_BUFFERS err='%d'", errno);
+            return false;
+        }
+        return true;
+    }
+
+    // io_uring_enter() calls made so far
+    uint64_t enters() const { return mEnters; }
+
+private:
+    int mFd;
+    char * mSqRing;
+    char * mCqRing;
+    io_uring_sqe * mSqes;
+    size_t mSqRingSize;
+    size_t mCqRingSize;
+    size_t mSqesSize = 0;
+    unsigned mSqEntries = 0;
+    unsigned * mSqHeadP = 0;
+    unsigned * mSqTailP = 0;
+    unsigned mSqMask = 0;
+    unsigned * mSqArray = 0;
+    unsigned * mCqHeadP = 0;
+    unsigned * mCqTailP = 0;
+    unsigned mCqMask = 0;
+    io_uring_cqe * mCqes = 0;
+    unsigned mSqTail;
+    unsigned mSqSubmitted;
+    uint64_t mEnters;
+
+    char * map(size_t size, off_t offset) {
+        void * p = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, offset);
+        return p == MAP_FAILED ? 0 : (char *) p;
+    }
+
+    void close() {
+        if (mSqes) ::munmap(mSqes, mSqesSize);
+        if (mCqRing && mCqRing != mSqRing) ::munmap(mCqRing, mCqRingSize);
+        if (mSqRing) ::munmap(mSqRing, mSqRingSize);
+        if (mFd >= 0) ::close(mFd);
+        mSqes = 0;
+        mSqRing = mCqRing = 0;
+        mFd = -1;
+    }
+
+    static bool probe() {
+        struct utsname u;
+        int major = 0, minor = 0;
+        if (::uname(&u) != 0 || sscanf(u.release, "%d.%d", &major, &minor) != 2 || major < 6) {
+            return false;
+        }
+        IOURing ring(4);
+        if (!ring.isOk()) {
+            return false;
+        }
+        const unsigned ops = 256;
+        std::vector<char> buff(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op), 0);
+        io_uring_probe * p = (io_uring_probe *) &buff[0];
+        if (::syscall(__NR_io_uring_register, ring.mFd, IORING_REGISTER_PROBE, p, ops) != 0) {
+            return false;
+        }
+        const int needed[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                               IORING_OP_PROVIDE_BUFFERS, IORING_OP_READ_FIXED,
+                               IORING_OP_READ, IORING_OP_ASYNC_CANCEL };
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i) {
+            if (needed[i] > p->last_op || !(p->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};  // IOURing
+
+/*
+ * TCPServer with completion hooks: onConnect(), onData() with the bytes
+ * received and onDisconnect(); answers go out with send(). With the
+ * io_uring backend one multishot accept and a multishot recv for each
+ * connection stay armed, received data lands in a group of provided
+ * buffers, and all the submissions and completions of a loop iteration
+ * take one io_uring_enter(). Where io_uring is not available the same
+ * hooks are driven by eventLoop() and epoll.
+ */
+
+class URingServer : public TCPServer {
+public:
+    enum Backend { AUTO, EPOLL, URING };
+
+    explicit URingServer(unsigned port, unsigned buffers = 512, size_t bufferSize = 4096)
+        : TCPServer(port)
+        , mBackend(EPOLL)
+        , mBufferCount(buffers)
+        , mBufferSize(bufferSize)
+        , mStop(false)
+        , mWake(-1)
+        , mRing(0)
+        , mSyscalls(0)
+        , mEpollWaits(0)
+    {}
+
+    virtual ~URingServer() {
+        if (mWake >= 0) ::close(mWake);
+    }
+
+    // completion hooks, on the loop thread for both backends
+    virtual void onConnect(SOCKET sd) { (void) sd; }
+    virtual void onData(SOCKET sd, const char * data, size_t size) {
+        (void) sd; (void) data; (void) size;
+    }
+    virtual void onDisconnect(SOCKET sd) { (void) sd; }
+
+    // serves until stop(), AUTO takes io_uring when supported
+    void run(Backend backend = AUTO) {
+        if (backend == AUTO) {
+            backend = IOURing::supported() ? URING : EPOLL;
+        }
+        mBackend = backend;
+        if (backend == URING && runURing()) {
+            return;
+        }
+        mBackend = EPOLL;
+        eventLoop(1);
+    }
+
+    // backend in use by run()
+    Backend backend() const { return mBackend; }
+
+    void stop() {
+        mStop = true;
+        const int wake = mWake;
+        if (wake >= 0) {
+            uint64_t one = 1;
+            if (::write(wake, &one, sizeof(one)) < 0) {
+                WARN("eventfd write err='%d'", errno);
+            }
+        }
+        TCPServer::stop();
+    }
+
+    // queues the data to the connection, from the loop thread
+    void send(SOCKET sd, const char * data, size_t size) {
+        Connection * c = connection(sd);
+        if (!c || c->Closing) {
+            return;
+        }
+        c->Pending.append(data, size);
+        if (mBackend == URING) {
+            if (!c->Busy) sendNext(c);
+        } else {
+            flush(c);
+        }
+    }
+
+    // closes the connection after onDisconnect(), from the loop thread
+    void disconnect(SOCKET sd) {
+        Connection * c = connection(sd);
+        if (!c) {
+            return;
+        }
+        if (mBackend == URING) {
+            ++c->Inflight;      // onDisconnect() may call disconnect() again
+            drop(c);
+            --c->Inflight;
+            release(c);
+        } else if (!c->Closing) {
+            closeConnection(sd);
+        }
+    }
+
+    // io_uring_enter() calls, or epoll_wait() + recv() + send() calls
+    uint64_t syscalls() const { return mSyscalls + mEpollWaits; }
+
+protected:
+    // user_data of the submissions: connection pointer with the operation
+    // in the low bits
+    enum Op { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_PROVIDE, OP_WAKE, OP_CANCEL };
+    static const unsigned BUFFER_GROUP = 1;
+
+    struct Connection {
+        SOCKET Sd;
+        std::string Pending;    // queued by send()
+        std::string Sending;    // io_uring: in flight, unchanged until completed
+        size_t SentPos = 0;     // of Sending, or of Pending with epoll
+        bool Busy = false;      // send in flight
+        bool Closing = false;
+        unsigned Inflight = 0;  // requests the kernel still holds
+        explicit Connection(SOCKET sd) : Sd(sd) {}
+    };
+
+    Backend mBackend;
+    unsigned mBufferCount;
+    size_t mBufferSize;
+    std::atomic<bool> mStop;
+    std::atomic<int> mWake;
+    uint64_t mWakeValue = 0;
+    IOURing * mRing;
+    std::vector<char> mBuffers;
+    std::vector<Connection *> mConnections;     // by descriptor
+    size_t mOpen = 0;
+    bool mAcceptArmed = false;
+    uint64_t mSyscalls;
+    uint64_t mEpollWaits;
+    char mRecvBuffer[16 * 1024];
+
+    Connection * connection(SOCKET sd) const {
+        return (sd >= 0 && (size_t) sd < mConnections.size()) ? mConnections[sd] : 0;
+    }
+
+    Connection * attach(SOCKET sd) {
+        if ((size_t) sd >= mConnections.size()) {
+            mConnections.resize(std::max((size_t) sd + 1, mConnections.size() * 2), 0);
+        }
+        Connection * c = new Connection(sd);
+        mConnections[sd] = c;
+        ++mOpen;
+        TCPSocket::set_nodelay(sd, true);
+        return c;
+    }
+
+    void detach(Connection * c) {
+        mConnections[c->Sd] = 0;
+        --mOpen;
+        delete c;
+    }
+
+    // epoll backend: TCPServer hooks
+
+    void onAccept(SOCKET sd, sockaddr *, socklen_t) override {
+        attach(sd);
+        onConnect(sd);
+    }
+
+    void onReadable(SOCKET sd) override {
+        for (;;) {
+            ++mSyscalls;
+            int rc = ::recv(sd, mRecvBuffer, sizeof(mRecvBuffer), 0);
+            NetMetrics::io(NetMetrics::BYTES_IN, rc);
+            if (rc > 0) {
+                onData(sd, mRecvBuffer, (size_t) rc);
+                if (!connection(sd)) return;
+                continue;
+            }
+            if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                closeConnection(sd);
+            }
+            break;
+        }
+        mEpollWaits = EventLoop::current()->waits();
+    }
+
+    void onWritable(SOCKET sd) override {
+        Connection * c = connection(sd);
+        if (c) flush(c);
+    }
+
+    void onClose(SOCKET sd) override {
+        Connection * c = connection(sd);
+        if (c) {
+            c->Closing = true;
+            onDisconnect(sd);
+            detach(c);
+        }
+    }
+
+    void flush(Connection * c) {
+        while (c->SentPos < c->Pending.size()) {
+            ++mSyscalls;
+            int rc = ::send(c->Sd, c->Pending.data() + c->SentPos, c->Pending.size() - c->SentPos,
+                            MSG_NOSIGNAL);
+            NetMetrics::io(NetMetrics::BYTES_OUT, rc);
+            if (rc < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) closeConnection(c->Sd);
+                return;
+            }
+            c->SentPos += (size_t) rc;
+        }
+        c->Pending.clear();
+        c->SentPos = 0;
+    }
+
+    // io_uring backend
+
+    static uint64_t userData(Connection * c, Op op) { return (uint64_t) (uintptr_t) c | op; }
+
+    bool runURing() {
+        IOURing ring(1024);
+        if (!ring.isOk()) {
+            return false;
+        }
+        // kept until the destructor, stop() may write to it any time
+        if (mWake < 0) {
+            mWake = ::eventfd(0, EFD_CLOEXEC);
+        }
+        const int wake = mWake;
+        if (wake < 0) {
+            return false;
+        }
+        mRing = &ring;
+        mBuffers.assign(mBufferCount * mBufferSize, 0);
+        provide(0, mBufferCount);
+        armAccept();
+        io_uring_sqe * e = ring.next();
+        e->opcode    = IORING_OP_READ;
+        e->fd        = wake;
+        e->addr      = (uint64_t) (uintptr_t) &mWakeValue;
+        e->len       = sizeof(mWakeValue);
+        e->user_data = OP_WAKE;
+
+        LOG("+URING");
+        while (!mStop) {
+            if (ring.submit(1) < 0) {
+                break;
+            }
+            ring.completions([this](const io_uring_cqe & cqe) { complete(cqe); });
+        }
+
+        // shut the connections down and wait for their requests to end
+        for (size_t i = 0; i < mConnections.size(); ++i) {
+            if (mConnections[i]) {
+                disconnect((SOCKET) i);
+            }
+        }
+        if (mAcceptArmed) {
+            io_uring_sqe * c = ring.next();
+            c->opcode    = IORING_OP_ASYNC_CANCEL;
+            c->addr      = OP_ACCEPT;
+            c->user_data = OP_CANCEL;
+        }
+        while (mOpen > 0 || mAcceptArmed) {
+            if (ring.submit(1) < 0) {
+                break;
+            }
+            ring.completions([this](const io_uring_cqe & cqe) { complete(cqe); });
+        }
+        mSyscalls += ring.enters();
+        NetMetrics::add(NetMetrics::SYSCALLS, (int64_t) ring.enters());
+        mRing = 0;
+        CLOSE_SOCKET(mSrvSocket);
+        LOG("-URING");
+        return true;
+    }
+
+    void complete(const io_uring_cqe & cqe) {
+        Connection * c = (Connection *) (uintptr_t) (cqe.user_data & ~(uint64_t) 7);
+        const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+        switch ((Op) (cqe.user_data & 7)) {
+        case OP_ACCEPT:
+            if (!more) mAcceptArmed = false;
+            if (cqe.res >= 0) {
+                SOCKET sd = cqe.res;
+                if (mStop) {
+                    CLOSE_SOCKET(sd);
+                    break;
+                }
+                Connection * n = attach(sd);
+                countAccept();
+                // held over the hook: onConnect() may disconnect()
+                ++n->Inflight;
+                onConnect(sd);
+                --n->Inflight;
+                if (!n->Closing) armRecv(n);
+                release(n);
+            } else if (cqe.res != -ECANCELED) {
+                WARN("accept err='%d'", -cqe.res);
+            }
+            if (!mAcceptArmed && !mStop) armAccept();
+            break;
+        case OP_RECV:
+            // the request is let go only after the hooks, which may disconnect()
+            if (cqe.res > 0) NetMetrics::add(NetMetrics::BYTES_IN, cqe.res);
+            if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+                const unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                if (!c->Closing) onData(c->Sd, &mBuffers[bid * mBufferSize], (size_t) cqe.res);
+                provide(bid, 1);
+                if (!more && !c->Closing) armRecv(c);
+            } else if (cqe.res == -ENOBUFS) {
+                if (!c->Closing) armRecv(c);     // buffers are given back by then
+            } else {
+                drop(c);
+            }
+            if (!more) --c->Inflight;
+            release(c);
+            break;
+        case OP_SEND:
+            c->Busy = false;
+            if (cqe.res < 0) {
+                drop(c);
+            } else {
+                NetMetrics::add(NetMetrics::BYTES_OUT, cqe.res);
+                c->SentPos += (size_t) cqe.res;
+                if (c->SentPos == c->Sending.size()) {
+                    c->Sending.clear();
+                    c->SentPos = 0;
+                }
+                if (!c->Closing) sendNext(c);
+            }
+            --c->Inflight;
+            release(c);
+            break;
+        case OP_PROVIDE:
+            if (cqe.res < 0) WARN("provide buffers err='%d'", -cqe.res);
+            break;
+        case OP_WAKE:
+        case OP_CANCEL:
+            break;
+        }
+    }
+
+    void armAccept() {
+        io_uring_sqe * e = mRing->next();
+        e->opcode       = IORING_OP_ACCEPT;
+        e->fd           = mSrvSocket;
+        e->ioprio       = IORING_ACCEPT_MULTISHOT;
+        e->accept_flags = SOCK_CLOEXEC;
+        e->user_data    = OP_ACCEPT;
+        mAcceptArmed = true;
+    }
+
+    void armRecv(Connection * c) {
+        io_uring_sqe * e = mRing->next();
+        e->opcode    = IORING_OP_RECV;
+        e->fd        = c->Sd;
+        e->ioprio    = IORING_RECV_MULTISHOT;
+        e->flags     = IOSQE_BUFFER_SELECT;
+        e->buf_group = BUFFER_GROUP;
+        e->user_data = userData(c, OP_RECV);
+        ++c->Inflight;
+    }
+
+    // gives count buffers starting from bid back to the kernel
+    void provide(unsigned bid, unsigned count) {
+        io_uring_sqe * e = mRing->next();
+        e->opcode    = IORING_OP_PROVIDE_BUFFERS;
+        e->fd        = (int) count;
+        e->addr      = (uint64_t) (uintptr_t) &mBuffers[bid * mBufferSize];
+        e->len       = (unsigned) mBufferSize;
+        e->off       = bid;
+        e->buf_group = BUFFER_GROUP;
+        e->user_data = OP_PROVIDE;
+    }
+
+    // one send in flight per connection: what was queued meanwhile goes next
+    void sendNext(Connection * c) {
+        if (c->Sending.empty()) {
+            if (c->Pending.empty()) return;
+            c->Sending.swap(c->Pending);
+            c->SentPos = 0;
+        }
+        io_uring_sqe * e = mRing->next();
+        e->opcode    = IORING_OP_SEND;
+        e->fd        = c->Sd;
+        e->addr      = (uint64_t) (uintptr_t) (c->Sending.data() + c->SentPos);
+        e->len       = (unsigned) (c->Sending.size() - c->SentPos);
+        e->msg_flags = MSG_NOSIGNAL;
+        e->user_data = userData(c, OP_SEND);
+        c->Busy = true;
+        ++c->Inflight;
+    }
+
+    // shutdown() ends the requests in flight, release() frees the
+    // connection with the last of them
+    void drop(Connection * c) {
+        if (!c->Closing) {
+            c->Closing = true;
+            onDisconnect(c->Sd);
+            ::shutdown(c->Sd, SHUT_RDWR);
+        }
+    }
+
+    void release(Connection * c) {
+        if (c->Closing && c->Inflight == 0) {
+            ::close(c->Sd);
+            detach(c);
+            countClose();
+        }
+    }
+};  // URingServer
+
+/*
+ * Reads files block by block into registered buffers: depth reads are
+ * in flight at once and one io_uring_enter() submits new reads and
+ * reaps the finished ones. Blocks reach the sink in file order.
+ * Without io_uring it is a pread() loop.
+ */
+
+class URingFileReader {
+public:
+    typedef std::function<bool(const char * data, size_t size, uint64_t offset)> Sink;
+
+    explicit URingFileReader(unsigned depth = 8, size_t blockSize = 128 * 1024, bool useURing = true)
+        : mDepth(std::max(1u, depth))
+        , mBlockSize(blockSize)
+        , mBuffers(mDepth * blockSize)
+    {
+        if (useURing && IOURing::supported()) {
+            mRing.reset(new IOURing(mDepth * 2));
+            std::vector<iovec> iov(mDepth);
+            for (unsigned i = 0; i < mDepth; ++i) {
+                iov[i].iov_base = &mBuffers[i * mBlockSize];
+                iov[i].iov_len  = mBlockSize;
+            }
+            if (!mRing->isOk() || !mRing->registerBuffers(&iov[0], mDepth)) {
+                mRing.reset();
+            }
+        }
+    }
+
+    bool usesURing() const { return mRing != nullptr; }
+
+    // submit() calls, or pread() calls without io_uring
+    uint64_t syscalls() const { return mRing ? mRing->enters() : mPreads; }
+
+    // the whole file
+    int64_t read(int fd, const Sink & sink) {
+        struct stat s;
+        if (::fstat(fd, &s) != 0) {
+            return -1;
+        }
+        return read(fd, 0, (uint64_t) s.st_size, sink);
+    }
+
+    // bytes [offset, offset + length) to the sink, returns the number of
+    // bytes read, less at the end of file, or -1 on errors
+    int64_t read(int fd, uint64_t offset, uint64_t length, const Sink & sink) {
+        return mRing ? readURing(fd, offset, offset + length, sink)
+                     : readSync(fd, offset, offset + length, sink);
+    }
+
+private:
+    unsigned mDepth;
+    size_t mBlockSize;
+    std::vector<char> mBuffers;
+    std::unique_ptr<IOURing> mRing;
+    uint64_t mPreads = 0;
+
+    int64_t readSync(int fd, uint64_t offset, uint64_t end, const Sink & sink) {
+        uint64_t pos = offset;
+        while (pos < end) {
+            size_t want = (size_t) std::min<uint64_t>(mBlockSize, end - pos);
+            ++mPreads;
+            ssize_t rc = ::pread(fd, &mBuffers[0], want, (off_t) pos);
+            if (rc < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (rc == 0) break;
+            if (!sink(&mBuffers[0], (size_t) rc, pos)) break;
+            pos += (uint64_t) rc;
+        }
+        return (int64_t) (pos - offset);
+    }
+
+    struct Block {
+        uint64_t Offset = 0;
+        int Result = 0;
+        bool Done = false;
+    };
+
+    int64_t readURing(int fd, uint64_t offset, uint64_t end, const Sink & sink) {
+        std::vector<Block> blocks(mDepth);
+        std::deque<unsigned> order;         // slots in file order
+        std::vector<unsigned> freeSlots;
+        for (unsigned i = mDepth; i-- > 0;) freeSlots.push_back(i);
+        uint64_t next = offset, delivered = offset;
+        bool failed = false, stopped = false;
+
+        while (!order.empty() || (next < end && !failed && !stopped)) {
+            while (!freeSlots.empty() && next < end && !failed && !stopped) {
+                const unsigned slot = freeSlots.back();
+                freeSlots.pop_back();
+                const size_t want = (size_t) std::min<uint64_t>(mBlockSize, end - next);
+                io_uring_sqe * e = mRing->next();
+                e->opcode    = IORING_OP_READ_FIXED;
+                e->fd        = fd;
+                e->addr      = (uint64_t) (uintptr_t) &mBuffers[slot * mBlockSize];
+                e->len       = (unsigned) want;
+                e->off       = next;
+                e->buf_index = (uint16_t) slot;
+                e->user_data = slot;
+                blocks[slot].Offset = next;
+                blocks[slot].Done = false;
+                order.push_back(slot);
+                next += want;
+            }
+            if (mRing->submit(1) < 0) {
+                return -1;  // requests may still be in flight, the ring is unusable
+            }
+            mRing->completions([&blocks](const io_uring_cqe & cqe) {
+                Block & b = blocks[cqe.user_data];
+                b.Result = cqe.res;
+                b.Done = true;
+            });
+            while (!order.empty() && blocks[order.front()].Done) {
+                const unsigned slot = order.front();
+                order.pop_front();
+                freeSlots.push_back(slot);
+                const Block & b = blocks[slot];
+                if (failed || stopped || b.Offset != delivered) {
+                    continue;   // after an error or a short read
+                }
+                if (b.Result < 0) {
+                    failed = true;
+                    continue;
+                }
+                if (b.Result > 0 && !sink(&mBuffers[slot * mBlockSize], (size_t) b.Result, b.Offset)) {
+                    stopped = true;
+                }
+                delivered += (uint64_t) b.Result;
+                const uint64_t want = std::min<uint64_t>(mBlockSize, end - b.Offset);
+                if ((uint64_t) b.Result < want) {
+                    stopped = true;     // end of file
+                }
+            }
+        }
+        return failed ? -1 : (int64_t) (delivered - offset);
+    }
+};  // URingFileReader
+
+} // namespace op
+
+#endif // __linux__
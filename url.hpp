@@ -33,71 +33,189 @@
 #include <cctype>
 #include <iomanip>
 #include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
 #include "strutils.hpp"
 
 namespace op {
 
 /*
- * A class that able to parse string with representation of URL
- * for example "protocol://host:port/path?query_string".
- * And also Encode/Decode using urlencode() for invalid URL characters.
+ * Index over the "key=value&key=value" query string. Nothing is split
+ * until the first lookup; keys and values are views into the original
+ * string, so it must outlive the index. Values are percent-decoded only
+ * when asked for with value()/values(). Keys are matched as is (raw).
  */
 
-class URL {
+class QueryParams {
 public:
-    std::string QueryString;
-    std::string Path;
-    std::string Protocol;
-    std::string Host;
-    std::string Port;
+    typedef std::string_view view_t;
 
-static URL Parse(const std::string & uri) {
-    URL result;
+    struct Param {
+        view_t Key;
+        view_t Value;   // raw, still percent-encoded
+        unsigned Next;  // next param with the same key or npos
+    };
+
+    static const unsigned npos = (unsigned) -1;
+
+    explicit QueryParams(view_t query = view_t())
+        : mQuery(query)
+        , mIndexed(false)
+    {}
+
+    size_t size() const { index(); return mParams.size(); }
+    bool empty() const  { return size() == 0; }
+    const Param & at(size_t i) const { index(); return mParams.at(i); }
+
+    bool has(view_t key) const { return first(key) != npos; }
+
+    size_t count(view_t key) const {
+        size_t n = 0;
+        for (unsigned i = first(key); i != npos; i = mParams[i].Next) ++n;
+        return n;
+    }
+
+    // first raw value of the key, or empty view
+    view_t raw(view_t key) const {
+        unsigned i = first(key);
+        return (i != npos) ? mParams[i].Value : view_t();
+    }
+
+    // first decoded value of the key, or def
+    std::string value(view_t key, const std::string & def = std::string()) const;
+
+    // all values of the repeated key in the original order
+    std::vector<view_t> raws(view_t key) const {
+        std::vector<view_t> result;
+        for (unsigned i = first(key); i != npos; i = mParams[i].Next)
+            result.push_back(mParams[i].Value);
+        return result;
+    }
+    std::vector<std::string> values(view_t key) const;
+
+private:
+    view_t mQuery;
+    mutable bool mIndexed;
+    mutable std::vector<Param> mParams;
+    // key -> (first, last) index in mParams
+    mutable std::unordered_map<view_t, std::pair<unsigned, unsigned> > mKeys;
+
+    unsigned first(view_t key) const {
+        index();
+        auto it = mKeys.find(key);
+        return (it != mKeys.end()) ? it->second.first : npos;
+    }
+
+    void index() const {
+        if (mIndexed) return;
+        mIndexed = true;
+        view_t q = mQuery.substr(0, mQuery.find('#'));
+        size_t n = std::count(q.begin(), q.end(), '&') + 1;
+        mParams.reserve(n);
+        mKeys.reserve(n);
+        for (size_t pos = 0; pos <= q.size();) {
+            size_t end = q.find('&', pos);
+            if (end == view_t::npos) end = q.size();
+            view_t pair = q.substr(pos, end - pos);
+            pos = end + 1;
+            if (pair.empty()) continue;
+            size_t eq = pair.find('=');
+            Param p;
+            p.Key   = pair.substr(0, eq);
+            p.Value = (eq != view_t::npos) ? pair.substr(eq + 1) : view_t();
+            p.Next  = npos;
+            unsigned idx = (unsigned) mParams.size();
+            auto ins = mKeys.emplace(p.Key, std::make_pair(idx, idx));
+            if (!ins.second) {
+                mParams[ins.first->second.second].Next = idx;
+                ins.first->second.second = idx;
+            }
+            mParams.push_back(p);
+        }
+    }
+};  // QueryParams
+
+/*
+ * Same split as URL::Parse() but without copies: all parts are views
+ * into the parsed string. Used where URLs are parsed in bulk.
+ */
+
+struct URLView {
+    std::string_view QueryString;
+    std::string_view Path;
+    std::string_view Protocol;
+    std::string_view Host;
+    std::string_view Port;
+
+static URLView Parse(std::string_view uri) {
+    typedef std::string_view view_t;
+    URLView result;
     if (uri.length() == 0) {
         return result;
     }
-    typedef std::string::const_iterator iterator_t;
-    iterator_t uriEnd = uri.end();
     // get query start
-    iterator_t queryStart = std::find(uri.begin(), uriEnd, '?');
+    size_t queryStart = std::min(uri.find('?'), uri.size());
+    view_t beforeQuery = uri.substr(0, queryStart);
     // protocol
-    iterator_t protocolStart = uri.begin();
-    iterator_t protocolEnd = std::find(protocolStart, uriEnd, ':');
-    if (protocolEnd != uriEnd) {
-        std::string prot = &*(protocolEnd);
-        if ((prot.length() > 3) && (prot.substr(0, 3) == "://")) {
-            result.Protocol = std::string(protocolStart, protocolEnd);
-            protocolEnd += 3;   //      ://
-        } else {
-            protocolEnd = uri.begin();  // no protocol
-        }
-    } else {
-        protocolEnd = uri.begin();  // no protocol
+    size_t hostStart = 0;
+    size_t protocolEnd = beforeQuery.find(':');
+    if (protocolEnd != view_t::npos && uri.size() > protocolEnd + 3
+            && uri.compare(protocolEnd, 3, "://") == 0) {
+        result.Protocol = uri.substr(0, protocolEnd);
+        hostStart = protocolEnd + 3;    //      ://
     }
     // hostname
-    iterator_t hostStart = protocolEnd;
-    iterator_t pathStart = std::find(hostStart, uriEnd, '/');  // get pathStart
-    iterator_t hostEnd = std::find(protocolEnd, 
-        (pathStart != uriEnd) ? pathStart : queryStart, ':');  // check for port
-    result.Host = std::string(hostStart, hostEnd);
+    size_t pathStart = std::min(beforeQuery.find('/', hostStart), queryStart);
+    view_t hostPort = uri.substr(hostStart, pathStart - hostStart);
+    size_t portStart = hostPort.find(':');
+    result.Host = hostPort.substr(0, portStart);
     // port
-    if ((hostEnd != uriEnd) && ((&*(hostEnd))[0] == L':')) {
-        // we've a port
-        hostEnd++;
-        iterator_t portEnd = (pathStart != uriEnd) ? pathStart : queryStart;
-        result.Port = std::string(hostEnd, portEnd);
+    if (portStart != view_t::npos) {
+        result.Port = hostPort.substr(portStart + 1);
     }
     // path
-    if (pathStart != uriEnd) {
-        result.Path = std::string(pathStart + 1, queryStart);
+    if (pathStart < queryStart) {
+        result.Path = uri.substr(pathStart + 1, queryStart - pathStart - 1);
     }
     // query string
-    if (queryStart != uriEnd) {
-        result.QueryString = std::string(queryStart + 1, uri.end());
+    if (queryStart < uri.size()) {
+        result.QueryString = uri.substr(queryStart + 1);
     }
     return result;
 }   // Parse
 
+};  // URLView
+
+/*
+ * A class that able to parse string with representation of URL
+ * for example "protocol://host:port/path?query_string".
+ * And also Encode/Decode using urlencode() for invalid URL characters.
+ */
+
+class URL {
+public:
+    std::string QueryString;
+    std::string Path;
+    std::string Protocol;
+    std::string Host;
+    std::string Port;
+
+    // lazy index over QueryString, valid while this URL is alive
+    QueryParams Params() const { return QueryParams(QueryString); }
+
+static URL Parse(const std::string & uri) {
+    URL result;
+    URLView v = URLView::Parse(uri);
+    result.QueryString.assign(v.QueryString.data(), v.QueryString.size());
+    result.Path.assign(v.Path.data(), v.Path.size());
+    result.Protocol.assign(v.Protocol.data(), v.Protocol.size());
+    result.Host.assign(v.Host.data(), v.Host.size());
+    result.Port.assign(v.Port.data(), v.Port.size());
+    return result;
+}   // Parse
+
 static std::string Encode(const std::string & value) {
     std::ostringstream escaped;
     escaped.fill('0');
@@ -121,28 +239,217 @@ static std::string Encode(const std::string & value) {
     return escaped.str();
 } // Encode
 
-static std::string Decode(const std::string & value) {
-    std::ostringstream unescaped;
+static std::string Decode(std::string_view value) {
+    std::string unescaped;
+    unescaped.reserve(value.size());
 
-    for (std::string::const_iterator i = value.begin(), n = value.end(); i != n;) {
-        std::string::value_type c = (*i++);
+    for (std::string_view::const_iterator i = value.begin(), n = value.end(); i != n;) {
+        char c = (*i++);
         if (c != '%') {
-            unescaped << (c == '+' ? ' ' : c);
+            unescaped.push_back(c == '+' ? ' ' : c);
             continue;
         }
 
         if (i + 2 > n) {
             break;
         }
-        std::string::value_type h = (*i++);
-        std::string::value_type l = (*i++);
+        char h = (*i++);
+        char l = (*i++);
         c = 0;
         op::StrUtils::hexByte(h, l, &c);
-        unescaped << ((unsigned char) c);
+        unescaped.push_back(c);
     }
 
-    return unescaped.str();
+    return unescaped;
 } // Decode
 
 };  // URL
-}   // namespace op {
\ No newline at end of file
+
+/*
+ * Canonical form of the URL for cache keys, built in one pass over the
+ * URLView parts: lowercase scheme and host, default port removed, dot
+ * segments removed, query parameters sorted, percent-escapes of the
+ * unreserved characters decoded and the rest uppercased, fragment dropped.
+ * FNV-1a 64 hash is computed while the form is emitted, the canonical
+ * string itself is written only when asked for.
+ */
+
+class URLCanonical {
+public:
+    typedef std::string_view view_t;
+
+    static uint64_t Hash(view_t uri, std::string * out = 0) {
+        URLCanonical c(out);
+        c.emit(uri);
+        return c.mHash;
+    }
+
+    static std::string String(view_t uri) {
+        std::string out;
+        Hash(uri, &out);
+        return out;
+    }
+
+private:
+    uint64_t mHash;
+    std::string * mOut;
+
+    explicit URLCanonical(std::string * out)
+        : mHash(0xcbf29ce484222325ULL)
+        , mOut(out)
+    {
+        if (mOut) {
+            mOut->clear();
+        }
+    }
+
+    void put(char c) {
+        mHash = (mHash ^ (unsigned char) c) * 0x100000001b3ULL;
+        if (mOut) mOut->push_back(c);
+    }
+    void put(view_t s) {
+        for (size_t i = 0; i < s.size(); ++i) put(s[i]);
+    }
+    void putLower(view_t s) {
+        for (size_t i = 0; i < s.size(); ++i) put((char) ::tolower((unsigned char) s[i]));
+    }
+    void putNorm(view_t s) {
+        char b[3];
+        for (size_t i = 0; i < s.size();) {
+            unsigned n = norm(s, i, b);
+            for (unsigned k = 0; k < n; ++k) put(b[k]);
+        }
+    }
+
+    static bool isUnreserved(char c) {
+        return ::isalnum((unsigned char) c) || c == '-' || c == '.' || c == '_' || c == '~';
+    }
+
+    // normalized bytes of the character at s[i], advances i
+    static unsigned norm(view_t s, size_t & i, char out[3]) {
+        static const char hex[] = "0123456789ABCDEF";
+        unsigned char c = s[i++];
+        if (c == '%' && i + 2 <= s.size()) {
+            char h, l;
+            if (op::StrUtils::hexNibble(s[i], &h) && op::StrUtils::hexNibble(s[i + 1], &l)) {
+                i += 2;
+                c = (unsigned char) ((h << 4) | l);
+                if (isUnreserved(c)) {
+                    out[0] = c;
+                    return 1;
+                }
+            } else {
+                c = '%';    // stray percent sign
+            }
+        } else if (c != '%' && c > ' ' && c < 0x7f) {
+            out[0] = c;
+            return 1;
+        }
+        out[0] = '%';
+        out[1] = hex[c >> 4];
+        out[2] = hex[c & 0x0f];
+        return 3;
+    }
+
+    static int compareNorm(view_t a, view_t b) {
+        char ba[3], bb[3];
+        unsigned na = 0, nb = 0, ia = 0, ib = 0;
+        size_t pa = 0, pb = 0;
+        for (;;) {
+            if (ia == na) { if (pa == a.size()) break; na = norm(a, pa, ba); ia = 0; }
+            if (ib == nb) { if (pb == b.size()) return 1; nb = norm(b, pb, bb); ib = 0; }
+            if (ba[ia] != bb[ib]) return (unsigned char) ba[ia] < (unsigned char) bb[ib] ? -1 : 1;
+            ++ia;
+            ++ib;
+        }
+        return (ib == nb && pb == b.size()) ? 0 : -1;
+    }
+
+    static bool isDefaultPort(view_t scheme, view_t port) {
+        static const struct { const char * scheme; const char * port; } defaults[] = {
+            { "http", "80" }, { "https", "443" }, { "ws", "80" }, { "wss", "443" }, { "ftp", "21" }
+        };
+        if (port.empty()) return true;
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) {
+            view_t d(defaults[i].scheme);
+            if (port != defaults[i].port || d.size() != scheme.size()) continue;
+            bool same = true;
+            for (size_t k = 0; same && k < d.size(); ++k)
+                same = (::tolower((unsigned char) scheme[k]) == d[k]);
+            if (same) return true;
+        }
+        return false;
+    }
+
+    void emit(view_t uri) {
+        URLView url = URLView::Parse(uri.substr(0, uri.find('#')));
+
+        if (!url.Protocol.empty()) {
+            putLower(url.Protocol);
+            put(view_t("://"));
+        }
+        putLower(url.Host);
+        if (!isDefaultPort(url.Protocol, url.Port)) {
+            put(':');
+            put(url.Port);
+        }
+
+        // path without dot segments
+        thread_local std::vector<view_t> segments;
+        segments.clear();
+        for (size_t pos = 0; !url.Path.empty();) {
+            size_t end = std::min(url.Path.find('/', pos), url.Path.size());
+            view_t seg = url.Path.substr(pos, end - pos);
+            bool last = (end == url.Path.size());
+            bool dot    = (compareNorm(seg, ".") == 0);
+            bool dotdot = !dot && (compareNorm(seg, "..") == 0);
+            if (dotdot && !segments.empty()) segments.pop_back();
+            if (dot || dotdot) {
+                if (last) segments.push_back(view_t());
+            } else {
+                segments.push_back(seg);
+            }
+            if (last) break;
+            pos = end + 1;
+        }
+        put('/');
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (i > 0) put('/');
+            putNorm(segments[i]);
+        }
+
+        // sorted query
+        thread_local std::vector<view_t> params;
+        params.clear();
+        for (size_t pos = 0; pos < url.QueryString.size();) {
+            size_t end = std::min(url.QueryString.find('&', pos), url.QueryString.size());
+            if (end > pos) params.push_back(url.QueryString.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        std::sort(params.begin(), params.end(), [](view_t a, view_t b) {
+            return compareNorm(a, b) < 0;
+        });
+        for (size_t i = 0; i < params.size(); ++i) {
+            put(i == 0 ? '?' : '&');
+            size_t eq = params[i].find('=');
+            putNorm(params[i].substr(0, eq));
+            if (eq != view_t::npos) {
+                put('=');
+                putNorm(params[i].substr(eq + 1));
+            }
+        }
+    }
+};  // URLCanonical
+
+inline std::string QueryParams::value(view_t key, const std::string & def) const {
+    unsigned i = first(key);
+    return (i != npos) ? URL::Decode(mParams[i].Value) : def;
+}
+
+inline std::vector<std::string> QueryParams::values(view_t key) const {
+    std::vector<std::string> result;
+    for (unsigned i = first(key); i != npos; i = mParams[i].Next)
+        result.push_back(URL::Decode(mParams[i].Value));
+    return result;
+}
+}   // namespace op {
\ No newline at end of file